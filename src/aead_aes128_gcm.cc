@@ -0,0 +1,443 @@
+#include "aead_aes128_gcm.hh"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace maf {
+
+// AES-128 (FIPS-197) & GCM (NIST SP 800-38D), with 96-bit nonces only.
+
+static constexpr U8 XTime(U8 x) { return (x << 1) ^ ((x >> 7) * 0x1b); }
+
+static constexpr U8 RotL8(U8 x, int n) { return (x << n) | (x >> (8 - n)); }
+
+// Generates the S-box by walking the multiplicative group of GF(2^8) with
+// generator 3 (p) & its inverse (q).
+static constexpr Arr<U8, 256> MakeSBox() {
+  Arr<U8, 256> sbox = {};
+  U8 p = 1, q = 1;
+  do {
+    p = p ^ XTime(p);
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    if (q & 0x80) {
+      q ^= 0x09;
+    }
+    sbox[p] = q ^ RotL8(q, 1) ^ RotL8(q, 2) ^ RotL8(q, 3) ^ RotL8(q, 4) ^ 0x63;
+  } while (p != 1);
+  sbox[0] = 0x63;
+  return sbox;
+}
+
+static constexpr Arr<U8, 256> kSBox = MakeSBox();
+
+static_assert(kSBox[0x53] == 0xed);
+
+static bool CpuHasAES_CLMUL() {
+#if defined(__x86_64__)
+  return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") &&
+         __builtin_cpu_supports("ssse3");
+#else
+  return false;
+#endif
+}
+
+static const bool kCpuHasAES_CLMUL = CpuHasAES_CLMUL();
+
+bool aes128_gcm_hardware = kCpuHasAES_CLMUL;
+
+static U64 LoadBig64(const U8 *p) {
+  U64 x;
+  memcpy(&x, p, 8);
+  return __builtin_bswap64(x);
+}
+
+static void StoreBig64(U8 *p, U64 x) {
+  x = __builtin_bswap64(x);
+  memcpy(p, &x, 8);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Portable implementation
+////////////////////////////////////////////////////////////////////////////////
+
+// Table lookups depend on the data, so this isn't constant-time.
+static void EncryptBlockPortable(const AES128_GCM &key, const U8 in[16],
+                                 U8 out[16]) {
+  U8 s[16];
+  for (int i = 0; i < 16; ++i) {
+    s[i] = in[i] ^ key.round_keys[0][i];
+  }
+  for (int round = 1; round <= 10; ++round) {
+    // State is column-major: byte `r` of column `c` is at `c * 4 + r`.
+    U8 t[16];
+    for (int c = 0; c < 4; ++c) {
+      for (int r = 0; r < 4; ++r) { // SubBytes & ShiftRows
+        t[c * 4 + r] = kSBox[s[((c + r) & 3) * 4 + r]];
+      }
+    }
+    if (round != 10) {
+      for (int c = 0; c < 4; ++c) { // MixColumns
+        U8 *a = t + c * 4;
+        U8 a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+        U8 all = a0 ^ a1 ^ a2 ^ a3;
+        a[0] = a0 ^ all ^ XTime(a0 ^ a1);
+        a[1] = a1 ^ all ^ XTime(a1 ^ a2);
+        a[2] = a2 ^ all ^ XTime(a2 ^ a3);
+        a[3] = a3 ^ all ^ XTime(a3 ^ a0);
+      }
+    }
+    for (int i = 0; i < 16; ++i) {
+      s[i] = t[i] ^ key.round_keys[round][i];
+    }
+  }
+  memcpy(out, s, 16);
+}
+
+// Multiplication in GF(2^128) with the bit order of GCM (constant-time).
+static void GfMulPortable(U64 &x_hi, U64 &x_lo, U64 h_hi, U64 h_lo) {
+  U64 z_hi = 0, z_lo = 0;
+  U64 v_hi = h_hi, v_lo = h_lo;
+  for (int i = 0; i < 128; ++i) {
+    U64 bit = i < 64 ? (x_hi >> (63 - i)) & 1 : (x_lo >> (127 - i)) & 1;
+    U64 mask = -bit;
+    z_hi ^= v_hi & mask;
+    z_lo ^= v_lo & mask;
+    U64 lsb = v_lo & 1;
+    v_lo = (v_lo >> 1) | (v_hi << 63);
+    v_hi = (v_hi >> 1) ^ (0xe100000000000000ull & -lsb);
+  }
+  x_hi = z_hi;
+  x_lo = z_lo;
+}
+
+// Absorb `data` (zero-padded to 16 bytes) into the GHASH state.
+static void GhashPortable(const AES128_GCM &key, U64 &x_hi, U64 &x_lo,
+                          Span<> data) {
+  const U8 *p = (const U8 *)data.data();
+  Size n = data.size();
+  while (n) {
+    U8 block[16] = {};
+    Size len = n < 16 ? n : 16;
+    memcpy(block, p, len);
+    x_hi ^= LoadBig64(block);
+    x_lo ^= LoadBig64(block + 8);
+    GfMulPortable(x_hi, x_lo, key.h_hi, key.h_lo);
+    p += len;
+    n -= len;
+  }
+}
+
+// Counter mode starting with counter value 2 (1 is used for the tag).
+static void CtrPortable(const AES128_GCM &key, Span<char, 12> nonce,
+                        Span<> data) {
+  U8 counter[16];
+  memcpy(counter, nonce.data(), 12);
+  U32 ctr = 2;
+  U8 *p = (U8 *)data.data();
+  Size n = data.size();
+  while (n) {
+    U32 ctr_big = __builtin_bswap32(ctr++);
+    memcpy(counter + 12, &ctr_big, 4);
+    U8 stream[16];
+    EncryptBlockPortable(key, counter, stream);
+    Size len = n < 16 ? n : 16;
+    for (Size i = 0; i < len; ++i) {
+      p[i] ^= stream[i];
+    }
+    p += len;
+    n -= len;
+  }
+}
+
+static Arr<char, 16> TagPortable(const AES128_GCM &key, Span<char, 12> nonce,
+                                 Span<> ciphertext, Span<> aad) {
+  U64 x_hi = 0, x_lo = 0;
+  GhashPortable(key, x_hi, x_lo, aad);
+  GhashPortable(key, x_hi, x_lo, ciphertext);
+  x_hi ^= (U64)aad.size() * 8;
+  x_lo ^= (U64)ciphertext.size() * 8;
+  GfMulPortable(x_hi, x_lo, key.h_hi, key.h_lo);
+
+  U8 j0[16];
+  memcpy(j0, nonce.data(), 12);
+  j0[12] = j0[13] = j0[14] = 0;
+  j0[15] = 1;
+  U8 mask[16];
+  EncryptBlockPortable(key, j0, mask);
+
+  Arr<char, 16> tag;
+  StoreBig64((U8 *)tag.data(), x_hi);
+  StoreBig64((U8 *)tag.data() + 8, x_lo);
+  for (int i = 0; i < 16; ++i) {
+    tag[i] ^= mask[i];
+  }
+  return tag;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// AES-NI & PCLMULQDQ implementation
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__x86_64__)
+
+#define AES_CLMUL_TARGET __attribute__((target("aes,pclmul,ssse3")))
+
+AES_CLMUL_TARGET static inline __m128i ByteSwap(__m128i x) {
+  return _mm_shuffle_epi8(
+      x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Accumulate the 256-bit carry-less product of `a` & `b` into `lo` & `hi`.
+AES_CLMUL_TARGET static inline void ClMul(__m128i a, __m128i b, __m128i &lo,
+                                          __m128i &hi) {
+  __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+  __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+  __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+  t1 = _mm_xor_si128(t1, t2);
+  lo = _mm_xor_si128(lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+  hi = _mm_xor_si128(hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+// Reduce a 256-bit product of byte-reflected operands modulo the GCM
+// polynomial ("Intel Carry-Less Multiplication Instruction and its Usage for
+// Computing the GCM Mode", algorithm 5).
+AES_CLMUL_TARGET static inline __m128i Reduce(__m128i lo, __m128i hi) {
+  // Shift the product left by one bit (operands are bit-reflected).
+  __m128i lo_carry = _mm_srli_epi32(lo, 31);
+  __m128i hi_carry = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  __m128i cross = _mm_srli_si128(lo_carry, 12);
+  hi_carry = _mm_slli_si128(hi_carry, 4);
+  lo_carry = _mm_slli_si128(lo_carry, 4);
+  lo = _mm_or_si128(lo, lo_carry);
+  hi = _mm_or_si128(_mm_or_si128(hi, hi_carry), cross);
+
+  __m128i a = _mm_slli_epi32(lo, 31);
+  __m128i b = _mm_slli_epi32(lo, 30);
+  __m128i c = _mm_slli_epi32(lo, 25);
+  a = _mm_xor_si128(_mm_xor_si128(a, b), c);
+  b = _mm_srli_si128(a, 4);
+  a = _mm_slli_si128(a, 12);
+  lo = _mm_xor_si128(lo, a);
+  __m128i d = _mm_srli_epi32(lo, 1);
+  __m128i e = _mm_srli_epi32(lo, 2);
+  __m128i f = _mm_srli_epi32(lo, 7);
+  d = _mm_xor_si128(_mm_xor_si128(d, e), _mm_xor_si128(f, b));
+  lo = _mm_xor_si128(lo, d);
+  return _mm_xor_si128(hi, lo);
+}
+
+AES_CLMUL_TARGET static inline __m128i GfMul(__m128i a, __m128i b) {
+  __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+  ClMul(a, b, lo, hi);
+  return Reduce(lo, hi);
+}
+
+AES_CLMUL_TARGET static void InitPowers(AES128_GCM &key) {
+  __m128i h = _mm_set_epi64x(key.h_hi, key.h_lo);
+  __m128i power = h;
+  for (int i = 0; i < 4; ++i) {
+    _mm_store_si128((__m128i *)key.h_powers[i], power);
+    power = GfMul(power, h);
+  }
+}
+
+// Absorb `data` (zero-padded to 16 bytes) into the GHASH state `x`.
+AES_CLMUL_TARGET static __m128i GhashHardware(const AES128_GCM &key,
+                                              __m128i x, Span<> data) {
+  const __m128i *h = (const __m128i *)key.h_powers;
+  __m128i h1 = _mm_load_si128(h), h2 = _mm_load_si128(h + 1),
+          h3 = _mm_load_si128(h + 2), h4 = _mm_load_si128(h + 3);
+  const char *p = data.data();
+  Size n = data.size();
+  for (; n >= 64; p += 64, n -= 64) {
+    __m128i b0 = ByteSwap(_mm_loadu_si128((const __m128i *)p));
+    __m128i b1 = ByteSwap(_mm_loadu_si128((const __m128i *)(p + 16)));
+    __m128i b2 = ByteSwap(_mm_loadu_si128((const __m128i *)(p + 32)));
+    __m128i b3 = ByteSwap(_mm_loadu_si128((const __m128i *)(p + 48)));
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    ClMul(_mm_xor_si128(x, b0), h4, lo, hi);
+    ClMul(b1, h3, lo, hi);
+    ClMul(b2, h2, lo, hi);
+    ClMul(b3, h1, lo, hi);
+    x = Reduce(lo, hi);
+  }
+  for (; n >= 16; p += 16, n -= 16) {
+    __m128i b = ByteSwap(_mm_loadu_si128((const __m128i *)p));
+    x = GfMul(_mm_xor_si128(x, b), h1);
+  }
+  if (n) {
+    alignas(16) char block[16] = {};
+    memcpy(block, p, n);
+    __m128i b = ByteSwap(_mm_load_si128((const __m128i *)block));
+    x = GfMul(_mm_xor_si128(x, b), h1);
+  }
+  return x;
+}
+
+AES_CLMUL_TARGET static inline __m128i EncryptBlockHardware(const __m128i rk[11],
+                                                            __m128i b) {
+  b = _mm_xor_si128(b, rk[0]);
+  for (int r = 1; r < 10; ++r) {
+    b = _mm_aesenc_si128(b, rk[r]);
+  }
+  return _mm_aesenclast_si128(b, rk[10]);
+}
+
+// Counter mode starting with counter value 2 (1 is used for the tag).
+AES_CLMUL_TARGET static void CtrHardware(const AES128_GCM &key,
+                                         Span<char, 12> nonce, Span<> data) {
+  __m128i rk[11];
+  for (int i = 0; i < 11; ++i) {
+    rk[i] = _mm_load_si128((const __m128i *)key.round_keys[i]);
+  }
+  alignas(16) char j0[16] = {};
+  memcpy(j0, nonce.data(), 12);
+  j0[15] = 1;
+  // Byte-swapped counter block - the 32-bit counter is in the lowest lane.
+  __m128i counter = ByteSwap(_mm_load_si128((const __m128i *)j0));
+  const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+
+  char *p = data.data();
+  Size n = data.size();
+  constexpr int kLanes = 8;
+  for (; n >= 16 * kLanes; p += 16 * kLanes, n -= 16 * kLanes) {
+    __m128i b[kLanes];
+    for (int i = 0; i < kLanes; ++i) {
+      counter = _mm_add_epi32(counter, one);
+      b[i] = _mm_xor_si128(ByteSwap(counter), rk[0]);
+    }
+    for (int r = 1; r < 10; ++r) {
+      for (int i = 0; i < kLanes; ++i) {
+        b[i] = _mm_aesenc_si128(b[i], rk[r]);
+      }
+    }
+    for (int i = 0; i < kLanes; ++i) {
+      b[i] = _mm_aesenclast_si128(b[i], rk[10]);
+      __m128i *q = (__m128i *)(p + 16 * i);
+      _mm_storeu_si128(q, _mm_xor_si128(_mm_loadu_si128(q), b[i]));
+    }
+  }
+  for (; n >= 16; p += 16, n -= 16) {
+    counter = _mm_add_epi32(counter, one);
+    __m128i stream = EncryptBlockHardware(rk, ByteSwap(counter));
+    __m128i *q = (__m128i *)p;
+    _mm_storeu_si128(q, _mm_xor_si128(_mm_loadu_si128(q), stream));
+  }
+  if (n) {
+    counter = _mm_add_epi32(counter, one);
+    alignas(16) char stream[16];
+    _mm_store_si128((__m128i *)stream,
+                    EncryptBlockHardware(rk, ByteSwap(counter)));
+    for (Size i = 0; i < n; ++i) {
+      p[i] ^= stream[i];
+    }
+  }
+}
+
+AES_CLMUL_TARGET static Arr<char, 16> TagHardware(const AES128_GCM &key,
+                                                  Span<char, 12> nonce,
+                                                  Span<> ciphertext,
+                                                  Span<> aad) {
+  __m128i x = _mm_setzero_si128();
+  x = GhashHardware(key, x, aad);
+  x = GhashHardware(key, x, ciphertext);
+  __m128i lengths =
+      _mm_set_epi64x((U64)aad.size() * 8, (U64)ciphertext.size() * 8);
+  x = GfMul(_mm_xor_si128(x, lengths),
+            _mm_load_si128((const __m128i *)key.h_powers[0]));
+
+  __m128i rk[11];
+  for (int i = 0; i < 11; ++i) {
+    rk[i] = _mm_load_si128((const __m128i *)key.round_keys[i]);
+  }
+  alignas(16) char j0[16] = {};
+  memcpy(j0, nonce.data(), 12);
+  j0[15] = 1;
+  __m128i mask = EncryptBlockHardware(rk, _mm_load_si128((const __m128i *)j0));
+
+  Arr<char, 16> tag;
+  _mm_storeu_si128((__m128i *)tag.data(), _mm_xor_si128(ByteSwap(x), mask));
+  return tag;
+}
+
+#endif // defined(__x86_64__)
+
+////////////////////////////////////////////////////////////////////////////////
+// Public interface
+////////////////////////////////////////////////////////////////////////////////
+
+AES128_GCM::AES128_GCM(Span<char, 16> key) {
+  memcpy(round_keys[0], key.data(), 16);
+  U8 rcon = 1;
+  for (int i = 1; i <= 10; ++i) {
+    const U8 *prev = round_keys[i - 1];
+    U8 *cur = round_keys[i];
+    cur[0] = prev[0] ^ kSBox[prev[13]] ^ rcon;
+    cur[1] = prev[1] ^ kSBox[prev[14]];
+    cur[2] = prev[2] ^ kSBox[prev[15]];
+    cur[3] = prev[3] ^ kSBox[prev[12]];
+    for (int j = 4; j < 16; ++j) {
+      cur[j] = prev[j] ^ cur[j - 4];
+    }
+    rcon = XTime(rcon);
+  }
+  U8 zero[16] = {}, h[16];
+  EncryptBlockPortable(*this, zero, h);
+  h_hi = LoadBig64(h);
+  h_lo = LoadBig64(h + 8);
+#if defined(__x86_64__)
+  if (kCpuHasAES_CLMUL) {
+    InitPowers(*this);
+  }
+#endif
+}
+
+static Arr<char, 16> Tag(const AES128_GCM &key, Span<char, 12> nonce,
+                         Span<> ciphertext, Span<> aad) {
+#if defined(__x86_64__)
+  if (aes128_gcm_hardware) {
+    return TagHardware(key, nonce, ciphertext, aad);
+  }
+#endif
+  return TagPortable(key, nonce, ciphertext, aad);
+}
+
+static void Ctr(const AES128_GCM &key, Span<char, 12> nonce, Span<> data) {
+#if defined(__x86_64__)
+  if (aes128_gcm_hardware) {
+    return CtrHardware(key, nonce, data);
+  }
+#endif
+  CtrPortable(key, nonce, data);
+}
+
+Arr<char, 16> Encrypt_AEAD_AES128_GCM(const AES128_GCM &key,
+                                      Span<char, 12> nonce, Span<> data,
+                                      Span<> aad) {
+  Ctr(key, nonce, data);
+  return Tag(key, nonce, data, aad);
+}
+
+bool Decrypt_AEAD_AES128_GCM(const AES128_GCM &key, Span<char, 12> nonce,
+                             Span<> data, Span<> aad, Span<char, 16> tag) {
+  Arr<char, 16> my_tag = Tag(key, nonce, data, aad);
+  char diff = 0; // constant-time comparison
+  for (int i = 0; i < 16; ++i) {
+    diff |= my_tag[i] ^ tag[i];
+  }
+  if (diff != 0) {
+    return false;
+  }
+  Ctr(key, nonce, data);
+  return true;
+}
+
+} // namespace maf
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "arr.hh"
+#include "int.hh"
+#include "span.hh"
+
+namespace maf {
+
+// Expanded AES-128 key & GHASH key. Can be reused to encrypt many messages
+// with the same key.
+struct AES128_GCM {
+  // AES round keys, in the FIPS-197 byte order (also used by AES-NI).
+  alignas(16) U8 round_keys[11][16];
+
+  // GHASH key (encrypted zero block), as a big-endian 128-bit number.
+  U64 h_hi, h_lo;
+
+  // H, H^2, H^3 & H^4 in the byte-reflected form used by the PCLMULQDQ
+  // kernel. Lets it reduce only once per four blocks.
+  alignas(16) U8 h_powers[4][16];
+
+  AES128_GCM(Span<char, 16> key);
+};
+
+// Whether the AES-NI & PCLMULQDQ kernels are used. Detected at startup. Can be
+// cleared to force the portable (slower, not constant-time) implementation.
+extern bool aes128_gcm_hardware;
+
+// Encrypt `data` in-place & return the authentication tag.
+Arr<char, 16> Encrypt_AEAD_AES128_GCM(const AES128_GCM &, Span<char, 12> nonce,
+                                      Span<> data, Span<> aad);
+
+// Verify the `tag` & decrypt `data` in-place. `data` is left untouched if the
+// tag doesn't match.
+bool Decrypt_AEAD_AES128_GCM(const AES128_GCM &, Span<char, 12> nonce,
+                             Span<> data, Span<> aad, Span<char, 16> tag);
+
+} // namespace maf
@@ -0,0 +1,121 @@
+#include "aead_aes128_gcm.hh"
+
+#include "gtest.hh"
+#include "hex.hh"
+
+using namespace maf;
+
+// Test cases 2-4 from "The Galois/Counter Mode of Operation (GCM)" by McGrew
+// & Viega.
+
+static const auto kKey = HexArr("feffe9928665731c6d6a8f9467308308");
+static const auto kNonce = HexArr("cafebabefacedbaddecaf888");
+static const auto kAAD = HexArr("feedfacedeadbeeffeedfacedeadbeefabaddad2");
+
+static const auto kPlaintext =
+    HexArr("d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+           "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255");
+
+static const auto kCiphertext =
+    HexArr("42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+           "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985");
+
+// Test case 4 uses only the first 60 bytes.
+static constexpr Size kShortSize = 60;
+
+struct AES128_GCM_Test : testing::TestWithParam<bool> {
+  void SetUp() override {
+    hardware = aes128_gcm_hardware;
+    aes128_gcm_hardware = GetParam() && hardware;
+  }
+  void TearDown() override { aes128_gcm_hardware = hardware; }
+  bool hardware;
+};
+
+TEST_P(AES128_GCM_Test, ZeroKey) {
+  Arr<char, 16> key_buf = {};
+  Arr<char, 12> nonce = {};
+  Arr<char, 16> data = {};
+  AES128_GCM key(key_buf);
+  auto tag = Encrypt_AEAD_AES128_GCM(key, nonce, data, kEmptySpan);
+  EXPECT_EQ(BytesToHex(data), "0388dace60b6a392f328c2b971b2fe78");
+  EXPECT_EQ(BytesToHex(tag), "ab6e47d42cec13bdf53a67b21257bddf");
+}
+
+TEST_P(AES128_GCM_Test, Encrypt) {
+  auto key_buf = kKey;
+  auto nonce = kNonce;
+  auto data = kPlaintext;
+  AES128_GCM key(key_buf);
+  auto tag = Encrypt_AEAD_AES128_GCM(key, nonce, data, kEmptySpan);
+  EXPECT_EQ(data, kCiphertext);
+  EXPECT_EQ(BytesToHex(tag), "4d5c2af327cd64a62cf35abd2ba6fab4");
+}
+
+TEST_P(AES128_GCM_Test, EncryptWithAAD) {
+  auto key_buf = kKey;
+  auto nonce = kNonce;
+  auto aad = kAAD;
+  Vec<> data(kPlaintext.begin(), kPlaintext.begin() + kShortSize);
+  AES128_GCM key(key_buf);
+  auto tag = Encrypt_AEAD_AES128_GCM(key, nonce, data, aad);
+  EXPECT_EQ(data, Vec<>(kCiphertext.begin(), kCiphertext.begin() + kShortSize));
+  EXPECT_EQ(BytesToHex(tag), "5bc94fbc3221a5db94fae95ae7121a47");
+}
+
+TEST_P(AES128_GCM_Test, Decrypt) {
+  auto key_buf = kKey;
+  auto nonce = kNonce;
+  auto aad = kAAD;
+  auto tag = HexArr("5bc94fbc3221a5db94fae95ae7121a47");
+  Vec<> ciphertext(kCiphertext.begin(), kCiphertext.begin() + kShortSize);
+  AES128_GCM key(key_buf);
+
+  Vec<> data = ciphertext;
+  ASSERT_TRUE(Decrypt_AEAD_AES128_GCM(key, nonce, data, aad, tag));
+  EXPECT_EQ(data, Vec<>(kPlaintext.begin(), kPlaintext.begin() + kShortSize));
+
+  data = ciphertext;
+  tag[0] ^= 1;
+  EXPECT_FALSE(Decrypt_AEAD_AES128_GCM(key, nonce, data, aad, tag));
+  EXPECT_EQ(data, ciphertext);
+}
+
+// Both implementations must agree on all lengths (lane & block tails).
+TEST(AES128_GCM, HardwareMatchesPortable) {
+  bool hardware = aes128_gcm_hardware;
+  if (!hardware) {
+    GTEST_SKIP() << "No AES-NI on this CPU";
+  }
+  Arr<char, 16> key_buf;
+  Arr<char, 12> nonce;
+  for (int i = 0; i < 16; ++i) {
+    key_buf[i] = i * 7;
+  }
+  for (int i = 0; i < 12; ++i) {
+    nonce[i] = i * 13;
+  }
+  AES128_GCM key(key_buf);
+  for (Size size : {0, 1, 15, 16, 17, 63, 64, 127, 128, 129, 1000, 16384}) {
+    Vec<> aad(size % 37, 'a');
+    Vec<> data(size);
+    for (Size i = 0; i < size; ++i) {
+      data[i] = i;
+    }
+    Vec<> portable = data, accelerated = data;
+    aes128_gcm_hardware = false;
+    auto portable_tag = Encrypt_AEAD_AES128_GCM(key, nonce, portable, aad);
+    aes128_gcm_hardware = true;
+    auto accelerated_tag =
+        Encrypt_AEAD_AES128_GCM(key, nonce, accelerated, aad);
+    EXPECT_EQ(portable, accelerated) << size;
+    EXPECT_EQ(portable_tag, accelerated_tag) << size;
+  }
+  aes128_gcm_hardware = hardware;
+}
+
+INSTANTIATE_TEST_SUITE_P(Implementations, AES128_GCM_Test,
+                         testing::Values(false, true),
+                         [](const testing::TestParamInfo<bool> &info) {
+                           return info.param ? "Hardware" : "Portable";
+                         });
@@ -2,20 +2,16 @@
 
 #include "chacha20.hh"
 #include "int.hh"
+#include "optional.hh"
 #include "poly1305.hh"
+#include "vec.hh"
 
 #include <strings.h>
 
 namespace maf {
 
-Poly1305 Encrypt_AEAD_CHACHA20_POLY1305(Span<char, 32> key,
-                                        Span<char, 12> nonce, Span<char> data,
-                                        Span<> aad) {
-  char poly1305_key[32] = {};
-  ChaCha20 chacha20(key, 0, nonce);
-  chacha20.Crypt(poly1305_key);
-  chacha20.Crypt(data);
-
+// Poly1305 tag of the encrypted `data` & `aad` (RFC 7539, section 2.8).
+static Poly1305 Tag(Span<char, 32> poly1305_key, Span<> data, Span<> aad) {
   Poly1305::Builder poly1305_builder(poly1305_key);
   poly1305_builder.Update(aad);
   if (aad.size() & 15) {
@@ -36,31 +32,23 @@ Poly1305 Encrypt_AEAD_CHACHA20_POLY1305(Span<char, 32> key,
   return poly1305_builder.Finalize();
 }
 
+Poly1305 Encrypt_AEAD_CHACHA20_POLY1305(Span<char, 32> key,
+                                        Span<char, 12> nonce, Span<char> data,
+                                        Span<> aad) {
+  char poly1305_key[32] = {};
+  ChaCha20 chacha20(key, 0, nonce);
+  chacha20.Crypt(poly1305_key);
+  chacha20.Crypt(data);
+  return Tag(poly1305_key, data, aad);
+}
+
 bool Decrypt_AEAD_CHACHA20_POLY1305(Span<char, 32> key, Span<char, 12> nonce,
                                     Span<> data, Span<> aad,
                                     const Poly1305 &tag) {
   char poly1305_key[32] = {};
   ChaCha20 chacha20(key, 0, nonce);
   chacha20.Crypt(poly1305_key);
-  Poly1305::Builder poly1305_builder(poly1305_key);
-  poly1305_builder.Update(aad);
-  if (aad.size() & 15) {
-    int padding1_size = 16 - (aad.size() & 15);
-    char padding1[15] = {};
-    poly1305_builder.Update(Span<>(padding1, padding1_size));
-  }
-  poly1305_builder.Update(data);
-  if (data.size() & 15) {
-    int padding2_size = 16 - (data.size() & 15);
-    char padding2[15] = {};
-    poly1305_builder.Update(Span<>(padding2, padding2_size));
-  }
-  U64 aad_size = aad.size();
-  poly1305_builder.Update(Span<>((char *)&aad_size, 8));
-  U64 data_size = data.size();
-  poly1305_builder.Update(Span<>((char *)&data_size, 8));
-  Poly1305 my_tag = poly1305_builder.Finalize();
-
+  Poly1305 my_tag = Tag(poly1305_key, data, aad);
   if (bcmp(my_tag.bytes, tag.bytes, 16) != 0) {
     return false;
   }
@@ -68,4 +56,90 @@ bool Decrypt_AEAD_CHACHA20_POLY1305(Span<char, 32> key, Span<char, 12> nonce,
   return true;
 }
 
+// Poly1305 keys (first half of the block with counter 0) of the `jobs`.
+static void Poly1305Keys(Span<ChaCha20Poly1305Job> jobs,
+                         Span<Arr<char, 64>> keys) {
+  for (Size begin = 0; begin < jobs.size(); begin += rfc7539::kLanes) {
+    Size n = std::min(rfc7539::kLanes, jobs.size() - begin);
+    Arr<Optional<ChaCha20>, rfc7539::kLanes> states;
+    Arr<ChaCha20 *, rfc7539::kLanes> state_ptrs;
+    Arr<Span<>, rfc7539::kLanes> blocks;
+    for (Size i = 0; i < n; ++i) {
+      auto &job = jobs[begin + i];
+      state_ptrs[i] = &states[i].emplace(job.key, 0, job.nonce);
+      keys[begin + i] = {};
+      blocks[i] = keys[begin + i];
+    }
+    rfc7539::CryptLanes(Span<ChaCha20 *>(state_ptrs.data(), n),
+                        Span<Span<>>(blocks.data(), n));
+  }
+}
+
+// Encrypts/decrypts the `data` of the `jobs` selected by `filter`. Lanes
+// move on to the next job as soon as their current one is done, so that short
+// & long messages can be mixed.
+template <typename Filter>
+static void CryptData(Span<ChaCha20Poly1305Job> jobs, Filter filter) {
+  struct Lane {
+    ChaCha20 state;
+    Span<> rest;
+  };
+  Arr<Optional<Lane>, rfc7539::kLanes> lanes;
+  Size next_job = 0;
+  while (true) {
+    Arr<ChaCha20 *, rfc7539::kLanes> states;
+    Arr<Span<>, rfc7539::kLanes> blocks;
+    Arr<Size, rfc7539::kLanes> active;
+    Size n = 0;
+    for (Size lane = 0; lane < rfc7539::kLanes; ++lane) {
+      while (!lanes[lane] && next_job < jobs.size()) {
+        auto &job = jobs[next_job++];
+        if (!job.data.empty() && filter(job)) {
+          lanes[lane].emplace(ChaCha20(job.key, 1, job.nonce), job.data);
+        }
+      }
+      if (!lanes[lane]) {
+        continue;
+      }
+      Span<> &rest = lanes[lane]->rest;
+      Size block_size = std::min<Size>(64, rest.size());
+      states[n] = &lanes[lane]->state;
+      blocks[n] = rest.first(block_size);
+      active[n] = lane;
+      rest = rest.subspan(block_size);
+      ++n;
+    }
+    if (n == 0) {
+      return;
+    }
+    rfc7539::CryptLanes(Span<ChaCha20 *>(states.data(), n),
+                        Span<Span<>>(blocks.data(), n));
+    for (Size i = 0; i < n; ++i) {
+      if (lanes[active[i]]->rest.empty()) {
+        lanes[active[i]].reset();
+      }
+    }
+  }
+}
+
+void EncryptBatch_AEAD_CHACHA20_POLY1305(Span<ChaCha20Poly1305Job> jobs) {
+  Vec<Arr<char, 64>> keys(jobs.size());
+  Poly1305Keys(jobs, keys);
+  CryptData(jobs, [](ChaCha20Poly1305Job &) { return true; });
+  for (Size i = 0; i < jobs.size(); ++i) {
+    jobs[i].tag = Tag(Span<>(keys[i]).first<32>(), jobs[i].data, jobs[i].aad);
+  }
+}
+
+void DecryptBatch_AEAD_CHACHA20_POLY1305(Span<ChaCha20Poly1305Job> jobs) {
+  Vec<Arr<char, 64>> keys(jobs.size());
+  Poly1305Keys(jobs, keys);
+  for (Size i = 0; i < jobs.size(); ++i) {
+    auto &job = jobs[i];
+    Poly1305 my_tag = Tag(Span<>(keys[i]).first<32>(), job.data, job.aad);
+    job.ok = bcmp(my_tag.bytes, job.tag.bytes, 16) == 0;
+  }
+  CryptData(jobs, [](ChaCha20Poly1305Job &job) { return job.ok; });
+}
+
 } // namespace maf
\ No newline at end of file
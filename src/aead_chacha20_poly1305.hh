@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arr.hh"
 #include "poly1305.hh"
 #include "span.hh"
 
@@ -13,4 +14,24 @@ bool Decrypt_AEAD_CHACHA20_POLY1305(Span<char, 32> key, Span<char, 12> nonce,
                                     Span<> data, Span<> aad,
                                     const Poly1305 &tag);
 
-} // namespace maf
\ No newline at end of file
+// Single message of a batch (see below).
+struct ChaCha20Poly1305Job {
+  Arr<char, 32> key;
+  Arr<char, 12> nonce;
+  Span<> data; // encrypted or decrypted in place
+  Span<> aad;
+  Poly1305 tag; // output of encryption, input of decryption
+
+  // Output of decryption - whether `tag` matched. The `data` of messages
+  // that don't match is left encrypted.
+  bool ok = false;
+};
+
+// Same as the functions above, for many independent messages (different keys
+// & nonces). ChaCha20 blocks of several messages are computed side by side in
+// SIMD lanes, which is faster than one message after another when the
+// messages are short.
+void EncryptBatch_AEAD_CHACHA20_POLY1305(Span<ChaCha20Poly1305Job> jobs);
+void DecryptBatch_AEAD_CHACHA20_POLY1305(Span<ChaCha20Poly1305Job> jobs);
+
+} // namespace maf
@@ -2,6 +2,7 @@
 
 #include "gtest.hh"
 #include "hex.hh"
+#include "vec.hh"
 
 using namespace maf;
 
@@ -57,3 +58,42 @@ TEST(AEAD_CHACHA20_POLY1305_Test, TestVector_Decrypt) {
             "Ladies and Gentlemen of the class of '99: If I could offer "
             "you only one tip for the future, sunscreen would be it.");
 }
+
+TEST(AEAD_CHACHA20_POLY1305_Test, Batch) {
+  // More messages than lanes, with lengths that end in the middle of a block
+  // & empty ones.
+  Vec<Vec<>> plaintexts, messages;
+  for (int i = 0; i < 20; ++i) {
+    Vec<> plaintext((i * 37) % 300);
+    for (int j = 0; j < plaintext.size(); ++j) {
+      plaintext[j] = i + j;
+    }
+    plaintexts.push_back(plaintext);
+  }
+  messages = plaintexts;
+  Vec<ChaCha20Poly1305Job> jobs(messages.size());
+  for (int i = 0; i < jobs.size(); ++i) {
+    std::copy_n(kKey, 32, jobs[i].key.begin());
+    std::copy_n(kNonce, 12, jobs[i].nonce.begin());
+    jobs[i].nonce[0] = i;
+    jobs[i].data = messages[i];
+    jobs[i].aad = kAAD;
+  }
+  EncryptBatch_AEAD_CHACHA20_POLY1305(jobs);
+  for (int i = 0; i < jobs.size(); ++i) {
+    Vec<> expected = plaintexts[i];
+    auto tag = Encrypt_AEAD_CHACHA20_POLY1305(kKey, jobs[i].nonce, expected,
+                                              kAAD);
+    EXPECT_EQ(messages[i], expected) << "message " << i;
+    EXPECT_EQ(BytesToHex(jobs[i].tag), BytesToHex(tag)) << "message " << i;
+  }
+
+  messages[3][0] ^= 1;
+  DecryptBatch_AEAD_CHACHA20_POLY1305(jobs);
+  for (int i = 0; i < jobs.size(); ++i) {
+    EXPECT_EQ(jobs[i].ok, i != 3) << "message " << i;
+    if (i != 3) {
+      EXPECT_EQ(messages[i], plaintexts[i]) << "message " << i;
+    }
+  }
+}
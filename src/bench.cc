@@ -0,0 +1,95 @@
+#include "bench.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "format.hh"
+
+namespace maf::bench {
+
+double Seconds(Clock::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+double Microseconds(Clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+double Samples::Percentile(double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  Size i = std::min<Size>(values.size() - 1, values.size() * p / 100);
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
+
+double Samples::Mean() const {
+  if (values.empty()) {
+    return 0;
+  }
+  double sum = 0;
+  for (double v : values) {
+    sum += v;
+  }
+  return sum / values.size();
+}
+
+static void AppendQuoted(Str &json, StrView s) {
+  json += '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+    }
+    json += c;
+  }
+  json += '"';
+}
+
+static void AppendKey(Str &json, StrView key) {
+  json += ", ";
+  AppendQuoted(json, key);
+  json += ": ";
+}
+
+Report::Report(StrView benchmark) {
+  json = "{\"benchmark\": ";
+  AppendQuoted(json, benchmark);
+}
+
+Report::~Report() {
+  json += "}";
+  puts(json.c_str());
+  fflush(stdout);
+}
+
+Report &Report::Set(StrView key, double value) {
+  AppendKey(json, key);
+  if (value == std::floor(value) && std::abs(value) < 1e15) {
+    json += f("%.0f", value);
+  } else if (std::isfinite(value)) {
+    json += f("%.6g", value);
+  } else {
+    json += "null";
+  }
+  return *this;
+}
+
+Report &Report::Set(StrView key, StrView value) {
+  AppendKey(json, key);
+  AppendQuoted(json, value);
+  return *this;
+}
+
+Report &Report::SetPercentiles(StrView prefix, Samples &samples) {
+  Str p(prefix);
+  Set(p + "_p50", samples.Percentile(50));
+  Set(p + "_p90", samples.Percentile(90));
+  Set(p + "_p99", samples.Percentile(99));
+  Set(p + "_p999", samples.Percentile(99.9));
+  Set(p + "_mean", samples.Mean());
+  return *this;
+}
+
+} // namespace maf::bench
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+
+#include "str.hh"
+#include "vec.hh"
+
+// Helpers for benchmark binaries (`*_bench.cc`).
+//
+// Results are printed to stdout as JSON Lines (one JSON object per line) so
+// that scripts can compare them between releases:
+//
+//   bench::Report("tcp_ping_pong")
+//       .Set("connections", 4)
+//       .SetPercentiles("rtt_us", samples);
+namespace maf::bench {
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::duration);
+double Microseconds(Clock::duration);
+
+// Collection of measurements (for example latencies).
+struct Samples {
+  Vec<double> values;
+
+  void Add(double value) { values.push_back(value); }
+
+  // Returns the value below which `p` percent of samples fall.
+  double Percentile(double p);
+  double Mean() const;
+};
+
+// A single line of benchmark output. Printed when destroyed.
+struct Report {
+  Str json;
+
+  Report(StrView benchmark);
+  ~Report();
+
+  Report &Set(StrView key, double value);
+  Report &Set(StrView key, StrView value);
+
+  // Adds `<prefix>_p50`, `_p90`, `_p99`, `_p999` & `_mean` keys.
+  Report &SetPercentiles(StrView prefix, Samples &);
+};
+
+} // namespace maf::bench
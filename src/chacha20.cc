@@ -1,5 +1,9 @@
 #include "chacha20.hh"
 
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
 namespace maf::rfc7539 {
 
 ChaCha20::ChaCha20(Span<char, 32> key, U32 counter, Span<char, 12> nonce)
@@ -46,12 +50,14 @@ ChaCha20::ChaCha20(Span<char, 32> key, U32 counter, Span<char, 12> nonce)
   c = PLUS(c, d);                                                              \
   b = ROTATE(XOR(b, c), 7);
 
-void ChaCha20::Crypt(Span<> mem) {
+// Reference implementation - one block at a time. Also handles the blocks
+// left over by the multi-block kernels.
+static void CryptScalar(ChaCha20 &state, Span<> mem) {
   U32 x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
   I32 j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
   char tmp[64];
 
-  U32 *x_input = (U32 *)this;
+  U32 *x_input = (U32 *)&state;
 
   j0 = x_input[0];
   j1 = x_input[1];
@@ -173,4 +179,220 @@ void ChaCha20::Crypt(Span<> mem) {
   }
 }
 
-} // namespace maf::rfc7539
\ No newline at end of file
+// Vector of one 32-bit word from each lane (GCC vector extension).
+typedef U32 Lanes __attribute__((vector_size(4 * kLanes)));
+
+#define ROTATE_LANES(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND_LANES(a, b, c, d)                                         \
+  a += b;                                                                      \
+  d = ROTATE_LANES(d ^ a, 16);                                                 \
+  c += d;                                                                      \
+  b = ROTATE_LANES(b ^ c, 12);                                                 \
+  a += b;                                                                      \
+  d = ROTATE_LANES(d ^ a, 8);                                                  \
+  c += d;                                                                      \
+  b = ROTATE_LANES(b ^ c, 7);
+
+void CryptLanes(Span<ChaCha20 *> states, Span<Span<>> blocks) {
+  Size n = states.size();
+  // Transpose the states, so that `j[w]` holds word `w` of every state.
+  // Unused lanes compute garbage which is ignored.
+  Lanes j[16] = {};
+  for (Size lane = 0; lane < n; ++lane) {
+    U32 *words = (U32 *)states[lane];
+    for (int w = 0; w < 16; ++w) {
+      j[w][lane] = words[w];
+    }
+  }
+  Lanes x[16];
+  for (int w = 0; w < 16; ++w) {
+    x[w] = j[w];
+  }
+  for (int i = 20; i > 0; i -= 2) {
+    QUARTERROUND_LANES(x[0], x[4], x[8], x[12])
+    QUARTERROUND_LANES(x[1], x[5], x[9], x[13])
+    QUARTERROUND_LANES(x[2], x[6], x[10], x[14])
+    QUARTERROUND_LANES(x[3], x[7], x[11], x[15])
+    QUARTERROUND_LANES(x[0], x[5], x[10], x[15])
+    QUARTERROUND_LANES(x[1], x[6], x[11], x[12])
+    QUARTERROUND_LANES(x[2], x[7], x[8], x[13])
+    QUARTERROUND_LANES(x[3], x[4], x[9], x[14])
+  }
+  for (int w = 0; w < 16; ++w) {
+    x[w] += j[w];
+  }
+  for (Size lane = 0; lane < n; ++lane) {
+    U32 key_stream[16];
+    for (int w = 0; w < 16; ++w) {
+      key_stream[w] = x[w][lane];
+    }
+    Span<> block = blocks[lane];
+    char *key_stream_bytes = (char *)key_stream;
+    for (Size i = 0; i < block.size(); ++i) {
+      block[i] ^= key_stream_bytes[i];
+    }
+    U32 *words = (U32 *)states[lane];
+    if (++words[12] == 0) {
+      ++words[13]; // same overflow as in `Crypt`
+    }
+  }
+}
+
+// Multi-block kernels: lane `i` computes block `i` of a group of `W`
+// consecutive blocks of one message - same word-sliced layout as
+// `CryptLanes`, with all lanes sharing the key & nonce.
+
+template <int W> struct Group {
+  typedef U32 Words __attribute__((vector_size(4 * W)));
+};
+
+// 16 bytes - one row of a block.
+typedef U32 Row __attribute__((vector_size(16)));
+
+// Element indices of `__builtin_shufflevector` which interleave two vectors
+// within each group of four lanes (like SSE2 `unpack{lo,hi}_epi{32,64}`).
+// Together they transpose 4x4 words: turn four vectors holding words
+// `w`..`w+3` of blocks into vectors holding a row of each block.
+template <bool kHigh, bool k64> static constexpr int Interleave(int i, int W) {
+  int base = i & ~3, pos = i & 3;
+  int from_second = k64 ? pos >> 1 : pos & 1;
+  int offset = (k64 ? pos & 1 : pos >> 1) + (kHigh ? 2 : 0);
+  return base + offset + from_second * W;
+}
+
+template <int W, bool kHigh, bool k64, Size... I>
+[[gnu::always_inline]] static inline void
+Unpack(const typename Group<W>::Words &a, const typename Group<W>::Words &b,
+       typename Group<W>::Words &out, std::index_sequence<I...>) {
+  out = __builtin_shufflevector(a, b, Interleave<kHigh, k64>(I, W)...);
+}
+
+// Encrypt/decrypt `groups` * `W` blocks (64 bytes each) at `m`. Inlined into
+// the per-ISA wrappers below, so that the vectors are compiled for their
+// instruction set.
+template <int W>
+[[gnu::always_inline]] static inline void CryptBlocks(ChaCha20 &state,
+                                                      char *m, Size groups) {
+  using Words = typename Group<W>::Words;
+  auto lanes = std::make_index_sequence<W>();
+  U32 *words = (U32 *)&state;
+  Words lane_index;
+  for (int i = 0; i < W; ++i) {
+    lane_index[i] = i;
+  }
+  for (; groups > 0; --groups, m += 64 * W) {
+    Words j[16];
+    for (int w = 0; w < 16; ++w) {
+      j[w] = words[w] + Words{}; // broadcast
+    }
+    j[12] += lane_index;
+    j[13] -= (Words)(j[12] < j[0] - j[0] + words[12]); // carry, as in `Crypt`
+    Words x[16];
+    for (int w = 0; w < 16; ++w) {
+      x[w] = j[w];
+    }
+    for (int i = 20; i > 0; i -= 2) {
+      QUARTERROUND_LANES(x[0], x[4], x[8], x[12])
+      QUARTERROUND_LANES(x[1], x[5], x[9], x[13])
+      QUARTERROUND_LANES(x[2], x[6], x[10], x[14])
+      QUARTERROUND_LANES(x[3], x[7], x[11], x[15])
+      QUARTERROUND_LANES(x[0], x[5], x[10], x[15])
+      QUARTERROUND_LANES(x[1], x[6], x[11], x[12])
+      QUARTERROUND_LANES(x[2], x[7], x[8], x[13])
+      QUARTERROUND_LANES(x[3], x[4], x[9], x[14])
+    }
+    for (int w = 0; w < 16; ++w) {
+      x[w] += j[w];
+    }
+    // Row `r` of each block comes from words 4r..4r+3.
+    for (int r = 0; r < 4; ++r) {
+      Words *v = x + 4 * r;
+      Words t[4], rows[4];
+      Unpack<W, false, false>(v[0], v[1], t[0], lanes);
+      Unpack<W, false, false>(v[2], v[3], t[1], lanes);
+      Unpack<W, true, false>(v[0], v[1], t[2], lanes);
+      Unpack<W, true, false>(v[2], v[3], t[3], lanes);
+      // Group of four lanes `g` of `rows[b]` holds row `r` of block 4g+b.
+      Unpack<W, false, true>(t[0], t[1], rows[0], lanes);
+      Unpack<W, true, true>(t[0], t[1], rows[1], lanes);
+      Unpack<W, false, true>(t[2], t[3], rows[2], lanes);
+      Unpack<W, true, true>(t[2], t[3], rows[3], lanes);
+      for (int b = 0; b < 4; ++b) {
+        Row key_stream[W / 4];
+        memcpy(key_stream, &rows[b], sizeof(rows[b]));
+        for (int g = 0; g < W / 4; ++g) {
+          char *p = m + 64 * (4 * g + b) + 16 * r;
+          Row data;
+          memcpy(&data, p, 16);
+          data ^= key_stream[g];
+          memcpy(p, &data, 16);
+        }
+      }
+    }
+    U32 counter = words[12];
+    words[12] += W;
+    if (words[12] < counter) {
+      ++words[13];
+    }
+  }
+}
+
+static void CryptBlocksSSE2(ChaCha20 &state, char *m, Size groups) {
+  CryptBlocks<4>(state, m, groups);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) static void
+CryptBlocksAVX2(ChaCha20 &state, char *m, Size groups) {
+  CryptBlocks<8>(state, m, groups);
+}
+
+__attribute__((target("avx512f"))) static void
+CryptBlocksAVX512(ChaCha20 &state, char *m, Size groups) {
+  CryptBlocks<16>(state, m, groups);
+}
+
+#endif
+
+static Kernel DetectKernel() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx512f")) {
+    return Kernel::kAVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return Kernel::kAVX2;
+  }
+  return Kernel::kSSE2;
+#else
+  return Kernel::kSSE2; // generic vectors, lowered by the compiler
+#endif
+}
+
+static const Kernel kCpuKernel = DetectKernel();
+
+Kernel crypt_kernel = kCpuKernel;
+
+void ChaCha20::Crypt(Span<> mem) {
+  // Widest kernel first - the narrower ones take the remaining blocks.
+  Kernel kernel = std::min(crypt_kernel, kCpuKernel);
+  auto Blocks = [&](Kernel min_kernel, int width,
+                    void (*crypt_blocks)(ChaCha20 &, char *, Size)) {
+    Size groups = mem.size() / (64 * width);
+    if (kernel >= min_kernel && groups > 0) {
+      crypt_blocks(*this, mem.data(), groups);
+      mem = mem.subspan(groups * 64 * width);
+    }
+  };
+#if defined(__x86_64__)
+  Blocks(Kernel::kAVX512, 16, CryptBlocksAVX512);
+  Blocks(Kernel::kAVX2, 8, CryptBlocksAVX2);
+#endif
+  Blocks(Kernel::kSSE2, 4, CryptBlocksSSE2);
+  if (!mem.empty()) {
+    CryptScalar(*this, mem);
+  }
+}
+
+} // namespace maf::rfc7539
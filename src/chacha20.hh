@@ -20,7 +20,8 @@ struct ChaCha20 {
 
   ChaCha20(Span<char, 32> key, U32 counter, Span<char, 12> nonce);
 
-  // Encrypt/decrypt the given buffer in-place.
+  // Encrypt/decrypt the given buffer in-place. Groups of consecutive blocks
+  // go through the widest multi-block kernel allowed by `crypt_kernel`.
   //
   // `counter` will be updated by the number of blocks encrypted.
   void Crypt(Span<>);
@@ -28,6 +29,26 @@ struct ChaCha20 {
   operator Span<>() const { return Span<>((char *)this, sizeof(*this)); }
 };
 
+// Kernels of `ChaCha20::Crypt`, by the number of blocks they encrypt at once:
+// 1 (the scalar reference), 4 (SSE2 - baseline x86-64), 8 (AVX2) & 16
+// (AVX-512).
+enum class Kernel { kScalar, kSSE2, kAVX2, kAVX512 };
+
+// Widest kernel used by `ChaCha20::Crypt`. Detected at startup (with cpuid).
+// Can be lowered to compare the kernels - `kScalar` forces the reference
+// implementation. Kernels that the CPU doesn't support are never used.
+extern Kernel crypt_kernel;
+
+// Number of ChaCha20 states that `CryptLanes` processes side by side - four
+// 32-bit lanes fill one SSE2 register (more lanes spill out of the 16
+// registers of baseline x86-64).
+constexpr Size kLanes = 4;
+
+// Encrypt/decrypt one block (64 bytes, or less at the end of a message) of up
+// to `kLanes` independent states at once, in SIMD lanes. `blocks[i]` is
+// XOR-ed with the key stream of `*states[i]`, whose counter is incremented.
+void CryptLanes(Span<ChaCha20 *> states, Span<Span<>> blocks);
+
 } // namespace rfc7539
 
 using ChaCha20 = rfc7539::ChaCha20;
@@ -4,6 +4,7 @@
 
 #include "arr.hh"
 #include "hex.hh"
+#include "vec.hh"
 
 using namespace maf;
 
@@ -43,4 +44,69 @@ TEST(ChaCha20Test, RFC7539_TestVector) {
                              "52bc514d16ccf806818ce91ab7793736"
                              "5af90bbf74a35be6b40b8eedf2785e42"
                              "874d");
-}
\ No newline at end of file
+}
+
+TEST(ChaCha20Test, Kernels) {
+  char key[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+                  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+                  0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+  char nonce[12] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    0x00, 0x4a, 0x00, 0x00, 0x00, 0x00};
+  auto saved_kernel = rfc7539::crypt_kernel;
+  // Sizes that end in each of the kernels. The last counter wraps around.
+  for (U32 counter : {1u, 0xfffffff0u}) {
+    for (Size size : {64 * 4, 64 * 8, 64 * 16, 64 * 31 + 17, 4000}) {
+      Vec<> message(size);
+      for (Size i = 0; i < size; ++i) {
+        message[i] = i * 7;
+      }
+      rfc7539::crypt_kernel = rfc7539::Kernel::kScalar;
+      ChaCha20 reference(key, counter, nonce);
+      Vec<> expected = message;
+      reference.Crypt(expected);
+      for (auto kernel :
+           {rfc7539::Kernel::kSSE2, rfc7539::Kernel::kAVX2,
+            rfc7539::Kernel::kAVX512}) {
+        rfc7539::crypt_kernel = kernel;
+        ChaCha20 chacha20(key, counter, nonce);
+        Vec<> actual = message;
+        chacha20.Crypt(actual);
+        EXPECT_EQ(actual, expected) << "kernel " << (int)kernel << ", size "
+                                    << size << ", counter " << counter;
+        EXPECT_EQ(chacha20.counter, reference.counter);
+        EXPECT_EQ(BytesToHex(chacha20), BytesToHex(reference));
+      }
+    }
+  }
+  rfc7539::crypt_kernel = saved_kernel;
+}
+
+TEST(ChaCha20Test, CryptLanes) {
+  char key[32] = {};
+  char nonce[12] = {};
+  Vec<ChaCha20> scalar, lanes;
+  Vec<ChaCha20 *> lane_ptrs;
+  Vec<Vec<>> expected, blocks;
+  Vec<Span<>> block_spans;
+  int n = rfc7539::kLanes;
+  for (int i = 0; i < n; ++i) {
+    key[0] = i;
+    nonce[11] = i;
+    scalar.emplace_back(key, i * 1000, nonce);
+    lanes.emplace_back(key, i * 1000, nonce);
+    Vec<> block(i == n - 1 ? 10 : 64, (char)i); // last one is partial
+    expected.push_back(block);
+    blocks.push_back(block);
+  }
+  for (int i = 0; i < n; ++i) {
+    scalar[i].Crypt(expected[i]);
+    lane_ptrs.push_back(&lanes[i]);
+    block_spans.push_back(blocks[i]);
+  }
+  rfc7539::CryptLanes(lane_ptrs, block_spans);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(blocks[i], expected[i]) << "lane " << i;
+    EXPECT_EQ(lanes[i].counter, scalar[i].counter) << "lane " << i;
+  }
+}
@@ -0,0 +1,107 @@
+#include "curve25519_pool.hh"
+
+#include <sys/random.h>
+
+#include "thread_pool.hh"
+#include "vec.hh"
+
+namespace maf::curve25519 {
+
+thread_local KeyPoolWatermarks key_pool_watermarks;
+
+thread_local static Vec<KeyPair> pool;
+
+// Set while a refill runs on the thread pool.
+thread_local static bool refilling = false;
+
+// Incremented by `ClearKeyPool` so that refills started before are discarded.
+thread_local static U32 generation = 0;
+
+// Appends `n` fresh key pairs to `out`. Entropy for the whole batch is read at
+// once.
+static void Generate(Size n, Vec<KeyPair> &out, Status &status) {
+  Vec<> entropy(n * 32);
+  for (Size filled = 0; filled < entropy.size();) {
+    SSize r = getrandom(entropy.data() + filled, entropy.size() - filled, 0);
+    if (r < 0) {
+      if (errno == EINTR) {
+        errno = 0;
+        continue;
+      }
+      status() += "getrandom()";
+      return;
+    }
+    filled += r;
+  }
+  out.reserve(out.size() + n);
+  for (Size i = 0; i < n; ++i) {
+    KeyPair pair;
+    pair.private_key =
+        Private::From32Bytes(Span<char, 32>(entropy.data() + i * 32, 32));
+    pair.public_key = Public::FromPrivate(pair.private_key);
+    out.push_back(pair);
+  }
+}
+
+KeyPair KeyPair::Generate(Status &status) {
+  Vec<KeyPair> out;
+  curve25519::Generate(1, out, status);
+  if (out.empty()) {
+    return {};
+  }
+  return out.front();
+}
+
+struct RefillJob : thread_pool::Job {
+  Size n;
+  U32 generation;
+  Vec<KeyPair> pairs;
+  Status status;
+
+  RefillJob(Size n) : n(n), generation(curve25519::generation) {}
+
+  void Run() override { Generate(n, pairs, status); }
+
+  void Done() override {
+    refilling = false;
+    if (!OK(status) || generation != curve25519::generation) {
+      return; // next `TakePooledKeyPair` will try again
+    }
+    pool.insert(pool.end(), pairs.begin(), pairs.end());
+  }
+};
+
+static void MaybeRefill() {
+  auto &watermarks = key_pool_watermarks;
+  if (refilling || pool.size() >= watermarks.low || !thread_pool::Started()) {
+    return;
+  }
+  refilling = true;
+  thread_pool::Submit(new RefillJob(watermarks.high - pool.size()));
+}
+
+Optional<KeyPair> TakePooledKeyPair() {
+  Optional<KeyPair> pair;
+  if (!pool.empty()) {
+    pair = pool.back();
+    pool.pop_back();
+  }
+  MaybeRefill();
+  return pair;
+}
+
+void FillKeyPool(Status &status) {
+  Size high = key_pool_watermarks.high;
+  if (pool.size() < high) {
+    Generate(high - pool.size(), pool, status);
+  }
+}
+
+Size KeyPoolSize() { return pool.size(); }
+
+void ClearKeyPool() {
+  pool.clear();
+  ++generation;
+}
+
+} // namespace maf::curve25519
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "curve25519.hh"
+#include "int.hh"
+#include "optional.hh"
+
+// Per-thread pool of pre-generated ephemeral key pairs.
+//
+// Generating a key pair takes a scalar multiplication (& some entropy). The
+// pool moves it off the connection setup path: pairs are generated in batches,
+// ahead of time, & taken out when needed.
+namespace maf::curve25519 {
+
+struct KeyPair {
+  Private private_key;
+  Public public_key;
+
+  static KeyPair Generate(Status &);
+};
+
+// When taking a pair leaves fewer than `low` pairs in the pool, it's refilled
+// up to `high` pairs on the `thread_pool` (if it was started).
+struct KeyPoolWatermarks {
+  Size low = 16;
+  Size high = 64;
+};
+
+extern thread_local KeyPoolWatermarks key_pool_watermarks;
+
+// Take a key pair out of this thread's pool. Each pair is returned only once.
+// Returns nothing when the pool is empty - the caller should generate the
+// pair itself.
+Optional<KeyPair> TakePooledKeyPair();
+
+// Generate key pairs on the calling thread, until the pool holds `high`
+// pairs. Can be used at startup, or when the `thread_pool` isn't used.
+void FillKeyPool(Status &);
+
+// Number of pairs ready in this thread's pool.
+Size KeyPoolSize();
+
+void ClearKeyPool();
+
+} // namespace maf::curve25519
@@ -0,0 +1,55 @@
+#include "curve25519_pool.hh"
+
+#include <set>
+
+#include "epoll.hh"
+#include "gtest.hh"
+#include "thread_pool.hh"
+
+using namespace maf;
+using namespace maf::curve25519;
+
+TEST(Curve25519PoolTest, PairsAreValidAndUnique) {
+  ClearKeyPool();
+  key_pool_watermarks = {.low = 4, .high = 8};
+  EXPECT_FALSE(TakePooledKeyPair().has_value());
+
+  Status status;
+  FillKeyPool(status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_EQ(KeyPoolSize(), 8);
+
+  std::set<Arr<char, 32>> seen;
+  while (auto pair = TakePooledKeyPair()) {
+    EXPECT_EQ(pair->public_key, Public::FromPrivate(pair->private_key));
+    EXPECT_TRUE(seen.insert(pair->private_key.bytes).second);
+  }
+  EXPECT_EQ(seen.size(), 8);
+  key_pool_watermarks = {};
+}
+
+TEST(Curve25519PoolTest, RefilledInBackground) {
+  ClearKeyPool();
+  key_pool_watermarks = {.low = 4, .high = 8};
+  epoll::Init();
+  thread_pool::Start(1);
+
+  // Empty pool starts a refill.
+  EXPECT_FALSE(TakePooledKeyPair().has_value());
+  Status status;
+  epoll::Loop(status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_EQ(KeyPoolSize(), 8);
+
+  // Dropping below the low watermark tops the pool up again.
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(TakePooledKeyPair().has_value());
+  }
+  EXPECT_EQ(KeyPoolSize(), 3);
+  epoll::Loop(status);
+  EXPECT_EQ(KeyPoolSize(), 8);
+
+  thread_pool::Stop();
+  ClearKeyPool();
+  key_pool_watermarks = {};
+}
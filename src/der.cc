@@ -0,0 +1,88 @@
+#include "der.hh"
+
+#include "format.hh"
+
+namespace maf::der {
+
+Element Read(Span<> &in, Status &status) {
+  Element element;
+  if (!OK(status)) {
+    return element;
+  }
+  auto Truncated = [&]() {
+    AppendErrorMessage(status) += "Truncated DER element";
+    return element;
+  };
+  if (in.size() < 2) {
+    return Truncated();
+  }
+  U8 tag = in[0];
+  U8 length_byte = in[1];
+  Size header_size = 2;
+  if ((tag & 0x1f) == 0x1f) {
+    AppendErrorMessage(status) += "Multi-byte DER tags are not supported";
+    return element;
+  }
+  Size length = length_byte;
+  if (length_byte & 0x80) {
+    int length_size = length_byte & 0x7f;
+    if (length_size == 0 || length_size > 4) {
+      AppendErrorMessage(status) +=
+          f("Unsupported DER length encoding 0x%02x", length_byte);
+      return element;
+    }
+    if (in.size() < header_size + length_size) {
+      return Truncated();
+    }
+    length = 0;
+    for (int i = 0; i < length_size; ++i) {
+      length = (length << 8) | (U8)in[header_size++];
+    }
+  }
+  if (in.size() - header_size < length) {
+    return Truncated();
+  }
+  element.tag = tag;
+  element.contents = in.subspan(header_size, length);
+  element.encoded = in.first(header_size + length);
+  in = in.subspan(header_size + length);
+  return element;
+}
+
+Span<> Read(Span<> &in, U8 tag, Status &status) {
+  Element element = Read(in, status);
+  if (OK(status) && element.tag != tag) {
+    AppendErrorMessage(status) +=
+        f("Expected DER tag 0x%02x but found 0x%02x", tag, element.tag);
+  }
+  return element.contents;
+}
+
+Span<> ReadUnsigned(Span<> &in, Status &status) {
+  Span<> bytes = Read(in, kInteger, status);
+  if (!OK(status)) {
+    return {};
+  }
+  if (bytes.empty() || (bytes[0] & 0x80)) {
+    AppendErrorMessage(status) += "Expected a non-negative DER INTEGER";
+    return {};
+  }
+  if (bytes[0] == 0 && bytes.size() > 1) {
+    bytes = bytes.subspan(1);
+  }
+  return bytes;
+}
+
+Span<> ReadBitStringBytes(Span<> &in, Status &status) {
+  Span<> bits = Read(in, kBitString, status);
+  if (!OK(status)) {
+    return {};
+  }
+  if (bits.empty() || bits[0] != 0) {
+    AppendErrorMessage(status) += "Expected a DER BIT STRING of whole bytes";
+    return {};
+  }
+  return bits.subspan(1);
+}
+
+} // namespace maf::der
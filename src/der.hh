@@ -0,0 +1,54 @@
+#pragma once
+
+#include "int.hh"
+#include "span.hh"
+#include "status.hh"
+
+// Distinguished Encoding Rules (X.690) - binary encoding of ASN.1, used by
+// certificates & keys. Reading only.
+namespace maf::der {
+
+// Tags of the universal types used by certificates & keys.
+constexpr U8 kBoolean = 0x01;
+constexpr U8 kInteger = 0x02;
+constexpr U8 kBitString = 0x03;
+constexpr U8 kOctetString = 0x04;
+constexpr U8 kNull = 0x05;
+constexpr U8 kObjectIdentifier = 0x06;
+constexpr U8 kUTCTime = 0x17;
+constexpr U8 kGeneralizedTime = 0x18;
+constexpr U8 kSequence = 0x30;
+constexpr U8 kSet = 0x31;
+
+// Tag of a context-specific, constructed element ([0] EXPLICIT, ...).
+constexpr U8 Explicit(U8 n) { return 0xa0 | n; }
+
+// Tag of a context-specific, primitive element ([2] IMPLICIT, ...).
+constexpr U8 Implicit(U8 n) { return 0x80 | n; }
+
+struct Element {
+  U8 tag = 0;
+  Span<> contents;
+  // Whole element, including the tag & length.
+  Span<> encoded;
+};
+
+// Read the element at the start of `in` & remove it from `in`. Supports only
+// single-byte tags & definite lengths (as required by DER).
+Element Read(Span<> &in, Status &);
+
+// Same as above, but fails unless the element has the given `tag`. Returns its
+// contents.
+Span<> Read(Span<> &in, U8 tag, Status &);
+
+// Whether `in` starts with an element with the given `tag`.
+inline bool Peek(Span<> in, U8 tag) { return !in.empty() && (U8)in[0] == tag; }
+
+// Read a non-negative INTEGER. Returns its big-endian bytes, without the
+// leading zero byte.
+Span<> ReadUnsigned(Span<> &in, Status &);
+
+// Read a BIT STRING which holds whole bytes (for example a key or signature).
+Span<> ReadBitStringBytes(Span<> &in, Status &);
+
+} // namespace maf::der
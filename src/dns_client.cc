@@ -380,8 +380,7 @@ PendingEntry::PendingEntry(Question question, Big<U16> id, LookupBase *lookup)
   question.write_to(buffer);
   IP upstream_ip =
       etc::resolv[(++server_i) % etc::resolv.size()]; // Round-robin
-  Str err;
-  client.fd.SendTo(upstream_ip, kServerPort, buffer, err);
+  client.QueueSendTo(upstream_ip, kServerPort, buffer);
 }
 
 void Override(const Str &domain, IP ip) {
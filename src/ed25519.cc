@@ -0,0 +1,414 @@
+#include "ed25519.hh"
+
+#include <cstring>
+
+#include "int.hh"
+#include "sha.hh"
+
+namespace maf::ed25519 {
+
+namespace {
+
+typedef unsigned U128 __attribute__((mode(TI)));
+
+constexpr U64 kMask51 = (U64(1) << 51) - 1;
+
+// Element of GF(2^255 - 19), as five 51-bit limbs (little-endian).
+struct Fe {
+  U64 v[5];
+};
+
+Fe FeFromInt(U64 x) { return Fe{{x, 0, 0, 0, 0}}; }
+
+void Carry(Fe &f) {
+  for (int i = 0; i < 4; ++i) {
+    f.v[i + 1] += f.v[i] >> 51;
+    f.v[i] &= kMask51;
+  }
+  f.v[0] += 19 * (f.v[4] >> 51);
+  f.v[4] &= kMask51;
+  f.v[1] += f.v[0] >> 51;
+  f.v[0] &= kMask51;
+}
+
+Fe operator+(const Fe &a, const Fe &b) {
+  Fe r;
+  for (int i = 0; i < 5; ++i) {
+    r.v[i] = a.v[i] + b.v[i];
+  }
+  Carry(r);
+  return r;
+}
+
+Fe operator-(const Fe &a, const Fe &b) {
+  // Add 4p so that the limbs don't underflow.
+  constexpr U64 k4P0 = 0x1fffffffffffb4;
+  constexpr U64 k4P = 0x1ffffffffffffc;
+  Fe r;
+  r.v[0] = a.v[0] + k4P0 - b.v[0];
+  for (int i = 1; i < 5; ++i) {
+    r.v[i] = a.v[i] + k4P - b.v[i];
+  }
+  Carry(r);
+  return r;
+}
+
+Fe operator*(const Fe &a, const Fe &b) {
+  U64 b1 = b.v[1] * 19, b2 = b.v[2] * 19, b3 = b.v[3] * 19, b4 = b.v[4] * 19;
+  const U64 *x = a.v, *y = b.v;
+  U128 t[5];
+  t[0] = (U128)x[0] * y[0] + (U128)x[1] * b4 + (U128)x[2] * b3 +
+         (U128)x[3] * b2 + (U128)x[4] * b1;
+  t[1] = (U128)x[0] * y[1] + (U128)x[1] * y[0] + (U128)x[2] * b4 +
+         (U128)x[3] * b3 + (U128)x[4] * b2;
+  t[2] = (U128)x[0] * y[2] + (U128)x[1] * y[1] + (U128)x[2] * y[0] +
+         (U128)x[3] * b4 + (U128)x[4] * b3;
+  t[3] = (U128)x[0] * y[3] + (U128)x[1] * y[2] + (U128)x[2] * y[1] +
+         (U128)x[3] * y[0] + (U128)x[4] * b4;
+  t[4] = (U128)x[0] * y[4] + (U128)x[1] * y[3] + (U128)x[2] * y[2] +
+         (U128)x[3] * y[1] + (U128)x[4] * y[0];
+  Fe r;
+  for (int i = 0; i < 4; ++i) {
+    t[i + 1] += t[i] >> 51;
+    r.v[i] = (U64)t[i] & kMask51;
+  }
+  r.v[4] = (U64)t[4] & kMask51;
+  r.v[0] += 19 * (U64)(t[4] >> 51);
+  r.v[1] += r.v[0] >> 51;
+  r.v[0] &= kMask51;
+  return r;
+}
+
+U64 Load64(const U8 *p) {
+  U64 x;
+  memcpy(&x, p, 8);
+  return x;
+}
+
+Fe FeFromBytes(const U8 in[32]) {
+  Fe f;
+  f.v[0] = Load64(in) & kMask51;
+  f.v[1] = (Load64(in + 6) >> 3) & kMask51;
+  f.v[2] = (Load64(in + 12) >> 6) & kMask51;
+  f.v[3] = (Load64(in + 19) >> 1) & kMask51;
+  f.v[4] = (Load64(in + 24) >> 12) & kMask51; // drops the top bit
+  return f;
+}
+
+// Canonical (fully reduced) encoding.
+void FeToBytes(U8 out[32], Fe f) {
+  Carry(f);
+  Carry(f);
+  // f < 2^255 now. It's >= p iff f + 19 overflows 2^255.
+  Fe t = f;
+  t.v[0] += 19;
+  for (int i = 0; i < 4; ++i) {
+    t.v[i + 1] += t.v[i] >> 51;
+    t.v[i] &= kMask51;
+  }
+  if (t.v[4] >> 51) {
+    t.v[4] &= kMask51;
+    f = t;
+  }
+  U64 w[4] = {f.v[0] | f.v[1] << 51, f.v[1] >> 13 | f.v[2] << 38,
+              f.v[2] >> 26 | f.v[3] << 25, f.v[3] >> 39 | f.v[4] << 12};
+  memcpy(out, w, 32);
+}
+
+// `exponent` is little-endian.
+Fe Pow(const Fe &a, const U8 exponent[32]) {
+  Fe r = FeFromInt(1);
+  for (int i = 255; i >= 0; --i) {
+    r = r * r;
+    if ((exponent[i / 8] >> (i % 8)) & 1) {
+      r = r * a;
+    }
+  }
+  return r;
+}
+
+// p - 2, (p - 5) / 8 & (p - 1) / 4 - little-endian.
+struct Exponents {
+  U8 p_minus_2[32], p_minus_5_div_8[32], p_minus_1_div_4[32];
+  Exponents() {
+    memset(p_minus_2, 0xff, 32);
+    p_minus_2[0] = 0xeb;
+    p_minus_2[31] = 0x7f;
+    memset(p_minus_5_div_8, 0xff, 32);
+    p_minus_5_div_8[0] = 0xfd;
+    p_minus_5_div_8[31] = 0x0f;
+    memset(p_minus_1_div_4, 0xff, 32);
+    p_minus_1_div_4[0] = 0xfb;
+    p_minus_1_div_4[31] = 0x1f;
+  }
+};
+
+const Exponents kExponents;
+
+Fe Invert(const Fe &a) { return Pow(a, kExponents.p_minus_2); }
+
+bool IsNegative(const Fe &f) {
+  U8 s[32];
+  FeToBytes(s, f);
+  return s[0] & 1;
+}
+
+bool Equal(const Fe &a, const Fe &b) {
+  U8 sa[32], sb[32];
+  FeToBytes(sa, a);
+  FeToBytes(sb, b);
+  return memcmp(sa, sb, 32) == 0;
+}
+
+// Point in extended coordinates: x = X/Z, y = Y/Z, xy = T/Z.
+struct Point {
+  Fe X, Y, Z, T;
+};
+
+struct Constants {
+  Fe d, d2, sqrt_m1;
+  Point base;
+  Constants();
+};
+
+const Constants &K() {
+  static const Constants constants;
+  return constants;
+}
+
+// Complete addition formula (also works for doubling).
+Point Add(const Point &p, const Point &q) {
+  Fe a = (p.Y - p.X) * (q.Y - q.X);
+  Fe b = (p.Y + p.X) * (q.Y + q.X);
+  Fe c = p.T * q.T * K().d2;
+  Fe d = p.Z * q.Z;
+  d = d + d;
+  Fe e = b - a, f = d - c, g = d + c, h = b + a;
+  return Point{e * f, h * g, g * f, e * h};
+}
+
+void CondSwap(Point &p, Point &q, U64 bit) {
+  U64 mask = -bit;
+  Fe *a[4] = {&p.X, &p.Y, &p.Z, &p.T};
+  Fe *b[4] = {&q.X, &q.Y, &q.Z, &q.T};
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 5; ++j) {
+      U64 x = (a[i]->v[j] ^ b[i]->v[j]) & mask;
+      a[i]->v[j] ^= x;
+      b[i]->v[j] ^= x;
+    }
+  }
+}
+
+// Multiply `q` by the little-endian 256-bit `scalar`.
+Point ScalarMult(Point q, const U8 scalar[32]) {
+  Point p = {FeFromInt(0), FeFromInt(1), FeFromInt(1), FeFromInt(0)};
+  for (int i = 255; i >= 0; --i) {
+    U64 bit = (scalar[i / 8] >> (i % 8)) & 1;
+    CondSwap(p, q, bit);
+    q = Add(q, p);
+    p = Add(p, p);
+    CondSwap(p, q, bit);
+  }
+  return p;
+}
+
+void Encode(U8 out[32], const Point &p) {
+  Fe z_inv = Invert(p.Z);
+  Fe x = p.X * z_inv;
+  Fe y = p.Y * z_inv;
+  FeToBytes(out, y);
+  out[31] ^= IsNegative(x) << 7;
+}
+
+// RFC 8032, section 5.1.3.
+bool Decode(Point &p, const U8 in[32], const Constants &k = K()) {
+  Fe y = FeFromBytes(in);
+  U8 canonical[32];
+  FeToBytes(canonical, y);
+  if (memcmp(canonical, in, 31) || canonical[31] != (in[31] & 0x7f)) {
+    return false; // y >= p
+  }
+  Fe one = FeFromInt(1);
+  Fe y2 = y * y;
+  Fe u = y2 - one;
+  Fe v = k.d * y2 + one;
+  Fe v3 = v * v * v;
+  Fe x = u * v3 * Pow(u * v3 * v3 * v, kExponents.p_minus_5_div_8);
+  Fe vx2 = v * x * x;
+  if (!Equal(vx2, u)) {
+    if (!Equal(vx2, FeFromInt(0) - u)) {
+      return false;
+    }
+    x = x * k.sqrt_m1;
+  }
+  bool sign = in[31] >> 7;
+  if (sign && Equal(x, FeFromInt(0))) {
+    return false;
+  }
+  if (IsNegative(x) != sign) {
+    x = FeFromInt(0) - x;
+  }
+  p = Point{x, y, one, x * y};
+  return true;
+}
+
+Constants::Constants() {
+  d = (FeFromInt(0) - FeFromInt(121665)) * Invert(FeFromInt(121666));
+  d2 = d + d;
+  sqrt_m1 = Pow(FeFromInt(2), kExponents.p_minus_1_div_4);
+  // y = 4/5, x positive
+  U8 base_bytes[32];
+  memset(base_bytes, 0x66, 32);
+  base_bytes[0] = 0x58;
+  Decode(base, base_bytes, *this);
+}
+
+// Order of the base point: 2^252 + 27742317777372353535851937790883648493.
+const I64 kL[32] = {0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+                    0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+                    0,    0,    0,    0,    0,    0,    0,    0,
+                    0,    0,    0,    0,    0,    0,    0,    0x10};
+
+// r = x mod L, where `x` holds 64 little-endian digits (of any magnitude that
+// fits).
+void ModL(U8 r[32], I64 x[64]) {
+  for (int i = 63; i >= 32; --i) {
+    I64 carry = 0;
+    int j;
+    for (j = i - 32; j < i - 12; ++j) {
+      x[j] += carry - 16 * x[i] * kL[j - (i - 32)];
+      carry = (x[j] + 128) >> 8;
+      x[j] -= carry << 8;
+    }
+    x[j] += carry;
+    x[i] = 0;
+  }
+  I64 carry = 0;
+  for (int j = 0; j < 32; ++j) {
+    x[j] += carry - (x[31] >> 4) * kL[j];
+    carry = x[j] >> 8;
+    x[j] &= 255;
+  }
+  for (int j = 0; j < 32; ++j) {
+    x[j] -= carry * kL[j];
+  }
+  for (int i = 0; i < 32; ++i) {
+    x[i + 1] += x[i] >> 8;
+    r[i] = x[i] & 255;
+  }
+}
+
+// Reduce a 64-byte hash modulo L.
+void ReduceHash(U8 r[32], const SHA512 &hash) {
+  I64 x[64];
+  for (int i = 0; i < 64; ++i) {
+    x[i] = (U8)hash.bytes[i];
+  }
+  ModL(r, x);
+}
+
+// Whether the little-endian scalar is < L.
+bool IsCanonicalScalar(const U8 s[32]) {
+  for (int i = 31; i >= 0; --i) {
+    if (s[i] != kL[i]) {
+      return s[i] < kL[i];
+    }
+  }
+  return false; // s == L
+}
+
+// Signing scalar (clamped) & nonce prefix of a private key.
+struct ExpandedKey {
+  U8 scalar[32];
+  U8 prefix[32];
+
+  ExpandedKey(const Private &key) {
+    SHA512 h(Span<>(key.bytes.data(), 32));
+    memcpy(scalar, h.bytes, 32);
+    memcpy(prefix, h.bytes + 32, 32);
+    scalar[0] &= 248;
+    scalar[31] &= 127;
+    scalar[31] |= 64;
+  }
+};
+
+} // namespace
+
+Private Private::From32Bytes(Span<char, 32> bytes) {
+  Private result;
+  memcpy(result.bytes.data(), bytes.data(), 32);
+  return result;
+}
+
+Public Public::FromPrivate(const Private &private_key) {
+  ExpandedKey expanded(private_key);
+  Public result;
+  Encode((U8 *)result.bytes.data(), ScalarMult(K().base, expanded.scalar));
+  return result;
+}
+
+bool Public::operator==(const Public &other) const {
+  return bytes == other.bytes;
+}
+
+Signature Signature::Sign(Span<> message, const Private &private_key,
+                          const Public &public_key) {
+  ExpandedKey expanded(private_key);
+  Signature sig;
+  U8 *R = (U8 *)sig.bytes.data();
+  U8 *S = R + 32;
+
+  U8 r[32];
+  ReduceHash(r, SHA512::Builder()
+                    .Update(Span<>((char *)expanded.prefix, 32))
+                    .Update(message)
+                    .Finalize());
+  Encode(R, ScalarMult(K().base, r));
+
+  U8 k[32];
+  ReduceHash(k, SHA512::Builder()
+                    .Update(Span<>((char *)R, 32))
+                    .Update(Span<>(public_key.bytes.data(), 32))
+                    .Update(message)
+                    .Finalize());
+
+  // S = r + k * scalar (mod L)
+  I64 x[64] = {};
+  for (int i = 0; i < 32; ++i) {
+    x[i] = r[i];
+  }
+  for (int i = 0; i < 32; ++i) {
+    for (int j = 0; j < 32; ++j) {
+      x[i + j] += (I64)k[i] * expanded.scalar[j];
+    }
+  }
+  ModL(S, x);
+  return sig;
+}
+
+bool Signature::Verify(Span<> message, const Public &public_key) const {
+  const U8 *R = (const U8 *)bytes.data();
+  const U8 *S = R + 32;
+  if (!IsCanonicalScalar(S)) {
+    return false;
+  }
+  Point A;
+  if (!Decode(A, (const U8 *)public_key.bytes.data())) {
+    return false;
+  }
+  U8 k[32];
+  ReduceHash(k, SHA512::Builder()
+                    .Update(Span<>((char *)R, 32))
+                    .Update(Span<>(public_key.bytes.data(), 32))
+                    .Update(message)
+                    .Finalize());
+  // Check that S * B - k * A encodes to R.
+  Point minus_A = {FeFromInt(0) - A.X, A.Y, A.Z, FeFromInt(0) - A.T};
+  Point check = Add(ScalarMult(K().base, S), ScalarMult(minus_A, k));
+  U8 encoded[32];
+  Encode(encoded, check);
+  return memcmp(encoded, R, 32) == 0;
+}
+
+} // namespace maf::ed25519
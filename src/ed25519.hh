@@ -0,0 +1,43 @@
+#pragma once
+
+#include "arr.hh"
+#include "span.hh"
+
+// Ed25519 signatures (RFC 8032).
+//
+// Straightforward implementation (radix 2^51 field arithmetic, complete
+// twisted Edwards addition). Not optimized for speed.
+namespace maf::ed25519 {
+
+struct Private {
+  // Private key is a 32-byte seed. The signing scalar & nonce prefix are
+  // derived from it with SHA-512.
+  Arr<char, 32> bytes;
+
+  static Private From32Bytes(Span<char, 32> bytes);
+
+  operator Span<>() { return bytes; }
+};
+
+struct Public {
+  Arr<char, 32> bytes;
+
+  static Public FromPrivate(const Private &);
+
+  bool operator==(const Public &) const;
+  operator Span<>() { return bytes; }
+};
+
+struct Signature {
+  Arr<char, 64> bytes;
+
+  static Signature Sign(Span<> message, const Private &, const Public &);
+
+  // Returns false if the signature doesn't match the message & key (or if the
+  // key or signature is malformed).
+  bool Verify(Span<> message, const Public &) const;
+
+  operator Span<>() { return bytes; }
+};
+
+} // namespace maf::ed25519
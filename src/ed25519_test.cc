@@ -0,0 +1,58 @@
+#include "ed25519.hh"
+
+#include "gtest.hh"
+#include "hex.hh"
+
+using namespace maf;
+using namespace maf::ed25519;
+
+// Test vectors from RFC 8032, section 7.1.
+
+TEST(Ed25519Test, Test1) {
+  auto seed = HexArr(
+      "9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60");
+  Private private_key = Private::From32Bytes(seed);
+  Public public_key = Public::FromPrivate(private_key);
+  EXPECT_EQ(BytesToHex(public_key.bytes),
+            "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+  Signature sig = Signature::Sign(kEmptySpan, private_key, public_key);
+  EXPECT_EQ(BytesToHex(sig.bytes),
+            "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+            "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b");
+  EXPECT_TRUE(sig.Verify(kEmptySpan, public_key));
+}
+
+TEST(Ed25519Test, Test2) {
+  auto seed = HexArr(
+      "4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb");
+  auto message = HexArr("72");
+  Private private_key = Private::From32Bytes(seed);
+  Public public_key = Public::FromPrivate(private_key);
+  EXPECT_EQ(BytesToHex(public_key.bytes),
+            "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c");
+  Signature sig = Signature::Sign(message, private_key, public_key);
+  EXPECT_EQ(BytesToHex(sig.bytes),
+            "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+            "085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00");
+  EXPECT_TRUE(sig.Verify(message, public_key));
+}
+
+TEST(Ed25519Test, RejectsTampering) {
+  auto seed = HexArr(
+      "4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb");
+  auto message = HexArr("72");
+  Private private_key = Private::From32Bytes(seed);
+  Public public_key = Public::FromPrivate(private_key);
+  Signature sig = Signature::Sign(message, private_key, public_key);
+
+  auto other_message = HexArr("73");
+  EXPECT_FALSE(sig.Verify(other_message, public_key));
+
+  Signature bad_r = sig;
+  bad_r.bytes[0] ^= 1;
+  EXPECT_FALSE(bad_r.Verify(message, public_key));
+
+  Signature bad_s = sig;
+  bad_s.bytes[63] |= 0x80; // S >= L
+  EXPECT_FALSE(bad_s.Verify(message, public_key));
+}
@@ -1,9 +1,12 @@
 #include "epoll.hh"
 
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/epoll.h>
 
+#include "vec.hh"
+
 //  #define DEBUG_EPOLL
 
 #ifdef DEBUG_EPOLL
@@ -16,8 +19,10 @@ thread_local int fd = 0;
 thread_local int listener_count = 0;
 
 static constexpr int kMaxEpollEvents = 10;
-static epoll_event events[kMaxEpollEvents];
-static int events_count = 0;
+thread_local static epoll_event events[kMaxEpollEvents];
+thread_local static int events_count = 0;
+
+thread_local static Vec<Listener *> scheduled_flushes;
 
 void Init() { fd = epoll_create1(EPOLL_CLOEXEC); }
 
@@ -72,14 +77,52 @@ void Del(Listener *l, Status &status) {
       events[i].data.ptr = nullptr;
     }
   }
+  if (l->flush_scheduled) {
+    std::replace(scheduled_flushes.begin(), scheduled_flushes.end(), l,
+                 (Listener *)nullptr);
+    l->flush_scheduled = false;
+  }
 #ifdef DEBUG_EPOLL
   LOG << "Removed listener for " << l->Name() << l->fd << ". Currently "
       << listener_count << " active listeners.";
 #endif
 }
 
+void ScheduleFlush(Listener *listener) {
+  if (listener->flush_scheduled) {
+    return;
+  }
+  listener->flush_scheduled = true;
+  scheduled_flushes.push_back(listener);
+}
+
+static void RunScheduledFlushes(Status &status) {
+  // Flushes may schedule more flushes (or remove listeners) so the list is
+  // processed by index & re-checked on every step.
+  int i = 0;
+  while (i < scheduled_flushes.size() && status.Ok()) {
+    Listener *l = scheduled_flushes[i++];
+    if (l == nullptr) {
+      continue;
+    }
+    l->flush_scheduled = false;
+    l->NotifyFlush(status);
+#ifdef DEBUG_EPOLL
+    if (!status.Ok()) {
+      ERROR << l->Name() << ": " << ErrorMessage(status);
+    }
+#endif
+  }
+  scheduled_flushes.erase(scheduled_flushes.begin(),
+                          scheduled_flushes.begin() + i);
+}
+
 void Loop(Status &status) {
   for (;;) {
+    RunScheduledFlushes(status);
+    if (!status.Ok()) {
+      return;
+    }
     if (listener_count == 0) {
       break;
     }
@@ -138,6 +181,17 @@ void Loop(Status &status) {
         }
 #endif
       }
+      if (events[i].data.ptr == nullptr)
+        continue;
+      if (events[i].events & EPOLLERR) {
+        l->NotifyError(status);
+        if (!status.Ok()) {
+#ifdef DEBUG_EPOLL
+          ERROR << l->Name() << ": " << ErrorMessage(status);
+#endif
+          return;
+        }
+      }
     }
     events_count = 0;
   }
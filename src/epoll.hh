@@ -20,6 +20,9 @@ struct Listener {
   // Whether this Listener is interested for NotifyWrite.
   bool notify_write = false;
 
+  // Whether NotifyFlush is going to be called. See `ScheduleFlush`.
+  bool flush_scheduled = false;
+
   Listener() = default;
   Listener(FD fd) : fd(std::move(fd)) {}
 
@@ -33,6 +36,14 @@ struct Listener {
   // writing.
   virtual void NotifyWrite(Status &){};
 
+  // Method called when the file descriptor reports an error condition
+  // (EPOLLERR) - for example when its error queue holds TX timestamps.
+  virtual void NotifyError(Status &){};
+
+  // Method called after all of the events of the current loop iteration were
+  // handled - if it was requested with `ScheduleFlush`.
+  virtual void NotifyFlush(Status &){};
+
   virtual const char *Name() const = 0;
 
   // Less-than operator for use in std::set.
@@ -57,6 +68,12 @@ void Mod(Listener *, Status &);
 // Remove the specified file descriptor from this epoll instance.
 void Del(Listener *, Status &);
 
+// Call `NotifyFlush` of this listener once all of the events of the current
+// loop iteration are handled (or before waiting for the first events).
+//
+// Allows listeners to batch work (for example syscalls) from several events.
+void ScheduleFlush(Listener *);
+
 // Poll events until an error is returned or all listeners drop.
 void Loop(Status &);
 
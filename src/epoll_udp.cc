@@ -1,14 +1,166 @@
 #include "epoll_udp.hh"
 #include "status.hh"
 #include <cstring>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 namespace maf::epoll {
 
+void UDPListener::HandleBatch(Span<Datagram> batch) {
+  for (auto &datagram : batch) {
+    if (fd == -1) {
+      break; // listener was closed by one of the handlers
+    }
+    request_buffer = datagram.buffer;
+    request_received_at = datagram.received_at;
+    HandleRequest(datagram.data, datagram.source_ip, datagram.source_port);
+  }
+  request_buffer = nullptr;
+}
+
+void UDPListener::TakeReceiveBuffers(Size count) {
+  batch_buffers.resize(count, nullptr);
+  for (auto &buffer : batch_buffers) {
+    if (buffer && buffer->Shared()) {
+      // Kept by a handler - leave it & continue with a fresh one.
+      buffer->Release();
+      buffer = nullptr;
+    }
+    if (buffer == nullptr) {
+      buffer = ReceiveBuffer::Take();
+    }
+  }
+}
+
+void UDPListener::ReleaseReceiveBuffers() {
+  for (auto *buffer : batch_buffers) {
+    buffer->Release();
+  }
+  batch_buffers.clear();
+}
+
+void UDPListener::EnableGRO(Status &status) {
+  int one = 1;
+  if (setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+    AppendErrorMessage(status) += "setsockopt(UDP_GRO)";
+    return;
+  }
+  gro = true;
+}
+
+// Size of the segments of a coalesced (GRO) datagram or 0.
+static Size GROSegmentSize(msghdr &msg) {
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int segment_size;
+      memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+      return segment_size;
+    }
+  }
+  return 0;
+}
+
+// Room for UDP_GRO & SCM_TIMESTAMPING.
+static constexpr Size kRecvControlSize =
+    CMSG_SPACE(sizeof(int)) + Timestamping::kControlSize;
+
+void UDPListener::EnableTimestamping(bool rx, bool tx, Status &status) {
+  timestamping.Enable(fd, rx, tx, status);
+}
+
+void UDPListener::ReadBatches(Status &status) {
+  Size batch_size = std::max<Size>(recv_batch_size, 1);
+  if (batch_headers.size() != batch_size) {
+    batch_headers.resize(batch_size);
+    batch_iovecs.resize(batch_size);
+    batch_addrs.resize(batch_size);
+    batch_control.resize(batch_size * kRecvControlSize);
+  }
+  Size slot_size = std::min(recv_buffer_size, ReceiveBuffer::kCapacity);
+  Size slots_per_buffer = ReceiveBuffer::kCapacity / slot_size;
+  while (fd != -1) {
+    TakeReceiveBuffers((batch_size + slots_per_buffer - 1) / slots_per_buffer);
+    for (Size i = 0; i < batch_size; ++i) {
+      ReceiveBuffer *buffer = batch_buffers[i / slots_per_buffer];
+      batch_iovecs[i] = {
+          .iov_base = buffer->data + i % slots_per_buffer * slot_size,
+          .iov_len = slot_size};
+      // recvmmsg overwrites msg_namelen & msg_flags so they must be reset.
+      batch_headers[i].msg_hdr = {.msg_name = &batch_addrs[i],
+                                  .msg_namelen = sizeof(sockaddr_in),
+                                  .msg_iov = &batch_iovecs[i],
+                                  .msg_iovlen = 1};
+      if (gro || timestamping.rx) {
+        batch_headers[i].msg_hdr.msg_control =
+            &batch_control[i * kRecvControlSize];
+        batch_headers[i].msg_hdr.msg_controllen = kRecvControlSize;
+      }
+    }
+    int n = recvmmsg(fd, batch_headers.data(), batch_size, 0, nullptr);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        errno = 0;
+        break;
+      } else {
+        AppendErrorMessage(status) += "UDPListener recvmmsg";
+        break;
+      }
+    }
+    Timestamping::Clock::time_point now;
+    if (timestamping.rx) {
+      now = Timestamping::Clock::now();
+    }
+    batch_datagrams.clear();
+    for (int i = 0; i < n; ++i) {
+      msghdr &msg = batch_headers[i].msg_hdr;
+      if (msg.msg_flags & MSG_TRUNC) {
+        continue; // datagram didn't fit in `recv_buffer_size`
+      }
+      Datagram datagram = {
+          .data = StrView((char *)batch_iovecs[i].iov_base,
+                          batch_headers[i].msg_len),
+          .source_ip = IP(batch_addrs[i].sin_addr.s_addr),
+          .source_port = Big<U16>(batch_addrs[i].sin_port).big_endian,
+          .buffer = batch_buffers[i / slots_per_buffer],
+      };
+      if (timestamping.rx) {
+        datagram.received_at = Timestamping::ReceivedAt(msg);
+        timestamping.RecordReceived(datagram.received_at, now);
+      }
+      Size segment_size = gro ? GROSegmentSize(msg) : 0;
+      if (segment_size == 0) {
+        batch_datagrams.push_back(datagram);
+        continue;
+      }
+      // Only the last segment may be shorter than `segment_size`.
+      StrView rest = datagram.data;
+      while (!rest.empty()) {
+        datagram.data = rest.substr(0, segment_size);
+        rest.remove_prefix(datagram.data.size());
+        batch_datagrams.push_back(datagram);
+      }
+    }
+    HandleBatch(batch_datagrams);
+    if ((Size)n < batch_size) {
+      break; // socket queue is empty - avoid the extra syscall
+    }
+  }
+  ReleaseReceiveBuffers();
+}
+
 void UDPListener::NotifyRead(Status &status) {
+  if (recv_batch_size > 1 || gro || timestamping.rx) {
+    ReadBatches(status);
+    return;
+  }
   while (fd != -1) {
+    TakeReceiveBuffers(1);
+    ReceiveBuffer *buffer = batch_buffers[0];
     sockaddr_in clientaddr;
     socklen_t clilen = sizeof(struct sockaddr);
-    SSize len = recvfrom(fd, recvbuf, sizeof(recvbuf), 0,
+    SSize len = recvfrom(fd, buffer->data, ReceiveBuffer::kCapacity, 0,
                          (struct sockaddr *)&clientaddr, &clilen);
     if (len < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -16,13 +168,149 @@ void UDPListener::NotifyRead(Status &status) {
         break;
       } else {
         AppendErrorMessage(status) += "UDPListener recvfrom";
-        return;
+        break;
       }
     }
     IP source_ip(clientaddr.sin_addr.s_addr);
     U16 source_port = Big<U16>(clientaddr.sin_port).big_endian;
-    HandleRequest(StrView((char *)recvbuf, len), source_ip, source_port);
+    request_buffer = buffer;
+    HandleRequest(StrView(buffer->data, len), source_ip, source_port);
+    request_buffer = nullptr;
   }
+  ReleaseReceiveBuffers();
 }
 
-} // namespace maf::epoll
\ No newline at end of file
+void UDPListener::QueueSendTo(IP remote_ip, U16 remote_port, StrView buffer) {
+  send_queue.push_back({
+      .offset = send_buffer.size(),
+      .size = buffer.size(),
+      .addr = {.sin_family = AF_INET,
+               .sin_port = Big(remote_port).big_endian,
+               .sin_addr = {.s_addr = remote_ip.addr}},
+  });
+  send_buffer.insert(send_buffer.end(), buffer.begin(), buffer.end());
+  if (!notify_write) { // otherwise we're waiting for EPOLLOUT anyway
+    ScheduleFlush(this);
+  }
+}
+
+// Limits of a single UDP_SEGMENT message (UDP_MAX_SEGMENTS & the maximum
+// IPv4 UDP payload).
+static constexpr Size kMaxGSOSegments = 64;
+static constexpr Size kMaxGSOBytes = 65507;
+
+static constexpr Size kGSOControlSize = CMSG_SPACE(sizeof(U16));
+
+static bool SameDestination(const sockaddr_in &a, const sockaddr_in &b) {
+  return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+void UDPListener::FlushSendQueue() {
+  while (fd != -1 && send_queue_pos < send_queue.size()) {
+    send_iovecs.clear();
+    send_segments.clear();
+    send_control.resize(UIO_MAXIOV * kGSOControlSize);
+    Size i = send_queue_pos;
+    while (i < send_queue.size() && send_iovecs.size() < UIO_MAXIOV) {
+      QueuedDatagram &first = send_queue[i];
+      Size segments = 1;
+      Size bytes = first.size;
+      if (gso && first.size > 0) {
+        // Queued datagrams are contiguous in `send_buffer` so a run of them
+        // can be sent as a single buffer.
+        while (i + segments < send_queue.size() &&
+               segments < kMaxGSOSegments) {
+          QueuedDatagram &next = send_queue[i + segments];
+          if (!SameDestination(first.addr, next.addr) ||
+              next.size > first.size || next.size == 0 ||
+              bytes + next.size > kMaxGSOBytes) {
+            break;
+          }
+          bytes += next.size;
+          ++segments;
+          if (next.size < first.size) {
+            break; // only the last segment may be shorter
+          }
+        }
+      }
+      send_iovecs.push_back(
+          {.iov_base = &send_buffer[first.offset], .iov_len = bytes});
+      send_segments.push_back(segments);
+      i += segments;
+    }
+    Size n = send_iovecs.size();
+    send_headers.resize(n);
+    for (Size j = 0, pos = send_queue_pos; j < n; pos += send_segments[j++]) {
+      QueuedDatagram &first = send_queue[pos];
+      msghdr &msg = send_headers[j].msg_hdr;
+      msg = {.msg_name = &first.addr,
+             .msg_namelen = sizeof(sockaddr_in),
+             .msg_iov = &send_iovecs[j],
+             .msg_iovlen = 1};
+      if (send_segments[j] > 1) {
+        msg.msg_control = &send_control[j * kGSOControlSize];
+        msg.msg_controllen = kGSOControlSize;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(U16));
+        U16 segment_size = first.size;
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+      }
+    }
+    Timestamping::Clock::time_point now;
+    if (timestamping.tx) {
+      now = Timestamping::Clock::now();
+    }
+    int sent = sendmmsg(fd, send_headers.data(), n, 0);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        errno = 0;
+        if (!notify_write) {
+          notify_write = true;
+          Status ignore;
+          Mod(this, ignore);
+        }
+        return;
+      }
+      last_send_error = "sendmmsg: ";
+      last_send_error += strerror(errno);
+      if (send_segments[0] > 1 && (errno == EINVAL || errno == EIO)) {
+        // Kernel or device can't segment this message - retry without GSO.
+        errno = 0;
+        gso = false;
+        continue;
+      }
+      // Error is reported for the first message of the batch. Drop it &
+      // continue with the rest.
+      send_errors += send_segments[0];
+      errno = 0;
+      send_queue_pos += send_segments[0];
+      continue;
+    }
+    for (int j = 0; j < sent; ++j) {
+      send_queue_pos += send_segments[j];
+      timestamping.RecordSend(1, now);
+    }
+  }
+  send_queue.clear();
+  send_buffer.clear();
+  send_queue_pos = 0;
+  if (notify_write) {
+    notify_write = false;
+    Status ignore;
+    Mod(this, ignore);
+  }
+}
+
+void UDPListener::NotifyWrite(Status &) { FlushSendQueue(); }
+
+void UDPListener::NotifyError(Status &) {
+  if (timestamping.tx) {
+    timestamping.ReadErrorQueue(fd);
+  }
+}
+
+void UDPListener::NotifyFlush(Status &) { FlushSendQueue(); }
+
+} // namespace maf::epoll
@@ -1,21 +1,135 @@
 #pragma once
 
+#include <netinet/in.h>
 #include <string>
 #include <string_view>
+#include <sys/socket.h>
 
 #include "epoll.hh"
 #include "int.hh"
+#include "recv_buffer.hh"
+#include "span.hh"
+#include "status.hh"
 #include "str.hh"
+#include "timestamping.hh"
+#include "vec.hh"
 
 namespace maf::epoll {
 
 struct UDPListener : Listener {
+  struct Datagram {
+    StrView data;
+    IP source_ip;
+    U16 source_port;
+    // Holds `data`. Take a `ReceiveBuffer::Ref` to keep the data after the
+    // handler returns (for example to hand it off to another thread).
+    ReceiveBuffer *buffer;
+    // Kernel RX timestamp. Only set when RX timestamping is enabled.
+    Timestamping::Clock::time_point received_at;
+  };
+
+  // Maximum number of datagrams received with a single `recvmmsg` call.
+  //
+  // When set to 1, datagrams are received one by one with `recvfrom`. 0 is
+  // treated as 1.
+  Size recv_batch_size = 1;
+
+  // Size of the buffer for each datagram of a batch (at most
+  // `ReceiveBuffer::kCapacity`). Longer datagrams are dropped. Smaller sizes
+  // let several datagrams share one `ReceiveBuffer`.
+  //
+  // With GRO this must fit the coalesced datagrams (up to 64 KiB).
+  Size recv_buffer_size = ReceiveBuffer::kCapacity;
+
+  // Ask the kernel to coalesce consecutive datagrams from the same source
+  // (UDP_GRO). They're split back into individual datagrams (using the segment
+  // size reported in cmsg) before `HandleBatch` is called.
+  //
+  // Datagrams are then always received with `recvmmsg`.
+  void EnableGRO(Status &);
+  bool gro = false;
+
+  // Kernel timestamps & the latency histograms derived from them.
+  //
+  // With RX timestamps, datagrams are always received with `recvmmsg`. TX
+  // timestamps cover the datagrams sent with `QueueSendTo`.
+  Timestamping timestamping;
+  void EnableTimestamping(bool rx, bool tx, Status &);
+
+  // Send runs of queued datagrams with the same destination & size as single
+  // UDP_SEGMENT (GSO) messages, segmented by the kernel (or the NIC).
+  //
+  // Disabled automatically if the kernel rejects it.
+  bool gso = false;
+
   virtual void HandleRequest(StrView buf, IP source_ip, U16 source_port) = 0;
 
+  // Buffer which holds the datagram passed to the current `HandleRequest`.
+  ReceiveBuffer *request_buffer = nullptr;
+
+  // Kernel RX timestamp of the datagram passed to the current `HandleRequest`.
+  Timestamping::Clock::time_point request_received_at;
+
+  // Called with the datagrams received by a single `recvmmsg`.
+  //
+  // The default implementation calls `HandleRequest` for each datagram.
+  virtual void HandleBatch(Span<Datagram> batch);
+
+  // Queue a datagram for sending. Queued datagrams are sent at the end of the
+  // current epoll loop iteration, with a single `sendmmsg` call.
+  //
+  // When the kernel buffer is full, the datagrams wait for EPOLLOUT rather
+  // than being dropped.
+  void QueueSendTo(IP remote_ip, U16 remote_port, StrView buffer);
+
+  // Send the queued datagrams immediately.
+  void FlushSendQueue();
+
+  // Number of queued datagrams which couldn't be sent (other than because of
+  // a full buffer) & the last reason for that.
+  Size send_errors = 0;
+  Str last_send_error;
+
   void NotifyRead(Status &) override;
+  void NotifyWrite(Status &) override;
+  void NotifyError(Status &) override;
+  void NotifyFlush(Status &) override;
 
 private:
-  U8 recvbuf[65536] = {0};
+  void ReadBatches(Status &);
+  // Make sure that `batch_buffers` has `count` buffers that aren't kept by
+  // any handler.
+  void TakeReceiveBuffers(Size count);
+  void ReleaseReceiveBuffers();
+
+  struct QueuedDatagram {
+    Size offset;
+    Size size;
+    sockaddr_in addr;
+  };
+
+  // Contents of the queued datagrams.
+  Vec<char> send_buffer;
+  Vec<QueuedDatagram> send_queue;
+  // Datagrams before this index were already sent.
+  Size send_queue_pos = 0;
+  // Reused by `FlushSendQueue`.
+  Vec<mmsghdr> send_headers;
+  Vec<iovec> send_iovecs;
+  Vec<char> send_control;
+  // Number of queued datagrams in each of the `send_headers`.
+  Vec<Size> send_segments;
+
+  // Receive buffers are taken from the per-thread pool for the duration of
+  // `NotifyRead` only.
+  Vec<ReceiveBuffer *> batch_buffers;
+
+  // Headers used by `recvmmsg`. Allocated on the first batched read.
+  Vec<mmsghdr> batch_headers;
+  Vec<iovec> batch_iovecs;
+  Vec<sockaddr_in> batch_addrs;
+  Vec<char> batch_control;
+  Vec<Datagram> batch_datagrams;
 };
 
-} // namespace maf::epoll
\ No newline at end of file
+} // namespace maf::epoll
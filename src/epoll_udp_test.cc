@@ -0,0 +1,250 @@
+#include "epoll_udp.hh"
+
+#include <sys/socket.h>
+
+#include "format.hh"
+#include "gtest.hh"
+
+using namespace maf;
+
+static constexpr U16 kPort = 1235;
+
+struct TestListener : epoll::UDPListener {
+  int expected;
+  Vec<Str> received;
+  Vec<Size> batch_sizes;
+
+  TestListener(int expected) : expected(expected) {
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    Status status;
+    fd.Bind(IP(127, 0, 0, 1), kPort, status);
+    EXPECT_TRUE(status.Ok()) << status.ToStr();
+    epoll::Add(this, status);
+    EXPECT_TRUE(status.Ok()) << status.ToStr();
+  }
+
+  void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {
+    EXPECT_EQ(source_ip, IP(127, 0, 0, 1));
+    received.emplace_back(buf);
+    if (received.size() == expected) {
+      Status ignore;
+      epoll::Del(this, ignore);
+      fd.Close();
+    }
+  }
+
+  void HandleBatch(Span<Datagram> batch) override {
+    batch_sizes.push_back(batch.size());
+    UDPListener::HandleBatch(batch);
+  }
+
+  const char *Name() const override { return "TestListener"; }
+};
+
+static void SendDatagrams(int n) {
+  FD sender = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  for (int i = 0; i < n; ++i) {
+    Str err;
+    sender.SendTo(IP(127, 0, 0, 1), kPort, "datagram " + ToStr(i), err);
+    ASSERT_EQ(err, "");
+  }
+}
+
+TEST(UDPListenerTest, SingleDatagrams) {
+  epoll::Init();
+  TestListener listener(3);
+  SendDatagrams(3);
+  Status status;
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_EQ(listener.received,
+            (Vec<Str>{"datagram 0", "datagram 1", "datagram 2"}));
+  EXPECT_TRUE(listener.batch_sizes.empty());
+}
+
+TEST(UDPListenerTest, Batched) {
+  epoll::Init();
+  TestListener listener(20);
+  listener.recv_batch_size = 8;
+  listener.recv_buffer_size = 512;
+  SendDatagrams(20);
+  Status status;
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  ASSERT_EQ(listener.received.size(), 20);
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(listener.received[i], "datagram " + ToStr(i));
+  }
+  // All datagrams were queued before the first read so batches are full.
+  EXPECT_EQ(listener.batch_sizes, (Vec<Size>{8, 8, 4}));
+}
+
+// Batch size 0 is treated as 1 (timestamping forces the `recvmmsg` path).
+TEST(UDPListenerTest, ZeroBatchSize) {
+  epoll::Init();
+  TestListener listener(3);
+  listener.recv_batch_size = 0;
+  Status status;
+  listener.EnableTimestamping(true, false, status);
+  ASSERT_TRUE(status.Ok()) << status.ToStr();
+  SendDatagrams(3);
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_EQ(listener.received,
+            (Vec<Str>{"datagram 0", "datagram 1", "datagram 2"}));
+  EXPECT_EQ(listener.batch_sizes, (Vec<Size>{1, 1, 1}));
+}
+
+TEST(UDPListenerTest, SendQueue) {
+  struct Sender : epoll::UDPListener {
+    Sender() {
+      fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      Status status;
+      epoll::Add(this, status);
+      EXPECT_TRUE(status.Ok()) << status.ToStr();
+    }
+    void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {}
+    void NotifyFlush(Status &status) override {
+      UDPListener::NotifyFlush(status);
+      // Nothing else to send - stop listening.
+      epoll::Del(this, status);
+      fd.Close();
+    }
+    const char *Name() const override { return "Sender"; }
+  };
+
+  epoll::Init();
+  TestListener listener(100);
+  listener.recv_batch_size = 32;
+  listener.recv_buffer_size = 512;
+  Sender sender;
+  for (int i = 0; i < 100; ++i) {
+    sender.QueueSendTo(IP(127, 0, 0, 1), kPort, "datagram " + ToStr(i));
+  }
+  EXPECT_TRUE(listener.received.empty()); // nothing sent before the loop
+
+  Status status;
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_EQ(sender.send_errors, 0) << sender.last_send_error;
+  ASSERT_EQ(listener.received.size(), 100);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(listener.received[i], "datagram " + ToStr(i));
+  }
+}
+
+TEST(UDPListenerTest, SegmentationOffload) {
+  struct Sender : epoll::UDPListener {
+    Sender() {
+      fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      gso = true;
+    }
+    void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {}
+    const char *Name() const override { return "Sender"; }
+  };
+
+  epoll::Init();
+  TestListener listener(41);
+  listener.recv_batch_size = 4;
+  Status status;
+  listener.EnableGRO(status);
+  ASSERT_TRUE(status.Ok()) << status.ToStr();
+  Sender sender;
+  // 40 full segments & a shorter one at the end.
+  for (int i = 0; i < 41; ++i) {
+    Str datagram = f("%03d", i);
+    datagram.resize(i < 40 ? 100 : 50, '.');
+    sender.QueueSendTo(IP(127, 0, 0, 1), kPort, datagram);
+  }
+  sender.FlushSendQueue();
+  EXPECT_EQ(sender.send_errors, 0) << sender.last_send_error;
+  EXPECT_TRUE(sender.gso) << sender.last_send_error;
+
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  ASSERT_EQ(listener.received.size(), 41);
+  for (int i = 0; i < 41; ++i) {
+    EXPECT_EQ(listener.received[i].substr(0, 3), f("%03d", i));
+    EXPECT_EQ(listener.received[i].size(), i < 40 ? 100 : 50);
+  }
+  // Segments arrive coalesced, in fewer reads than datagrams.
+  EXPECT_LT(listener.batch_sizes.size(), 41);
+}
+
+TEST(UDPListenerTest, KeepReceiveBuffer) {
+  struct KeepingListener : TestListener {
+    Vec<std::pair<StrView, ReceiveBuffer::Ref>> kept;
+    KeepingListener() : TestListener(10) {}
+    void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {
+      kept.emplace_back(buf, ReceiveBuffer::Ref(request_buffer));
+      TestListener::HandleRequest(buf, source_ip, source_port);
+    }
+  };
+
+  // UDPListener doesn't embed any receive memory.
+  EXPECT_LT(sizeof(KeepingListener), ReceiveBuffer::kCapacity);
+
+  for (int batch_size : {1, 4}) {
+    epoll::Init();
+    KeepingListener listener;
+    listener.recv_batch_size = batch_size;
+    listener.recv_buffer_size = 1024;
+    SendDatagrams(10);
+    Status status;
+    epoll::Loop(status);
+    EXPECT_TRUE(status.Ok()) << status.ToStr();
+    // Kept datagrams weren't overwritten by the following reads.
+    ASSERT_EQ(listener.kept.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_EQ(listener.kept[i].first, "datagram " + ToStr(i));
+    }
+  }
+}
+
+TEST(UDPListenerTest, Timestamping) {
+  struct TimestampingListener : TestListener {
+    int timestamped = 0;
+    TimestampingListener() : TestListener(5) {}
+    void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {
+      if (request_received_at != Timestamping::Clock::time_point()) {
+        ++timestamped;
+      }
+      TestListener::HandleRequest(buf, source_ip, source_port);
+    }
+  };
+  struct Sender : epoll::UDPListener {
+    Sender() {
+      fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      Status status;
+      EnableTimestamping(false, true, status);
+      EXPECT_TRUE(status.Ok()) << status.ToStr();
+      epoll::Add(this, status);
+    }
+    void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {}
+    void NotifyError(Status &status) override {
+      UDPListener::NotifyError(status);
+      if (timestamping.tx_latency_ns.count == 5) {
+        epoll::Del(this, status);
+        fd.Close();
+      }
+    }
+    const char *Name() const override { return "Sender"; }
+  };
+
+  epoll::Init();
+  TimestampingListener listener;
+  Status status;
+  listener.EnableTimestamping(true, false, status);
+  ASSERT_TRUE(status.Ok()) << status.ToStr();
+  Sender sender;
+  for (int i = 0; i < 5; ++i) {
+    sender.QueueSendTo(IP(127, 0, 0, 1), kPort, "datagram " + ToStr(i));
+  }
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_EQ(listener.received.size(), 5);
+  // Kernel may take a moment to start RX timestamping.
+  EXPECT_GE(listener.timestamped, 4);
+  EXPECT_EQ(listener.timestamping.rx_latency_ns.count, listener.timestamped);
+  EXPECT_EQ(sender.timestamping.tx_latency_ns.count, 5);
+}
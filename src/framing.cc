@@ -0,0 +1,174 @@
+#include "framing.hh"
+
+#include <cstring>
+
+#include "format.hh"
+
+namespace maf::framing {
+
+Format Format::LengthPrefixed(U8 length_size) {
+  return Format{.kind = Kind::kLengthField,
+                .header_size = length_size,
+                .length_offset = 0,
+                .length_size = length_size};
+}
+
+Format Format::Delimited(Str delimiter) {
+  return Format{.kind = Kind::kDelimiter, .delimiter = std::move(delimiter)};
+}
+
+Format Format::HeaderWithLength(Size header_size, Size length_offset,
+                                U8 length_size, SSize length_adjustment) {
+  return Format{.kind = Kind::kLengthField,
+                .header_size = header_size,
+                .length_offset = length_offset,
+                .length_size = length_size,
+                .length_adjustment = length_adjustment};
+}
+
+bool Format::Validate(Status &status) const {
+  if (kind == Kind::kDelimiter) {
+    if (delimiter.empty()) {
+      AppendErrorMessage(status) += "Frame delimiter is empty";
+      return false;
+    }
+    return true;
+  }
+  if (length_size < 1 || length_size > 8) {
+    AppendErrorMessage(status) +=
+        f("Frame length field must have 1 to 8 bytes (got %d)", length_size);
+    return false;
+  }
+  if (length_offset + length_size > header_size) {
+    AppendErrorMessage(status) +=
+        f("Frame length field (bytes %lu-%lu) doesn't fit in the %lu-byte "
+          "header",
+          length_offset, length_offset + length_size, header_size);
+    return false;
+  }
+  return true;
+}
+
+static U64 ReadBigEndian(const char *p, U8 n) {
+  U64 ret = 0;
+  for (U8 i = 0; i < n; ++i) {
+    ret = (ret << 8) | (U8)p[i];
+  }
+  return ret;
+}
+
+static void WriteBigEndian(char *p, U8 n, U64 value) {
+  for (int i = n - 1; i >= 0; --i) {
+    p[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+bool Reader::Next(Span<> buf, Frame &frame, Status &status) {
+  if (!format.Validate(status)) {
+    return false;
+  }
+  Span<> rest = buf.subspan(consumed);
+  if (format.kind == Format::Kind::kLengthField) {
+    if (rest.size() < format.header_size) {
+      return false; // wait for more data
+    }
+    SSize body_size =
+        (SSize)ReadBigEndian(rest.data() + format.length_offset,
+                             format.length_size) +
+        format.length_adjustment;
+    if (body_size < 0 || body_size > format.max_frame_size) {
+      AppendErrorMessage(status) += f("Invalid frame length %ld", body_size);
+      return false;
+    }
+    Size frame_size = format.header_size + body_size;
+    if (rest.size() < frame_size) {
+      return false; // wait for more data
+    }
+    frame.header = rest.first(format.header_size);
+    frame.body = rest.subspan(format.header_size, body_size);
+    consumed += frame_size;
+    return true;
+  } else {
+    Size delim_size = format.delimiter.size();
+    Size from = search_pos > consumed ? search_pos - consumed : 0;
+    if (rest.size() < delim_size + from) {
+      return false;
+    }
+    void *found = memmem(rest.data() + from, rest.size() - from,
+                         format.delimiter.data(), delim_size);
+    if (found == nullptr) {
+      if (rest.size() > format.max_frame_size) {
+        AppendErrorMessage(status) +=
+            f("Frame exceeds %lu bytes", format.max_frame_size);
+        return false;
+      }
+      // Delimiter may be split between this & the next read.
+      search_pos = consumed + rest.size() - delim_size + 1;
+      return false;
+    }
+    Size body_size = (char *)found - rest.data();
+    frame.header = Span<>(rest.data(), 0);
+    frame.body = rest.first(body_size);
+    consumed += body_size + delim_size;
+    search_pos = consumed;
+    return true;
+  }
+}
+
+void Reader::Release(Vec<> &buf) {
+  if (consumed == 0) {
+    return;
+  }
+  buf.erase(buf.begin(), buf.begin() + consumed);
+  search_pos -= std::min(search_pos, consumed);
+  consumed = 0;
+}
+
+Size BeginFrame(Vec<> &buf, const Format &format) {
+  Size frame_begin = buf.size();
+  if (format.kind == Format::Kind::kLengthField) {
+    buf.resize(buf.size() + format.header_size);
+  }
+  return frame_begin;
+}
+
+void EndFrame(Vec<> &buf, const Format &format, Size frame_begin,
+              Status &status) {
+  if (!format.Validate(status)) {
+    buf.resize(frame_begin);
+    return;
+  }
+  if (format.kind == Format::Kind::kLengthField) {
+    Size body_size = buf.size() - frame_begin - format.header_size;
+    SSize length = (SSize)body_size - format.length_adjustment;
+    bool fits = format.length_size == 8 ||
+                (U64)length < (U64)1 << (8 * format.length_size);
+    if (body_size > format.max_frame_size || length < 0 || !fits) {
+      AppendErrorMessage(status) +=
+          f("Frame body of %lu bytes can't be encoded in the length field",
+            body_size);
+      buf.resize(frame_begin);
+      return;
+    }
+    WriteBigEndian(buf.data() + frame_begin + format.length_offset,
+                   format.length_size, length);
+  } else {
+    if (buf.size() - frame_begin > format.max_frame_size) {
+      AppendErrorMessage(status) +=
+          f("Frame exceeds %lu bytes", format.max_frame_size);
+      buf.resize(frame_begin);
+      return;
+    }
+    buf.insert(buf.end(), format.delimiter.begin(), format.delimiter.end());
+  }
+}
+
+void AppendFrame(Vec<> &buf, const Format &format, Span<> body,
+                 Status &status) {
+  Size frame_begin = BeginFrame(buf, format);
+  buf.insert(buf.end(), body.begin(), body.end());
+  EndFrame(buf, format, frame_begin, status);
+}
+
+} // namespace maf::framing
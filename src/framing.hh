@@ -0,0 +1,138 @@
+#pragma once
+
+#include "int.hh"
+#include "span.hh"
+#include "status.hh"
+#include "str.hh"
+#include "stream.hh"
+#include "vec.hh"
+
+// Splitting of byte streams (`Stream::inbox`) into messages.
+//
+// Frames are returned as views into the receive buffer - nothing is copied.
+// Consumed frames are removed from the buffer in bulk, by `Reader::Release`.
+//
+// Usage:
+//
+//   struct RPC : tcp::Connection {
+//     framing::Reader reader{framing::Format::LengthPrefixed(4)};
+//
+//     void NotifyReceived() override {
+//       reader.ForEach(*this, [&](framing::Frame frame) { ... });
+//     }
+//   };
+namespace maf::framing {
+
+// Describes how frames are delimited.
+struct Format {
+  enum class Kind {
+    // Frame starts with a fixed-size header which contains a big-endian
+    // length field.
+    kLengthField,
+    // Frame ends with a delimiter.
+    kDelimiter,
+  } kind;
+
+  // kLengthField: size of the header.
+  Size header_size = 0;
+  // kLengthField: location of the length field within the header.
+  Size length_offset = 0;
+  // kLengthField: size of the length field (1 to 8 bytes).
+  U8 length_size = 0;
+  // kLengthField: number added to the length field to get the size of the
+  // frame body (the part after the header).
+  SSize length_adjustment = 0;
+
+  // kDelimiter: sequence of bytes which ends each frame.
+  Str delimiter;
+
+  // Frames larger than this are treated as a stream corruption.
+  Size max_frame_size = 16 * 1024 * 1024;
+
+  // Frames with a big-endian length of the body as their header.
+  static Format LengthPrefixed(U8 length_size);
+
+  // Frames ended with `delimiter` (for example "\r\n").
+  static Format Delimited(Str delimiter);
+
+  // Frames with a fixed header that contains the body length somewhere inside
+  // (for example TLS records: `HeaderWithLength(5, 3, 2)`).
+  static Format HeaderWithLength(Size header_size, Size length_offset,
+                                 U8 length_size, SSize length_adjustment = 0);
+
+  // Returns false & sets an error on `status` if the fields don't describe a
+  // usable format (empty delimiter, length field outside of the header, etc.).
+  bool Validate(Status &status) const;
+};
+
+struct Frame {
+  // kLengthField: the fixed-size header. kDelimiter: empty.
+  Span<> header;
+  // kLengthField: bytes after the header. kDelimiter: bytes before the
+  // delimiter.
+  Span<> body;
+};
+
+// Returns frames from a receive buffer.
+//
+// Frames remain valid until `Release` is called or the buffer is modified.
+struct Reader {
+  Format format;
+
+  // Offset of the first byte after the frames returned by `Next`.
+  Size consumed = 0;
+
+  // kDelimiter: offset from which the next search should start.
+  Size search_pos = 0;
+
+  Reader(Format format) : format(std::move(format)) {}
+
+  // Returns true & sets `frame` if `buf` contains another complete frame.
+  //
+  // Sets an error on `status` if the stream doesn't follow the format (or the
+  // format itself is invalid).
+  bool Next(Span<> buf, Frame &frame, Status &status);
+
+  // Remove all of the consumed frames from the beginning of `buf`.
+  void Release(Vec<> &buf);
+
+  // Call `fn` with each complete frame in `stream.inbox` & release them
+  // afterwards.
+  //
+  // `fn` may stop the iteration by returning false. The remaining frames stay
+  // in `inbox`.
+  template <typename Fn> void ForEach(Stream &stream, Fn fn) {
+    Frame frame;
+    Status &status = stream;
+    while (Next(stream.inbox, frame, status)) {
+      if constexpr (std::is_same_v<decltype(fn(frame)), bool>) {
+        if (!fn(frame)) {
+          break;
+        }
+      } else {
+        fn(frame);
+      }
+    }
+    Release(stream.inbox);
+  }
+};
+
+// Reserves space for the frame header at the end of `buf`. Returns the
+// offset of the frame, which should be passed to `EndFrame` once the body is
+// appended.
+//
+// For `kDelimiter` this does nothing.
+Size BeginFrame(Vec<> &buf, const Format &);
+
+// Fills in the length field (`kLengthField`) or appends the delimiter
+// (`kDelimiter`).
+//
+// When the body doesn't fit in the length field (or exceeds
+// `max_frame_size`), the frame is removed from `buf` & an error is set on
+// `status`.
+void EndFrame(Vec<> &buf, const Format &, Size frame_begin, Status &);
+
+// Appends a complete frame with the given body. Fails like `EndFrame`.
+void AppendFrame(Vec<> &buf, const Format &, Span<> body, Status &);
+
+} // namespace maf::framing
@@ -0,0 +1,135 @@
+#include "framing.hh"
+
+#include "gtest.hh"
+
+using namespace maf;
+using namespace maf::framing;
+
+static void Append(Vec<> &buf, StrView s) {
+  buf.insert(buf.end(), s.begin(), s.end());
+}
+
+TEST(FramingTest, LengthPrefixed) {
+  Format format = Format::LengthPrefixed(2);
+  Vec<> buf;
+  Status status;
+  AppendFrame(buf, format, Span<>("hello"sv), status);
+  AppendFrame(buf, format, Span<>("world!"sv), status);
+  EXPECT_EQ(buf.size(), 2 + 5 + 2 + 6);
+
+  // Deliver the bytes in two parts, splitting the second frame.
+  Vec<> inbox(buf.begin(), buf.begin() + 9);
+  Reader reader(format);
+  Frame frame;
+  ASSERT_TRUE(reader.Next(inbox, frame, status));
+  EXPECT_EQ(StrViewOf(frame.body), "hello");
+  EXPECT_EQ(frame.body.data(), inbox.data() + 2); // no copy
+  EXPECT_FALSE(reader.Next(inbox, frame, status));
+  reader.Release(inbox);
+  EXPECT_EQ(inbox.size(), 2);
+
+  inbox.insert(inbox.end(), buf.begin() + 9, buf.end());
+  ASSERT_TRUE(reader.Next(inbox, frame, status));
+  EXPECT_EQ(StrViewOf(frame.body), "world!");
+  EXPECT_FALSE(reader.Next(inbox, frame, status));
+  reader.Release(inbox);
+  EXPECT_TRUE(inbox.empty());
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+}
+
+TEST(FramingTest, Delimited) {
+  Reader reader(Format::Delimited("\r\n"));
+  Vec<> inbox;
+  Frame frame;
+  Status status;
+  Append(inbox, "first\r");
+  EXPECT_FALSE(reader.Next(inbox, frame, status));
+  Append(inbox, "\nsecond\r\nthi");
+  ASSERT_TRUE(reader.Next(inbox, frame, status));
+  EXPECT_EQ(StrViewOf(frame.body), "first");
+  ASSERT_TRUE(reader.Next(inbox, frame, status));
+  EXPECT_EQ(StrViewOf(frame.body), "second");
+  EXPECT_FALSE(reader.Next(inbox, frame, status));
+  reader.Release(inbox);
+  EXPECT_EQ(StrViewOf(inbox.Span()), "thi");
+  Append(inbox, "rd\r\n");
+  ASSERT_TRUE(reader.Next(inbox, frame, status));
+  EXPECT_EQ(StrViewOf(frame.body), "third");
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+}
+
+TEST(FramingTest, HeaderWithLength) {
+  // TLS record: type (1), version (2), length (2).
+  Format format = Format::HeaderWithLength(5, 3, 2);
+  Vec<> buf;
+  Size begin = BeginFrame(buf, format);
+  buf[begin] = 0x17;
+  buf[begin + 1] = 0x03;
+  buf[begin + 2] = 0x03;
+  Append(buf, "abc");
+  Status status;
+  EndFrame(buf, format, begin, status);
+  EXPECT_EQ(buf, (Vec<>{0x17, 0x03, 0x03, 0x00, 0x03, 'a', 'b', 'c'}));
+
+  Reader reader(format);
+  Frame frame;
+  ASSERT_TRUE(reader.Next(buf, frame, status));
+  EXPECT_EQ(frame.header.size(), 5);
+  EXPECT_EQ(frame.header[0], 0x17);
+  EXPECT_EQ(StrViewOf(frame.body), "abc");
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+}
+
+TEST(FramingTest, OversizedFrame) {
+  Format format = Format::LengthPrefixed(4);
+  format.max_frame_size = 10;
+  Vec<> inbox = {0, 0, 0, 11};
+  Reader reader(format);
+  Frame frame;
+  Status status;
+  EXPECT_FALSE(reader.Next(inbox, frame, status));
+  EXPECT_FALSE(status.Ok());
+}
+
+TEST(FramingTest, BodyDoesntFitLengthField) {
+  Format format = Format::LengthPrefixed(2);
+  Vec<> buf = {'x'};
+  Vec<> body(70000, 'a');
+  Status status;
+  AppendFrame(buf, format, body, status);
+  EXPECT_FALSE(status.Ok());
+  EXPECT_EQ(buf, Vec<>{'x'}); // no partial frame
+
+  // Body shorter than the adjustment would need a negative length.
+  Status negative_status;
+  format.length_adjustment = 4;
+  AppendFrame(buf, format, Span<>("abc"sv), negative_status);
+  EXPECT_FALSE(negative_status.Ok());
+  EXPECT_EQ(buf, Vec<>{'x'});
+
+  Status oversized_status;
+  format = Format::LengthPrefixed(4);
+  format.max_frame_size = 10;
+  AppendFrame(buf, format, Span<>("hello world"sv), oversized_status);
+  EXPECT_FALSE(oversized_status.Ok());
+  EXPECT_EQ(buf, Vec<>{'x'});
+}
+
+TEST(FramingTest, InvalidFormat) {
+  Vec<> inbox = {'a', 'b', 'c', 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  Frame frame;
+  for (Format format : {Format::Delimited(""), Format::LengthPrefixed(0),
+                        Format::LengthPrefixed(9),
+                        Format::HeaderWithLength(4, 3, 2)}) {
+    Reader reader(format);
+    Status status;
+    EXPECT_FALSE(reader.Next(inbox, frame, status));
+    EXPECT_FALSE(status.Ok());
+
+    Vec<> buf;
+    Status append_status;
+    AppendFrame(buf, format, Span<>("abc"sv), append_status);
+    EXPECT_FALSE(append_status.Ok());
+    EXPECT_TRUE(buf.empty());
+  }
+}
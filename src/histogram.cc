@@ -0,0 +1,61 @@
+#include "histogram.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "format.hh"
+
+namespace maf {
+
+void Histogram::Add(U64 value) {
+  ++buckets[std::min<int>(std::bit_width(value), kBuckets - 1)];
+  ++count;
+  sum += value;
+  max = std::max(max, value);
+}
+
+static U64 BucketEnd(int i) { return i == 0 ? 0 : (U64(1) << i) - 1; }
+
+U64 Histogram::Percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  U64 rank = std::max<U64>(1, std::ceil(count * p / 100));
+  U64 seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return std::min(BucketEnd(i), max);
+    }
+  }
+  return max;
+}
+
+void Histogram::Merge(const Histogram &other) {
+  for (int i = 0; i < kBuckets; ++i) {
+    buckets[i] += other.buckets[i];
+  }
+  count += other.count;
+  sum += other.sum;
+  max = std::max(max, other.max);
+}
+
+Str Histogram::ToStr() const {
+  Str ret = f("n=%lu mean=%.1f p50<=%lu p99<=%lu max=%lu", count, Mean(),
+              Percentile(50), Percentile(99), max);
+  for (int i = 0; i < kBuckets; ++i) {
+    if (buckets[i] == 0) {
+      continue;
+    }
+    if (i == 0) {
+      ret += f(" 0:%lu", buckets[i]);
+    } else {
+      ret += f(" [%lu,%lu):%lu", U64(1) << (i - 1), BucketEnd(i) + 1,
+               buckets[i]);
+    }
+  }
+  return ret;
+}
+
+} // namespace maf
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "int.hh"
+#include "str.hh"
+
+namespace maf {
+
+// Fixed-size histogram with power-of-two buckets.
+//
+// Cheap enough to be updated on every event (no allocations) - meant for
+// long-running latency measurements where `bench::Samples` would grow without
+// bounds. Percentiles are approximate (upper bound of the bucket).
+struct Histogram {
+  static constexpr int kBuckets = 64;
+
+  // Bucket `i` counts values in range [2^(i-1), 2^i). Bucket 0 counts zeros.
+  U64 buckets[kBuckets] = {};
+  U64 count = 0;
+  U64 sum = 0;
+  U64 max = 0;
+
+  void Add(U64 value);
+
+  // Approximate value below which `p` percent of the values fall.
+  U64 Percentile(double p) const;
+
+  double Mean() const { return count ? (double)sum / count : 0; }
+
+  void Merge(const Histogram &other);
+
+  // For example "n=10 mean=7.5 p50<=8 p99<=16 max=12 [4,8):3 [8,16):7".
+  Str ToStr() const;
+};
+
+} // namespace maf
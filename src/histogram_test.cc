@@ -0,0 +1,38 @@
+#include "histogram.hh"
+
+#include "gtest.hh"
+
+using namespace maf;
+
+TEST(HistogramTest, Buckets) {
+  Histogram h;
+  EXPECT_EQ(h.Percentile(50), 0);
+  for (U64 v : {0, 1, 2, 3, 4, 7, 8, 1000}) {
+    h.Add(v);
+  }
+  EXPECT_EQ(h.count, 8);
+  EXPECT_EQ(h.max, 1000);
+  EXPECT_EQ(h.buckets[0], 1); // 0
+  EXPECT_EQ(h.buckets[1], 1); // 1
+  EXPECT_EQ(h.buckets[2], 2); // 2, 3
+  EXPECT_EQ(h.buckets[3], 2); // 4, 7
+  EXPECT_EQ(h.buckets[4], 1); // 8
+  EXPECT_EQ(h.buckets[10], 1); // 1000
+  EXPECT_EQ(h.Percentile(50), 3);
+  EXPECT_EQ(h.Percentile(100), 1000);
+  EXPECT_DOUBLE_EQ(h.Mean(), 1025 / 8.0);
+  EXPECT_EQ(h.ToStr(), "n=8 mean=128.1 p50<=3 p99<=1000 max=1000 0:1 "
+                       "[1,2):1 [2,4):2 [4,8):2 [8,16):1 [512,1024):1");
+}
+
+TEST(HistogramTest, Merge) {
+  Histogram a, b;
+  a.Add(5);
+  b.Add(100);
+  b.Add(6);
+  a.Merge(b);
+  EXPECT_EQ(a.count, 3);
+  EXPECT_EQ(a.sum, 111);
+  EXPECT_EQ(a.max, 100);
+  EXPECT_EQ(a.buckets[3], 2);
+}
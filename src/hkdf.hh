@@ -10,18 +10,21 @@ template <typename Hash> Hash HKDF_Extract(Span<> salt, Span<> ikm) {
   return HMAC<Hash>(salt, ikm);
 }
 
+// T(i) = HMAC(prk, T(i-1) | info | i). Doesn't allocate.
 template <typename Hash> void HKDF_Expand(Span<> prk, Span<> info, Span<> out) {
-  U8 i = 0;
-  Vec<> t;
+  HMAC_Builder<Hash> keyed(prk);
+  Hash t;
+  char i = 0;
   size_t filled = 0;
   while (filled < out.size()) {
+    HMAC_Builder<Hash> builder = keyed;
+    if (i > 0) {
+      builder.Update(t.bytes);
+    }
     ++i;
-    t.insert(t.end(), info.begin(), info.end());
-    t.push_back(i);
-    Hash hmac = HMAC<Hash>(prk, t);
-    t.assign(hmac.bytes, hmac.bytes + sizeof(hmac.bytes));
+    t = builder.Update(info).Update(Span<>(&i, 1)).Finalize();
     size_t n = std::min(out.size() - filled, sizeof(Hash));
-    memcpy(out.data() + filled, hmac.bytes, n);
+    memcpy(out.data() + filled, t.bytes, n);
     filled += n;
   }
 }
@@ -21,20 +21,38 @@ template <typename Hash> Arr<char, Hash::kBlockSize> HMAC_FixedKey(Span<> key) {
   return fixed_key;
 }
 
-template <typename Hash> Hash HMAC(Span<> key, Span<> m) {
-  Arr<char, Hash::kBlockSize> fixed_key = HMAC_FixedKey<Hash>(key);
-  for (int i = 0; i < Hash::kBlockSize; ++i) {
-    fixed_key[i] ^= 0x36;
+// Incremental HMAC. Lets the message be passed in several parts (without
+// concatenating them). A keyed builder can be copied to compute HMACs of
+// several messages with the same key.
+template <typename Hash> struct HMAC_Builder {
+  typename Hash::Builder inner;
+  typename Hash::Builder outer;
+
+  HMAC_Builder(Span<> key) {
+    Arr<char, Hash::kBlockSize> fixed_key = HMAC_FixedKey<Hash>(key);
+    for (int i = 0; i < Hash::kBlockSize; ++i) {
+      fixed_key[i] ^= 0x36;
+    }
+    inner.Update(fixed_key);
+    for (int i = 0; i < Hash::kBlockSize; ++i) {
+      fixed_key[i] ^= 0x36 ^ 0x5c;
+    }
+    outer.Update(fixed_key);
   }
-  auto inner_hash =
-      typename Hash::Builder().Update(fixed_key).Update(m).Finalize();
-  for (int i = 0; i < Hash::kBlockSize; ++i) {
-    fixed_key[i] ^= 0x36 ^ 0x5c;
+
+  HMAC_Builder &Update(Span<> m) {
+    inner.Update(m);
+    return *this;
   }
-  return typename Hash::Builder()
-      .Update(fixed_key)
-      .Update(inner_hash.bytes)
-      .Finalize();
+
+  Hash Finalize() {
+    auto inner_hash = inner.Finalize();
+    return outer.Update(inner_hash.bytes).Finalize();
+  }
+};
+
+template <typename Hash> Hash HMAC(Span<> key, Span<> m) {
+  return HMAC_Builder<Hash>(key).Update(m).Finalize();
 }
 
 } // namespace maf
\ No newline at end of file
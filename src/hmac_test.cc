@@ -13,3 +13,17 @@ TEST(HmacTest, SHA256) {
   EXPECT_EQ(BytesToHex(hmac.bytes),
             "f7bc83f430538424b13298e6aa6fb143ef4d59a14946175997479dbc2d1a3cd8");
 }
+
+TEST(HmacTest, Incremental) {
+  HMAC_Builder<SHA256> keyed(SpanOfCStr("key"));
+  auto builder = keyed; // keyed builder is reusable
+  SHA256 hmac = builder.Update(SpanOfCStr("The quick brown fox "))
+                    .Update(SpanOfCStr("jumps over the lazy dog"))
+                    .Finalize();
+  EXPECT_EQ(BytesToHex(hmac.bytes),
+            "f7bc83f430538424b13298e6aa6fb143ef4d59a14946175997479dbc2d1a3cd8");
+  SHA256 again =
+      keyed.Update(SpanOfCStr("The quick brown fox jumps over the lazy dog"))
+          .Finalize();
+  EXPECT_EQ(BytesToHex(again.bytes), BytesToHex(hmac.bytes));
+}
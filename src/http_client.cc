@@ -8,6 +8,7 @@
 #include "../build/generated/version.hh"
 #include "ip.hh"
 #include "log.hh"
+#include "slab.hh"
 #include "status.hh"
 #include "tcp.hh"
 #include "tls.hh"
@@ -130,7 +131,7 @@ static void SetUrl(RequestBase &req, Str url) {
 
 static void OpenStream(RequestBase &req) {
   if (req.protocol == Protocol::kHttp) {
-    struct HttpStream : tcp::Connection {
+    struct HttpStream : tcp::Connection, Recycled<HttpStream> {
       RequestBase &req;
       HttpStream(RequestBase &req, IP ip, U16 port) : req(req) {
         Connect({
@@ -147,15 +148,9 @@ static void OpenStream(RequestBase &req) {
     };
     req.stream = std::make_unique<HttpStream>(req, req.resolved_ip, req.port);
   } else if (req.protocol == Protocol::kHttps) {
-    struct HttpsStream : tls::Connection {
+    struct HttpsStream : tls::Connection, Recycled<HttpsStream> {
       RequestBase &req;
-      HttpsStream(RequestBase &req, IP ip, U16 port, Str host) : req(req) {
-        Connect({tcp::Connection::Config{
-                     .remote_ip = ip,
-                     .remote_port = port,
-                 },
-                 host});
-      }
+      HttpsStream(RequestBase &req) : req(req) {}
       void NotifyReceived() override {
         if (this == req.stream.get()) {
           ResponseReceived(req);
@@ -167,8 +162,7 @@ static void OpenStream(RequestBase &req) {
         }
       }
     };
-    req.stream =
-        std::make_unique<HttpsStream>(req, req.resolved_ip, req.port, req.host);
+    req.stream = std::make_unique<HttpsStream>(req);
   }
 
   auto Append = [&](StrView str) {
@@ -186,6 +180,19 @@ static void OpenStream(RequestBase &req) {
   Append("Accept: */*\r\n");
   Append("Connection: close\r\n");
   Append("\r\n");
+  if (req.protocol == Protocol::kHttps) {
+    // Connect once the request is ready so that it can go out as 0-RTT data
+    // (GET is idempotent).
+    tls::Connection::Config config = {tcp::Connection::Config{
+                                          .remote_ip = req.resolved_ip,
+                                          .remote_port = req.port,
+                                      },
+                                      req.host};
+    config.early_data = true;
+    // Only HTTP/1.1 is implemented. Servers which would pick "h2" fall back.
+    config.alpn = {"http/1.1"};
+    static_cast<tls::Connection &>(*req.stream).Connect(config);
+  }
   req.stream->Send();
   req.inbox_pos = 0;
   req.parsing_state = RequestBase::ParsingState::Status;
@@ -0,0 +1,42 @@
+#include "pem.hh"
+
+#include "base64.hh"
+
+namespace maf::pem {
+
+static constexpr StrView kBegin = "-----BEGIN ";
+static constexpr StrView kEnd = "-----END ";
+static constexpr StrView kDashes = "-----";
+
+Vec<Block> Decode(StrView text, Status &status) {
+  Vec<Block> blocks;
+  while (true) {
+    Size begin = text.find(kBegin);
+    if (begin == StrView::npos) {
+      break;
+    }
+    text.remove_prefix(begin + kBegin.size());
+    Size label_end = text.find(kDashes);
+    if (label_end == StrView::npos) {
+      AppendErrorMessage(status) += "PEM header is not terminated";
+      return blocks;
+    }
+    Block &block = blocks.emplace_back();
+    block.label = Str(text.substr(0, label_end));
+    text.remove_prefix(label_end + kDashes.size());
+
+    Str footer = Str(kEnd) + block.label + Str(kDashes);
+    Size end = text.find(footer);
+    if (end == StrView::npos) {
+      AppendErrorMessage(status) += "PEM block \"" + block.label +
+                                    "\" is missing its END line";
+      return blocks;
+    }
+    // Base64Decode skips the line breaks.
+    block.der = Base64Decode(text.substr(0, end));
+    text.remove_prefix(end + footer.size());
+  }
+  return blocks;
+}
+
+} // namespace maf::pem
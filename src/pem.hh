@@ -0,0 +1,22 @@
+#pragma once
+
+#include "status.hh"
+#include "str.hh"
+#include "vec.hh"
+
+// Privacy-Enhanced Mail (RFC 7468) - textual encoding of certificates & keys.
+namespace maf::pem {
+
+struct Block {
+  // Type of the block, for example "CERTIFICATE" or "PRIVATE KEY".
+  Str label;
+
+  // Decoded (DER) contents.
+  Vec<> der;
+};
+
+// Decode all of the "-----BEGIN <label>-----" blocks in `text`, in order.
+// Text outside of the blocks is ignored.
+Vec<Block> Decode(StrView text, Status &);
+
+} // namespace maf::pem
@@ -0,0 +1,117 @@
+#include "recv_buffer.hh"
+
+namespace maf {
+
+struct ReceiveBufferPool {
+  // Maximum number of free buffers kept around (16 MiB).
+  static constexpr Size kMaxFree = 256;
+
+  // One reference for the owning thread & one for each buffer that is in use.
+  std::atomic<Size> refs = 1;
+
+  // Accessed only by the owning thread.
+  ReceiveBuffer *free = nullptr;
+  Size free_count = 0;
+
+  // Buffers released by other threads. Lock-free stack which is emptied all
+  // at once by the owning thread (so there is no ABA problem).
+  std::atomic<ReceiveBuffer *> returned = nullptr;
+
+  void Unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // Owning thread has exited & all buffers are back.
+      DeleteList(returned.exchange(nullptr, std::memory_order_acquire));
+      delete this;
+    }
+  }
+
+  static void DeleteList(ReceiveBuffer *buffer) {
+    while (buffer) {
+      delete std::exchange(buffer, buffer->next);
+    }
+  }
+
+  // Move the buffers released by other threads to the free list.
+  void CollectReturned() {
+    ReceiveBuffer *buffer =
+        returned.exchange(nullptr, std::memory_order_acquire);
+    while (buffer) {
+      ReceiveBuffer *next = buffer->next;
+      PushFree(buffer);
+      buffer = next;
+    }
+  }
+
+  void PushFree(ReceiveBuffer *buffer) {
+    if (free_count >= kMaxFree) {
+      delete buffer;
+      return;
+    }
+    buffer->next = free;
+    free = buffer;
+    ++free_count;
+  }
+};
+
+static thread_local ReceiveBufferPool *local_pool = nullptr;
+
+// Gives up the thread's reference to its pool when the thread exits.
+struct LocalPoolOwner {
+  ~LocalPoolOwner() {
+    if (local_pool) {
+      ReceiveBufferPool::DeleteList(local_pool->free);
+      local_pool->free = nullptr;
+      local_pool->free_count = 0;
+      std::exchange(local_pool, nullptr)->Unref();
+    }
+  }
+};
+
+static thread_local LocalPoolOwner local_pool_owner;
+
+static ReceiveBufferPool &LocalPool() {
+  if (local_pool == nullptr) {
+    (void)&local_pool_owner; // make sure the destructor runs
+    local_pool = new ReceiveBufferPool();
+  }
+  return *local_pool;
+}
+
+ReceiveBuffer *ReceiveBuffer::Take() {
+  ReceiveBufferPool &pool = LocalPool();
+  if (pool.free == nullptr) {
+    pool.CollectReturned();
+  }
+  pool.refs.fetch_add(1, std::memory_order_relaxed);
+  if (ReceiveBuffer *buffer = pool.free) {
+    pool.free = buffer->next;
+    --pool.free_count;
+    buffer->refs.store(1, std::memory_order_relaxed);
+    return buffer;
+  }
+  return new ReceiveBuffer(&pool);
+}
+
+void ReceiveBuffer::Release() {
+  if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  ReceiveBufferPool *owner = pool;
+  if (owner == local_pool) {
+    owner->PushFree(this);
+  } else {
+    next = owner->returned.load(std::memory_order_relaxed);
+    while (!owner->returned.compare_exchange_weak(
+        next, this, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+  owner->Unref();
+}
+
+Size ReceiveBufferPoolSize() {
+  ReceiveBufferPool &pool = LocalPool();
+  pool.CollectReturned();
+  return pool.free_count;
+}
+
+} // namespace maf
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include "int.hh"
+
+// Reference counted buffers for received data.
+//
+// Buffers come from a per-thread pool (one per epoll loop), so idle sockets
+// don't hold any receive memory. A handler may keep a reference to the buffer
+// it was given & pass it to another thread - the data is never copied. Once
+// the last reference is dropped (on any thread) the buffer goes back to the
+// pool of the thread which allocated it.
+namespace maf {
+
+struct ReceiveBufferPool;
+
+struct ReceiveBuffer {
+  static constexpr Size kCapacity = 65536;
+
+  std::atomic<U32> refs;
+  ReceiveBufferPool *pool;
+  // Link used while the buffer is in the pool.
+  ReceiveBuffer *next = nullptr;
+  alignas(16) char data[kCapacity];
+
+  ReceiveBuffer(ReceiveBufferPool *pool) : refs(1), pool(pool) {}
+
+  // Returns a buffer from the current thread's pool, with one reference.
+  static ReceiveBuffer *Take();
+
+  void Acquire() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+  // Drop a reference. Can be called from any thread.
+  void Release();
+
+  // True if somebody other than the caller holds a reference.
+  bool Shared() const { return refs.load(std::memory_order_acquire) > 1; }
+
+  // Owning reference to a `ReceiveBuffer`.
+  struct Ref {
+    ReceiveBuffer *buffer = nullptr;
+
+    Ref() = default;
+    explicit Ref(ReceiveBuffer *buffer) : buffer(buffer) {
+      if (buffer) {
+        buffer->Acquire();
+      }
+    }
+    Ref(const Ref &other) : Ref(other.buffer) {}
+    Ref(Ref &&other) : buffer(std::exchange(other.buffer, nullptr)) {}
+    Ref &operator=(Ref other) {
+      std::swap(buffer, other.buffer);
+      return *this;
+    }
+    ~Ref() {
+      if (buffer) {
+        buffer->Release();
+      }
+    }
+
+    ReceiveBuffer *operator->() const { return buffer; }
+    explicit operator bool() const { return buffer != nullptr; }
+  };
+};
+
+// Number of free buffers in the current thread's pool.
+Size ReceiveBufferPoolSize();
+
+} // namespace maf
@@ -0,0 +1,53 @@
+#include "recv_buffer.hh"
+
+#include <thread>
+
+#include "gtest.hh"
+
+using namespace maf;
+
+TEST(ReceiveBufferTest, Reuse) {
+  ReceiveBuffer *a = ReceiveBuffer::Take();
+  a->Release();
+  ReceiveBuffer *b = ReceiveBuffer::Take();
+  EXPECT_EQ(a, b);
+  {
+    ReceiveBuffer::Ref ref(b);
+    b->Release(); // `ref` keeps it alive
+    EXPECT_FALSE(b->Shared());
+    ReceiveBuffer *c = ReceiveBuffer::Take();
+    EXPECT_NE(b, c);
+    c->Release();
+  }
+  EXPECT_GE(ReceiveBufferPoolSize(), 2);
+}
+
+TEST(ReceiveBufferTest, ReleaseOnAnotherThread) {
+  ReceiveBuffer *buffer = ReceiveBuffer::Take();
+  Size free_before = ReceiveBufferPoolSize();
+  buffer->data[0] = 'x';
+  ReceiveBuffer::Ref ref(buffer);
+  buffer->Release();
+  std::thread worker([ref = std::move(ref)]() mutable {
+    EXPECT_EQ(ref->data[0], 'x');
+    ref = ReceiveBuffer::Ref();
+  });
+  worker.join();
+  // Buffer went back to the pool of this thread.
+  EXPECT_EQ(ReceiveBufferPoolSize(), free_before + 1);
+  EXPECT_EQ(ReceiveBuffer::Take(), buffer);
+  buffer->Release();
+}
+
+TEST(ReceiveBufferTest, OutlivesThread) {
+  ReceiveBuffer::Ref ref;
+  std::thread worker([&]() {
+    ReceiveBuffer *buffer = ReceiveBuffer::Take();
+    buffer->data[0] = 'y';
+    ref = ReceiveBuffer::Ref(buffer);
+    buffer->Release();
+  });
+  worker.join();
+  EXPECT_EQ(ref->data[0], 'y');
+  ref = ReceiveBuffer::Ref(); // frees the pool of the exited thread
+}
@@ -0,0 +1,288 @@
+#include "rsa.hh"
+
+#include <bit>
+#include <cstring>
+
+#include "big_endian.hh"
+#include "der.hh"
+#include "hex.hh"
+#include "sha.hh"
+
+namespace maf::rsa {
+
+using Limbs = Vec<U32>;
+
+// Converts big-endian `bytes` into `limbs` little-endian 32-bit limbs.
+static Limbs FromBigEndian(Span<> bytes, Size limbs) {
+  Limbs out(limbs, 0);
+  for (Size i = 0; i < bytes.size(); ++i) {
+    Size byte_index = bytes.size() - 1 - i; // from the least significant
+    out[i / 4] |= (U32)(U8)bytes[byte_index] << (8 * (i % 4));
+  }
+  return out;
+}
+
+static void ToBigEndian(const Limbs &limbs, Span<> out) {
+  for (Size i = 0; i < out.size(); ++i) {
+    Size byte_index = out.size() - 1 - i;
+    out[byte_index] = i / 4 < limbs.size() ? limbs[i / 4] >> (8 * (i % 4)) : 0;
+  }
+}
+
+// Whether a >= b (same number of limbs).
+static bool GreaterOrEqual(const Limbs &a, const Limbs &b) {
+  for (Size i = a.size(); i-- > 0;) {
+    if (a[i] != b[i]) {
+      return a[i] > b[i];
+    }
+  }
+  return true;
+}
+
+// a -= b (same number of limbs). Returns the borrow.
+static U32 Subtract(Limbs &a, const Limbs &b) {
+  U64 borrow = 0;
+  for (Size i = 0; i < a.size(); ++i) {
+    U64 diff = (U64)a[i] - b[i] - borrow;
+    a[i] = (U32)diff;
+    borrow = (diff >> 32) & 1;
+  }
+  return borrow;
+}
+
+// a * b * R^-1 mod n (CIOS Montgomery multiplication).
+static Limbs MontgomeryMultiply(const Public &key, const Limbs &a,
+                                const Limbs &b) {
+  const Limbs &n = key.n;
+  Size s = n.size();
+  Limbs t(s + 2, 0);
+  for (Size i = 0; i < s; ++i) {
+    U64 carry = 0;
+    for (Size j = 0; j < s; ++j) {
+      U64 sum = (U64)t[j] + (U64)a[j] * b[i] + carry;
+      t[j] = (U32)sum;
+      carry = sum >> 32;
+    }
+    U64 sum = (U64)t[s] + carry;
+    t[s] = (U32)sum;
+    t[s + 1] = sum >> 32;
+
+    U32 m = t[0] * key.n0_inv;
+    carry = ((U64)t[0] + (U64)m * n[0]) >> 32;
+    for (Size j = 1; j < s; ++j) {
+      sum = (U64)t[j] + (U64)m * n[j] + carry;
+      t[j - 1] = (U32)sum;
+      carry = sum >> 32;
+    }
+    sum = (U64)t[s] + carry;
+    t[s - 1] = (U32)sum;
+    t[s] = t[s + 1] + (sum >> 32);
+  }
+  bool overflow = t[s] != 0;
+  t.resize(s);
+  if (overflow || GreaterOrEqual(t, n)) {
+    Subtract(t, n);
+  }
+  return t;
+}
+
+// x^e mod n.
+static Limbs PowerModN(const Public &key, const Limbs &x) {
+  Limbs x_mont = MontgomeryMultiply(key, x, key.rr);
+  Limbs acc = x_mont;
+  auto EBit = [&](Size bit) { return (key.e[bit / 32] >> (bit % 32)) & 1; };
+  Size e_bits = key.e.size() * 32;
+  while (!EBit(e_bits - 1)) {
+    --e_bits;
+  }
+  for (Size bit = e_bits - 1; bit-- > 0;) {
+    acc = MontgomeryMultiply(key, acc, acc);
+    if (EBit(bit)) {
+      acc = MontgomeryMultiply(key, acc, x_mont);
+    }
+  }
+  Limbs one(key.n.size(), 0);
+  one[0] = 1;
+  return MontgomeryMultiply(key, acc, one);
+}
+
+Public Public::FromDER(Span<> der, Status &status) {
+  Public key;
+  Span<> sequence = der::Read(der, der::kSequence, status);
+  Span<> n_bytes = der::ReadUnsigned(sequence, status);
+  Span<> e_bytes = der::ReadUnsigned(sequence, status);
+  if (!OK(status)) {
+    AppendErrorMessage(status) += "Invalid RSA public key";
+    return key;
+  }
+  // At least 1024 bits. Odd modulus & exponent (at least 3).
+  if (n_bytes.size() < 128 || n_bytes.size() > 1024 || !(n_bytes.back() & 1) ||
+      e_bytes.size() > 8 || !(e_bytes.back() & 1) ||
+      (e_bytes.size() == 1 && (U8)e_bytes[0] < 3)) {
+    AppendErrorMessage(status) += "Unsupported RSA public key";
+    return key;
+  }
+  Size limbs = (n_bytes.size() + 3) / 4;
+  key.n = FromBigEndian(n_bytes, limbs);
+  key.e = FromBigEndian(e_bytes, (e_bytes.size() + 3) / 4);
+  key.bits = n_bytes.size() * 8 - std::countl_zero((U8)n_bytes[0]);
+
+  // -n^-1 mod 2^32 with Newton's iteration (each step doubles the number of
+  // correct bits).
+  U32 inv = 1;
+  for (int i = 0; i < 5; ++i) {
+    inv *= 2 - key.n[0] * inv;
+  }
+  key.n0_inv = -inv;
+
+  // 2R mod n (R = 2^(32 * limbs)). When the top bit of `n` is set (as in
+  // 2048-bit or 4096-bit keys), R mod n = R - n. Otherwise 1 is doubled
+  // (32 * limbs) times.
+  Limbs two_r(limbs, 0);
+  auto Double = [&]() {
+    U32 carry = 0;
+    for (Size j = 0; j < limbs; ++j) {
+      U32 next_carry = two_r[j] >> 31;
+      two_r[j] = (two_r[j] << 1) | carry;
+      carry = next_carry;
+    }
+    if (carry || GreaterOrEqual(two_r, key.n)) {
+      Subtract(two_r, key.n);
+    }
+  };
+  if (key.bits == limbs * 32) {
+    Subtract(two_r, key.n); // 0 - n = R - n (mod R)
+  } else {
+    two_r[0] = 1;
+    for (Size i = 0; i < limbs * 32; ++i) {
+      Double();
+    }
+  }
+  Double();
+  // ...which is 2 in the Montgomery form. R^2 mod n is the Montgomery form of
+  // R = 2^(32 * limbs).
+  Size exponent = limbs * 32;
+  Limbs acc = two_r;
+  for (int bit = std::bit_width(exponent) - 1; bit-- > 0;) {
+    acc = MontgomeryMultiply(key, acc, acc);
+    if ((exponent >> bit) & 1) {
+      acc = MontgomeryMultiply(key, acc, two_r);
+    }
+  }
+  key.rr = std::move(acc);
+  return key;
+}
+
+// Encoded message (EM) of the `signature` - the signature raised to the
+// public exponent. Empty if the signature is out of range.
+static Vec<> EncodedMessage(const Public &key, Span<> signature) {
+  if (key.n.empty() || signature.size() != key.SignatureSize()) {
+    return {};
+  }
+  Limbs s = FromBigEndian(signature, key.n.size());
+  if (GreaterOrEqual(s, key.n)) {
+    return {};
+  }
+  Vec<> em(key.SignatureSize());
+  ToBigEndian(PowerModN(key, s), em);
+  return em;
+}
+
+// DigestInfo prefixes (RFC 8017, section 9.2, note 1).
+static const auto kDigestInfoSHA256 =
+    HexArr("3031300d060960864801650304020105000420");
+static const auto kDigestInfoSHA512 =
+    HexArr("3051300d060960864801650304020305000440");
+
+static bool VerifyPKCS1(const Public &key, Span<> digest_info, Span<> digest,
+                        Span<> signature) {
+  Vec<> em = EncodedMessage(key, signature);
+  Size t_size = digest_info.size() + digest.size();
+  if (em.size() < t_size + 11) {
+    return false;
+  }
+  Vec<> expected(em.size(), (char)0xff);
+  expected[0] = 0x00;
+  expected[1] = 0x01;
+  Size t_begin = em.size() - t_size;
+  expected[t_begin - 1] = 0x00;
+  memcpy(expected.data() + t_begin, digest_info.data(), digest_info.size());
+  memcpy(expected.data() + t_begin + digest_info.size(), digest.data(),
+         digest.size());
+  return em == expected;
+}
+
+bool VerifyPKCS1_SHA256(const Public &key, Span<> message, Span<> signature) {
+  SHA256 digest(message);
+  Span<> digest_info(kDigestInfoSHA256.data(), kDigestInfoSHA256.size());
+  return VerifyPKCS1(key, digest_info, digest, signature);
+}
+
+bool VerifyPKCS1_SHA512(const Public &key, Span<> message, Span<> signature) {
+  SHA512 digest(message);
+  Span<> digest_info(kDigestInfoSHA512.data(), kDigestInfoSHA512.size());
+  return VerifyPKCS1(key, digest_info, digest, signature);
+}
+
+bool VerifyPSS_SHA256(const Public &key, Span<> message, Span<> signature) {
+  constexpr Size kHashSize = 32;
+  constexpr Size kSaltSize = 32;
+  Vec<> em = EncodedMessage(key, signature);
+  if (em.empty()) {
+    return false;
+  }
+  Size em_bits = key.bits - 1;
+  Size em_size = (em_bits + 7) / 8;
+  Span<> encoded = em;
+  if (em_size < encoded.size()) {
+    if (encoded[0] != 0) {
+      return false;
+    }
+    encoded = encoded.subspan(1);
+  }
+  if (em_size < kHashSize + kSaltSize + 2 || (U8)encoded.back() != 0xbc) {
+    return false;
+  }
+  Size db_size = em_size - kHashSize - 1;
+  Span<> masked_db = encoded.first(db_size);
+  Span<> h = encoded.subspan(db_size, kHashSize);
+  U8 unused_bits_mask = 0xff << (8 - (8 * em_size - em_bits));
+  if (8 * em_size > em_bits && (masked_db[0] & unused_bits_mask)) {
+    return false;
+  }
+  // MGF1 (RFC 8017, appendix B.2.1).
+  Vec<> db(masked_db.begin(), masked_db.end());
+  for (U32 counter = 0; counter * kHashSize < db_size; ++counter) {
+    Big<U32> counter_big(counter);
+    SHA256 mask = SHA256::Builder()
+                      .Update(h)
+                      .Update(Span<>((char *)&counter_big, 4))
+                      .Finalize();
+    for (Size i = 0; i < kHashSize && counter * kHashSize + i < db_size; ++i) {
+      db[counter * kHashSize + i] ^= mask.bytes[i];
+    }
+  }
+  if (8 * em_size > em_bits) {
+    db[0] &= ~unused_bits_mask;
+  }
+  Size padding_size = db_size - kSaltSize - 1;
+  for (Size i = 0; i < padding_size; ++i) {
+    if (db[i] != 0) {
+      return false;
+    }
+  }
+  if (db[padding_size] != 0x01) {
+    return false;
+  }
+  Span<> salt = Span<>(db).subspan(padding_size + 1);
+  char zeros[8] = {};
+  SHA256 m_hash(message);
+  SHA256 expected_h = SHA256::Builder()
+                          .Update(zeros)
+                          .Update(m_hash)
+                          .Update(salt)
+                          .Finalize();
+  return Span<>(expected_h) == h;
+}
+
+} // namespace maf::rsa
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "int.hh"
+#include "span.hh"
+#include "status.hh"
+#include "vec.hh"
+
+// RSA signature verification (RFC 8017). Public keys only - there's no
+// signing or decryption.
+//
+// Montgomery multiplication on 32-bit limbs. Verification uses small public
+// exponents, so this is fast enough for checking certificates.
+namespace maf::rsa {
+
+struct Public {
+  // Modulus & public exponent, as little-endian 32-bit limbs.
+  Vec<U32> n;
+  Vec<U32> e;
+
+  // Bits in the modulus.
+  Size bits = 0;
+
+  // Montgomery constants of `n`: R^2 mod n (R = 2^(32 * n.size())) &
+  // -n^-1 mod 2^32.
+  Vec<U32> rr;
+  U32 n0_inv = 0;
+
+  // Parse a DER-encoded RSAPublicKey (RFC 8017, appendix A.1.1) - the
+  // contents of the subjectPublicKey of a certificate.
+  static Public FromDER(Span<> der, Status &);
+
+  // Size of the signatures, in bytes.
+  Size SignatureSize() const { return (bits + 7) / 8; }
+};
+
+// RSASSA-PKCS1-v1_5 (RFC 8017, section 8.2.2) with SHA-256 or SHA-512.
+bool VerifyPKCS1_SHA256(const Public &, Span<> message, Span<> signature);
+bool VerifyPKCS1_SHA512(const Public &, Span<> message, Span<> signature);
+
+// RSASSA-PSS (RFC 8017, section 8.1.2) with SHA-256, MGF1-SHA-256 & a 32-byte
+// salt - as in the rsa_pss_rsae_sha256 scheme of TLS 1.3.
+bool VerifyPSS_SHA256(const Public &, Span<> message, Span<> signature);
+
+} // namespace maf::rsa
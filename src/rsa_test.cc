@@ -0,0 +1,85 @@
+#include "rsa.hh"
+
+#include "gtest.hh"
+#include "hex.hh"
+
+using namespace maf;
+
+// 2048-bit key & signatures of kMessage, generated with OpenSSL.
+static auto kPublicKey = HexArr(
+    "3082010a0282010100a661a60656edeef177368a4bec84960a6be61f486b48e5df631f84"
+    "8053776f462ff10bf86896e826d98c07d9a9ccb2cdcd3cd254b885068ff67a8d4ce3c8ac"
+    "d7d6574a4200b4265e1de7bc10aefe988b7a96da3d8a10058608f309fcc5f4311af05ea4"
+    "50cd468ef2abb8e637cadee8c75aa9e00388b1389f3403eaf9b72df6ef05370754b76097"
+    "22cecee93758c3d5266169952fad1c9e292c15e7185a89f55f2233c5c05ddd69a79c3c5a"
+    "32968bf45867ba9c2c867351d79656a79eed2c58b5f26d8975bacf0348fe6c106c758308"
+    "6cc9e7e4c16b8b23f54ca250ad1e4002921c560889680ef97ca6acd8e15ee2ec1a63ba11"
+    "9b642dfe45275122c3928e1b2d0203010001");
+
+static constexpr StrView kMessage = "maf RSA test message";
+
+static auto kSignaturePKCS1_SHA256 = HexArr(
+    "925f7ba691d46e89eb136ab753f83ec22286e9f41550f1a8989dea273bd984648251a67a"
+    "ce1d296e7c7188af7734f850a08614e202127031997274b7712bc5544d53c0ea1268a4ba"
+    "532b8e5061f4ad46b4a53f098166033f444ace80fe5bb71d7dbf1a9308aceaaa12267bf9"
+    "74891bdacc2f53ab00b9e43dca1bc5aedc463cfdeb3b0fde2a335c3d96521110ed34dd06"
+    "8721f0e5bbe48cb79da27f0f97613233f0930e034a02f6bc6bc941dc761a25f2b19633e8"
+    "b76987d4a443d3054a8409f4f0affa1f1445092de1d85afa8c611d40d022b81606fd8b57"
+    "c7aa9489c0b2912cd374088abbe05e50530c27457f01314869a3333df995a783a632ca08"
+    "08484fac");
+
+static auto kSignaturePKCS1_SHA512 = HexArr(
+    "44bc247eb07d9c0c7a170ca4c693e53be49f790a238b10190bd0368f2bbd542b26c2a1da"
+    "a30fe5a84a8c3890fac02374c52644456148d8e1c8a53f3fb20da465bacd628083c1ee46"
+    "56ca540605de40abf8251e987562f4ee76531ce423d8d73e202723c6d214db3a57899db7"
+    "f8aa41652086e5a968b38e70ba7db14003ee68b1feedc94f58d17f3680a1e191cc23ed63"
+    "ed074008f30df5e6a9f2efb3070e1fb9684bac927fd6ca07ee9e727895abb19238d6aa1b"
+    "0714417c24e3161867f9b0473e7a171f61a5b185a6bccc0d9d738f052d1298ad32af2483"
+    "0e238dc420b6845ffe8d5c5a545f8f83bdf205c339581b27f6be8dc8ba6e318054537323"
+    "ffdcd190");
+
+static auto kSignaturePSS_SHA256 = HexArr(
+    "05d345bdd01bb657e8906649ca5d65108ffbc3fb0f0a7740bee80cb883c1e310e46884f5"
+    "c29f6e00e6fb39a7df26aa0c6cad7a01c4e0a7c0def84708e256ce622516c7bbf2e730a1"
+    "1631f25f748ee1ce4412f641ff99f1ddb2595ea1b12ff4facb034a82db9b7a2792046fb9"
+    "59e479b36408c2f1b4ec9f45d0852c882741520f03a17e6ec76172d2154f27f61ddf2bd9"
+    "a437493fad46ccb8d58f3cde12b238a51d5abf9b9b4181e71d28c6767bce0a8eec3094e4"
+    "3898751ee61eae39f06e0cd2452a55846363143ad40456213ee34811c0dd74ef68bc80da"
+    "7cbe540b05162579bd2c54999002cac5bb513e4b0fa5ecac213995b685402a70ebcd81ae"
+    "c19f9ba1");
+
+TEST(RSATest, PublicKey) {
+  Status status;
+  auto key = rsa::Public::FromDER(kPublicKey, status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_EQ(key.bits, 2048);
+  EXPECT_EQ(key.SignatureSize(), 256);
+  EXPECT_EQ(key.e, Vec<U32>{65537});
+
+  rsa::Public::FromDER(Span<>(kPublicKey).first(100), status);
+  EXPECT_FALSE(OK(status));
+}
+
+TEST(RSATest, Verify) {
+  Status status;
+  auto key = rsa::Public::FromDER(kPublicKey, status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_TRUE(rsa::VerifyPKCS1_SHA256(key, kMessage, kSignaturePKCS1_SHA256));
+  EXPECT_TRUE(rsa::VerifyPKCS1_SHA512(key, kMessage, kSignaturePKCS1_SHA512));
+  EXPECT_TRUE(rsa::VerifyPSS_SHA256(key, kMessage, kSignaturePSS_SHA256));
+
+  // Wrong scheme.
+  EXPECT_FALSE(rsa::VerifyPKCS1_SHA256(key, kMessage, kSignaturePKCS1_SHA512));
+  EXPECT_FALSE(rsa::VerifyPSS_SHA256(key, kMessage, kSignaturePKCS1_SHA256));
+
+  // Wrong message.
+  StrView other_message = "maf RSA test messagE";
+  EXPECT_FALSE(
+      rsa::VerifyPKCS1_SHA256(key, other_message, kSignaturePKCS1_SHA256));
+  EXPECT_FALSE(rsa::VerifyPSS_SHA256(key, other_message, kSignaturePSS_SHA256));
+
+  // Corrupted signature.
+  auto corrupted = kSignaturePSS_SHA256;
+  corrupted[100] ^= 1;
+  EXPECT_FALSE(rsa::VerifyPSS_SHA256(key, kMessage, corrupted));
+}
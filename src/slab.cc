@@ -0,0 +1,41 @@
+#include "slab.hh"
+
+namespace maf {
+
+// Limits for the buffer pool. Buffers with larger capacity are freed because
+// they would waste memory when reused by connections with little traffic.
+static constexpr Size kMaxPooledBuffers = 256;
+static constexpr Size kMaxPooledCapacity = 256 * 1024;
+
+// Thread-locals are destroyed before objects with static storage duration so
+// streams destroyed at exit may outlive the pool. Once it's gone, buffers are
+// simply freed. (`bool` has a trivial destructor so it remains readable.)
+static thread_local bool buffer_pool_alive = true;
+
+struct BufferPool {
+  Vec<Vec<>> buffers;
+  ~BufferPool() { buffer_pool_alive = false; }
+};
+
+static thread_local BufferPool buffer_pool;
+
+Vec<> TakeBuffer() {
+  if (!buffer_pool_alive || buffer_pool.buffers.empty()) {
+    return {};
+  }
+  Vec<> ret = std::move(buffer_pool.buffers.back());
+  buffer_pool.buffers.pop_back();
+  return ret;
+}
+
+void RecycleBuffer(Vec<> &&buffer) {
+  if (!buffer_pool_alive || buffer.capacity() == 0 ||
+      buffer.capacity() > kMaxPooledCapacity ||
+      buffer_pool.buffers.size() >= kMaxPooledBuffers) {
+    return;
+  }
+  buffer.clear();
+  buffer_pool.buffers.push_back(std::move(buffer));
+}
+
+} // namespace maf
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <new>
+
+#include "int.hh"
+#include "vec.hh"
+
+// Recycling of memory used by objects which are frequently created & destroyed
+// (connections, protocol state machines).
+namespace maf {
+
+// Singly-linked list of free memory blocks. The link is stored in the free
+// block itself.
+struct SlabFreeList {
+  // Maximum number of blocks kept around. Additional blocks are returned to
+  // the system allocator.
+  static constexpr Size kMaxBlocks = 256;
+
+  struct Block {
+    Block *next;
+  };
+
+  Block *head = nullptr;
+  Size count = 0;
+
+  ~SlabFreeList() {
+    while (head) {
+      ::operator delete(Pop());
+    }
+  }
+
+  void *Pop() {
+    Block *block = head;
+    if (block) {
+      head = block->next;
+      --count;
+    }
+    return block;
+  }
+
+  bool Push(void *ptr) {
+    if (count >= kMaxBlocks) {
+      return false;
+    }
+    head = new (ptr) Block{.next = head};
+    ++count;
+    return true;
+  }
+};
+
+// Mixin which makes `new T` & `delete T` reuse memory of previously deleted
+// objects of the same type.
+//
+// Usage:
+//
+//   struct Foo : Base, Recycled<Foo> { ... };
+//
+// Free blocks are kept per-thread. Objects deleted through a base class pointer
+// are recycled as long as the base class has a virtual destructor. Classes
+// derived from `T` fall back to the regular allocator.
+template <typename T> struct Recycled {
+  inline static thread_local SlabFreeList free_list;
+
+  static void *operator new(Size size) {
+    if (size == sizeof(T)) {
+      if (void *block = free_list.Pop()) {
+        return block;
+      }
+    }
+    return ::operator new(size);
+  }
+
+  static void operator delete(void *ptr, Size size) {
+    if (size == sizeof(T) && free_list.Push(ptr)) {
+      return;
+    }
+    ::operator delete(ptr);
+  }
+};
+
+// Returns an empty buffer - possibly with some capacity left from a previous
+// user.
+Vec<> TakeBuffer();
+
+// Allows the capacity of `buffer` to be reused by a future `TakeBuffer`.
+void RecycleBuffer(Vec<> &&buffer);
+
+} // namespace maf
@@ -0,0 +1,53 @@
+#include "slab.hh"
+
+#include "gtest.hh"
+
+using namespace maf;
+
+namespace {
+
+struct Base {
+  virtual ~Base() = default;
+};
+
+struct Object : Base, Recycled<Object> {
+  char payload[100];
+};
+
+// Recycles its buffer when destroyed at exit - after the buffer pool.
+struct RecycledAtExit {
+  Vec<> buffer = Vec<>(1000);
+  ~RecycledAtExit() { RecycleBuffer(std::move(buffer)); }
+};
+
+} // namespace
+
+TEST(SlabTest, ReusesFreedObjects) {
+  Base *a = new Object();
+  void *a_addr = a;
+  delete a;
+  Object *b = new Object();
+  EXPECT_EQ((void *)b, a_addr);
+  Object *c = new Object();
+  EXPECT_NE((void *)c, a_addr);
+  delete b;
+  delete c;
+  EXPECT_EQ(Recycled<Object>::free_list.count, 2);
+}
+
+TEST(SlabTest, ReusesBufferCapacity) {
+  Vec<> buffer;
+  buffer.resize(1000);
+  const char *data = buffer.data();
+  RecycleBuffer(std::move(buffer));
+  Vec<> reused = TakeBuffer();
+  EXPECT_TRUE(reused.empty());
+  EXPECT_GE(reused.capacity(), 1000);
+  EXPECT_EQ(reused.data(), data);
+}
+
+TEST(SlabTest, RecycleAfterPoolDestroyed) {
+  RecycleBuffer(Vec<>(1000)); // make sure the pool is constructed first
+  static RecycledAtExit object;
+  EXPECT_EQ(object.buffer.size(), 1000);
+}
@@ -1,15 +1,21 @@
 #pragma once
 
+#include "slab.hh"
 #include "status.hh"
 #include "vec.hh"
 
 namespace maf {
 
 struct Stream {
-  Vec<> inbox;
-  Vec<> outbox;
-
-  virtual ~Stream() = default;
+  // Buffers are recycled between streams to avoid reallocating them with each
+  // new connection.
+  Vec<> inbox = TakeBuffer();
+  Vec<> outbox = TakeBuffer();
+
+  virtual ~Stream() {
+    RecycleBuffer(std::move(inbox));
+    RecycleBuffer(std::move(outbox));
+  }
 
   // Flush the contents of `outbox`.
   //
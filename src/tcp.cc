@@ -1,14 +1,41 @@
 #include "tcp.hh"
 
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
+#include <linux/tcp.h> // <netinet/tcp.h> lacks the newer tcp_info fields
 #include <netinet/in.h>
-#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include "format.hh"
+
 namespace maf::tcp {
 
+// Connections which are currently registered in epoll. Used for batched
+// TCP_INFO sampling.
+thread_local static Vec<Connection *> open_connections;
+
+static void AddOpenConnection(Connection &c) {
+  if (c.open_index >= 0) {
+    return;
+  }
+  c.open_index = open_connections.size();
+  open_connections.push_back(&c);
+}
+
+static void RemoveOpenConnection(Connection &c) {
+  if (c.open_index < 0) {
+    return;
+  }
+  Connection *last = open_connections.back();
+  open_connections[c.open_index] = last;
+  last->open_index = c.open_index;
+  open_connections.pop_back();
+  c.open_index = -1;
+}
+
 void Server::Listen(Config config) {
   fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
               /*protocol*/ 0);
@@ -89,6 +116,9 @@ const char *Server::Name() const { return "tcp::Server"; }
 void Connection::Adopt(FD fd) {
   this->fd = std::move(fd);
   epoll::Add(this, status);
+  if (status.Ok()) {
+    AddOpenConnection(*this);
+  }
 }
 
 void Connection::Connect(Config config) {
@@ -133,6 +163,7 @@ void Connection::Connect(Config config) {
     status() += "epoll::Add()";
     return;
   }
+  AddOpenConnection(*this);
 }
 
 Connection::~Connection() { Close(); }
@@ -156,6 +187,10 @@ void Connection::Send() {
   if (write_buffer_full) {
     return;
   }
+  Timestamping::Clock::time_point now;
+  if (timestamping.tx) {
+    now = Timestamping::Clock::now();
+  }
   ssize_t count = send(fd, outbox.data(), outbox.size(), MSG_NOSIGNAL);
   if (count == -1) {
     if (errno == EWOULDBLOCK || errno == EAGAIN) {
@@ -169,6 +204,7 @@ void Connection::Send() {
     Close();
     return;
   }
+  timestamping.RecordSend(count, now);
   outbox.erase(outbox.begin(), outbox.begin() + count);
   if (closing && outbox.empty()) {
     Close();
@@ -187,6 +223,7 @@ void Connection::Close() {
   if (IsClosed()) {
     return;
   }
+  RemoveOpenConnection(*this);
   epoll::Del(this, status);
   shutdown(fd, SHUT_RDWR);
   fd.Close();
@@ -195,10 +232,138 @@ void Connection::Close() {
 
 bool Connection::IsClosed() const { return fd == -1; }
 
+void Connection::SampleTransportInfo(Status &status) {
+  tcp_info info = {};
+  socklen_t len = sizeof(info);
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+    status() += "getsockopt(TCP_INFO)";
+    return;
+  }
+  transport_info.sampled_at = std::chrono::steady_clock::now();
+  transport_info.rtt_us = info.tcpi_rtt;
+  transport_info.rtt_var_us = info.tcpi_rttvar;
+  transport_info.cwnd = info.tcpi_snd_cwnd;
+  transport_info.mss = info.tcpi_snd_mss;
+  transport_info.retransmits = info.tcpi_total_retrans;
+  transport_info.bytes_in_flight = (U64)info.tcpi_unacked * info.tcpi_snd_mss;
+  // Older kernels return a shorter struct without the delivery rate.
+  if (len >= offsetof(tcp_info, tcpi_delivery_rate) +
+                 sizeof(info.tcpi_delivery_rate)) {
+    transport_info.delivery_rate = info.tcpi_delivery_rate;
+  }
+}
+
+Str TransportInfo::ToStr() const {
+  return f("rtt=%uus+/-%uus cwnd=%u mss=%u retransmits=%u in_flight=%lu "
+           "delivery_rate=%lu B/s",
+           rtt_us, rtt_var_us, cwnd, mss, retransmits, bytes_in_flight,
+           delivery_rate);
+}
+
+void SampleTransportInfo() {
+  for (Connection *c : open_connections) {
+    Status ignore;
+    c->SampleTransportInfo(ignore);
+  }
+}
+
+// Returns true if `a` is in worse shape than `b`.
+static bool Worse(const TransportInfo &a, const TransportInfo &b,
+                  TransportMetric by) {
+  switch (by) {
+  case TransportMetric::kRtt:
+    return a.rtt_us > b.rtt_us;
+  case TransportMetric::kRetransmits:
+    return a.retransmits > b.retransmits;
+  case TransportMetric::kDeliveryRate:
+    return a.delivery_rate < b.delivery_rate;
+  case TransportMetric::kBytesInFlight:
+    return a.bytes_in_flight > b.bytes_in_flight;
+  }
+  return false;
+}
+
+Vec<Connection *> WorstConnections(Size n, TransportMetric by) {
+  Vec<Connection *> ret(open_connections);
+  n = std::min(n, ret.size());
+  std::partial_sort(ret.begin(), ret.begin() + n, ret.end(),
+                    [by](Connection *a, Connection *b) {
+                      return Worse(a->transport_info, b->transport_info, by);
+                    });
+  ret.resize(n);
+  return ret;
+}
+
+void TransportInfoSampler::Start(std::chrono::steady_clock::duration interval,
+                                 Status &status) {
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    status() += "timerfd_create()";
+    return;
+  }
+  auto ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+  timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+  itimerspec spec = {.it_interval = ts, .it_value = ts};
+  if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+    status() += "timerfd_settime()";
+    fd.Close();
+    return;
+  }
+  epoll::Add(this, status);
+  if (!status.Ok()) {
+    fd.Close();
+  }
+}
+
+void TransportInfoSampler::Stop() {
+  if (fd < 0) {
+    return;
+  }
+  Status ignore;
+  epoll::Del(this, ignore);
+  fd.Close();
+}
+
+void TransportInfoSampler::NotifyRead(Status &) {
+  U64 expirations;
+  if (read(fd, &expirations, sizeof(expirations)) < 0) {
+    errno = 0; // spurious wakeup
+    return;
+  }
+  SampleTransportInfo();
+}
+
+const char *TransportInfoSampler::Name() const {
+  return "tcp::TransportInfoSampler";
+}
+
 thread_local static U8 read_buffer[1024 * 1024];
 
+void Connection::EnableTimestamping(bool rx, bool tx, Status &status) {
+  timestamping.Enable(fd, rx, tx, status);
+}
+
+// Read with the RX timestamp.
+static ssize_t ReadTimestamped(Connection &c) {
+  iovec iov = {.iov_base = read_buffer, .iov_len = sizeof(read_buffer)};
+  alignas(cmsghdr) char control[Timestamping::kControlSize];
+  msghdr msg = {.msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control,
+                .msg_controllen = sizeof(control)};
+  ssize_t count = recvmsg(c.fd, &msg, 0);
+  if (count > 0) {
+    c.received_at = Timestamping::ReceivedAt(msg);
+    c.timestamping.RecordReceived(c.received_at, Timestamping::Clock::now());
+  }
+  return count;
+}
+
 void Connection::NotifyRead(Status &epoll_status) {
-  ssize_t count = read(fd, read_buffer, sizeof(read_buffer));
+  ssize_t count = timestamping.rx
+                      ? ReadTimestamped(*this)
+                      : read(fd, read_buffer, sizeof(read_buffer));
   if (count == 0) { // EOF
     Close();
     return;
@@ -224,6 +389,12 @@ void Connection::NotifyWrite(Status &epoll_status) {
   Send();
 }
 
+void Connection::NotifyError(Status &) {
+  if (timestamping.tx) {
+    timestamping.ReadErrorQueue(fd);
+  }
+}
+
 const char *Connection::Name() const { return "tcp::Connection"; }
 
 } // namespace maf::tcp
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <chrono>
+
 #include "epoll.hh"
 #include "str.hh"
 #include "stream.hh"
+#include "timestamping.hh"
+#include "vec.hh"
 
 namespace maf::tcp {
 
@@ -30,6 +34,34 @@ struct Server : epoll::Listener {
   const char *Name() const override;
 };
 
+// Transport metrics of a single connection, as reported by the kernel through
+// `getsockopt(TCP_INFO)`.
+struct TransportInfo {
+  // When this sample was taken. Default-constructed if the connection was
+  // never sampled.
+  std::chrono::steady_clock::time_point sampled_at = {};
+
+  // Smoothed round-trip time & its mean deviation (microseconds).
+  U32 rtt_us = 0;
+  U32 rtt_var_us = 0;
+
+  // Congestion window (segments) & maximum segment size (bytes).
+  U32 cwnd = 0;
+  U32 mss = 0;
+
+  // Total number of retransmitted segments over the lifetime of the
+  // connection.
+  U32 retransmits = 0;
+
+  // Bytes sent but not yet acknowledged by the peer.
+  U64 bytes_in_flight = 0;
+
+  // Most recent delivery rate estimate (bytes per second).
+  U64 delivery_rate = 0;
+
+  Str ToStr() const;
+};
+
 // Responsible for interacting with the epoll loop.
 //
 // This is not a "listener" in the TCP sense.
@@ -53,6 +85,16 @@ struct Connection : epoll::Listener, Stream {
   // all of the data from `send_tcp` is written.
   bool closing = false;
 
+  // Most recent result of `SampleTransportInfo`.
+  TransportInfo transport_info;
+
+  // Kernel timestamps & the latency histograms derived from them.
+  Timestamping timestamping;
+
+  // Kernel RX timestamp of the data most recently appended to `inbox`. Only
+  // set when RX timestamping is enabled.
+  Timestamping::Clock::time_point received_at;
+
   struct Config : Server::Config {
     IP remote_ip = IP(127, 0, 0, 1);
     U16 remote_port;
@@ -69,16 +111,64 @@ struct Connection : epoll::Listener, Stream {
 
   bool IsClosed() const;
 
+  // Refresh `transport_info` of this connection.
+  void SampleTransportInfo(Status &);
+
+  // Should be called right after `Adopt` or `Connect`, before any data is
+  // sent.
+  void EnableTimestamping(bool rx, bool tx, Status &);
+
   /////////////////////////////////////
   // epoll interface - not for users //
   /////////////////////////////////////
 
   void NotifyRead(Status &) override;
   void NotifyWrite(Status &) override;
+  void NotifyError(Status &) override;
 
   const char *Name() const override;
 
   operator Status &() override { return status; }
+
+  // Position in the per-thread list of open connections (or -1).
+  int open_index = -1;
+};
+
+// Refresh `transport_info` of all open connections on this thread.
+//
+// Connections that fail to report their TCP_INFO are skipped.
+void SampleTransportInfo();
+
+enum class TransportMetric {
+  kRtt,           // highest `rtt_us` first
+  kRetransmits,   // highest `retransmits` first
+  kDeliveryRate,  // lowest `delivery_rate` first
+  kBytesInFlight, // highest `bytes_in_flight` first
+};
+
+// Returns up to `n` open connections of this thread, ordered from the worst.
+//
+// Uses the most recent `transport_info` of each connection - call
+// `SampleTransportInfo` (or run a `TransportInfoSampler`) to refresh it.
+Vec<Connection *> WorstConnections(Size n,
+                                   TransportMetric by = TransportMetric::kRtt);
+
+// Periodically calls `SampleTransportInfo` from the epoll loop.
+//
+// Note that while it's running, `epoll::Loop` won't exit on its own.
+struct TransportInfoSampler : epoll::Listener {
+  ~TransportInfoSampler() { Stop(); }
+
+  void Start(std::chrono::steady_clock::duration interval, Status &);
+  void Stop();
+
+  /////////////////////////////////////
+  // epoll interface - not for users //
+  /////////////////////////////////////
+
+  void NotifyRead(Status &) override;
+
+  const char *Name() const override;
 };
 
 } // namespace maf::tcp
\ No newline at end of file
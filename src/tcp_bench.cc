@@ -0,0 +1,228 @@
+#pragma maf main
+
+// Loopback benchmark of `tcp::Server` & `tcp::Connection`.
+//
+// Usage: tcp_bench [max_connections]
+//
+// Measures ping-pong latency, streaming throughput (at several message sizes)
+// & accept rate. Client & server run on the same epoll loop. Results are
+// printed as JSON Lines (see bench.hh).
+
+#include <cstdlib>
+
+#include "bench.hh"
+#include "epoll.hh"
+#include "fn.hh"
+#include "log.hh"
+#include "tcp.hh"
+#include "unique_ptr.hh"
+
+using namespace maf;
+using bench::Clock;
+
+static constexpr U16 kPort = 12345;
+
+namespace {
+
+struct Server : tcp::Server {
+  enum class Mode { kEcho, kSink } mode;
+
+  struct ServerConnection : tcp::Connection {
+    Server &server;
+    ServerConnection(Server &server, FD fd) : server(server) {
+      Adopt(std::move(fd));
+    }
+    void NotifyReceived() override {
+      if (server.mode == Mode::kEcho) {
+        outbox.insert(outbox.end(), inbox.begin(), inbox.end());
+        Send();
+      } else {
+        server.received_bytes += inbox.size();
+        server.last_received = Clock::now();
+      }
+      inbox.clear();
+    }
+    void NotifyClosed() override {
+      if (--server.open_connections == 0 &&
+          server.accepted == server.expected) {
+        server.StopListening();
+      }
+    }
+  };
+
+  Vec<UniquePtr<ServerConnection>> connections;
+  Size expected;
+  Size accepted = 0;
+  Size open_connections = 0;
+  Size received_bytes = 0;
+  Clock::time_point last_accepted;
+  Clock::time_point last_received;
+  Fn<void()> all_accepted = []() {};
+
+  Server(Mode mode, Size expected) : mode(mode), expected(expected) {
+    Listen({.local_ip = IP(127, 0, 0, 1), .local_port = kPort});
+    if (!OK(status)) {
+      FATAL << "Couldn't start server: " << status;
+    }
+  }
+
+  void NotifyAcceptedTCP(FD fd, IP ip, U16 port) override {
+    ++accepted;
+    ++open_connections;
+    last_accepted = Clock::now();
+    connections.emplace_back(new ServerConnection(*this, std::move(fd)));
+    if (accepted == expected) {
+      all_accepted();
+    }
+  }
+};
+
+void RunLoop() {
+  Status status;
+  epoll::Loop(status);
+  if (!OK(status)) {
+    FATAL << status;
+  }
+}
+
+struct PingPongClient : tcp::Connection {
+  Size message_size;
+  Size remaining;
+  Clock::time_point sent_at;
+  bench::Samples &rtt_us;
+
+  PingPongClient(Size message_size, Size round_trips, bench::Samples &rtt_us)
+      : message_size(message_size), remaining(round_trips), rtt_us(rtt_us) {
+    Connect({.remote_port = kPort});
+    Ping();
+  }
+
+  void Ping() {
+    outbox.insert(outbox.end(), message_size, 'p');
+    sent_at = Clock::now();
+    Send();
+  }
+
+  void NotifyReceived() override {
+    if (inbox.size() < message_size) {
+      return;
+    }
+    rtt_us.Add(bench::Microseconds(Clock::now() - sent_at));
+    inbox.erase(inbox.begin(), inbox.begin() + message_size);
+    if (--remaining > 0) {
+      Ping();
+    } else {
+      Close();
+    }
+  }
+};
+
+void BenchPingPong(Size connections, Size message_size, Size round_trips) {
+  Server server(Server::Mode::kEcho, connections);
+  bench::Samples rtt_us;
+  Vec<UniquePtr<PingPongClient>> clients;
+  auto start = Clock::now();
+  for (Size i = 0; i < connections; ++i) {
+    clients.emplace_back(
+        new PingPongClient(message_size, round_trips / connections, rtt_us));
+  }
+  RunLoop();
+  double seconds = bench::Seconds(Clock::now() - start);
+  bench::Report("tcp_ping_pong")
+      .Set("connections", connections)
+      .Set("message_size", message_size)
+      .Set("round_trips", rtt_us.values.size())
+      .Set("round_trips_per_sec", rtt_us.values.size() / seconds)
+      .SetPercentiles("rtt_us", rtt_us);
+}
+
+struct StreamingClient : tcp::Connection {
+  Size message_size;
+  Size remaining_bytes;
+
+  StreamingClient(Size message_size, Size bytes)
+      : message_size(message_size), remaining_bytes(bytes) {
+    Connect({.remote_port = kPort});
+    Pump();
+  }
+
+  // Keep the kernel buffer full, one `send` per message.
+  void Pump() {
+    while (!IsClosed() && !write_buffer_full && remaining_bytes > 0) {
+      Size n = std::min(message_size, remaining_bytes);
+      outbox.insert(outbox.end(), n, 's');
+      remaining_bytes -= n;
+      if (remaining_bytes == 0) {
+        closing = true;
+      }
+      Send();
+    }
+  }
+
+  void NotifyReceived() override {}
+
+  void NotifyWrite(Status &epoll_status) override {
+    tcp::Connection::NotifyWrite(epoll_status);
+    Pump();
+  }
+};
+
+void BenchStreaming(Size connections, Size message_size, Size total_bytes) {
+  Server server(Server::Mode::kSink, connections);
+  Vec<UniquePtr<StreamingClient>> clients;
+  auto start = Clock::now();
+  for (Size i = 0; i < connections; ++i) {
+    clients.emplace_back(
+        new StreamingClient(message_size, total_bytes / connections));
+  }
+  RunLoop();
+  double seconds = bench::Seconds(server.last_received - start);
+  bench::Report("tcp_streaming")
+      .Set("connections", connections)
+      .Set("message_size", message_size)
+      .Set("bytes", server.received_bytes)
+      .Set("bytes_per_sec", server.received_bytes / seconds)
+      .Set("messages_per_sec", server.received_bytes / message_size / seconds);
+}
+
+struct IdleClient : tcp::Connection {
+  IdleClient() { Connect({.remote_port = kPort}); }
+  void NotifyReceived() override {}
+};
+
+void BenchAccept(Size connections) {
+  Server server(Server::Mode::kSink, connections);
+  Vec<UniquePtr<IdleClient>> clients;
+  auto start = Clock::now();
+  for (Size i = 0; i < connections; ++i) {
+    clients.emplace_back(new IdleClient());
+  }
+  server.all_accepted = [&]() {
+    for (auto &client : clients) {
+      client->Close();
+    }
+  };
+  RunLoop();
+  double seconds = bench::Seconds(server.last_accepted - start);
+  bench::Report("tcp_accept")
+      .Set("connections", connections)
+      .Set("accepts_per_sec", connections / seconds);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Size max_connections = argc > 1 ? atoi(argv[1]) : 64;
+  epoll::Init();
+  for (Size n = 1; n <= max_connections; n *= 4) {
+    BenchPingPong(n, 64, std::max<Size>(20000, n * 100));
+  }
+  for (Size message_size : {64, 1024, 16 * 1024, 256 * 1024}) {
+    Size total_bytes = std::min<Size>(256 << 20, message_size * 500'000);
+    for (Size n = 1; n <= max_connections; n *= 4) {
+      BenchStreaming(n, message_size, total_bytes);
+    }
+  }
+  BenchAccept(std::min<Size>(1000, max_connections * 16));
+  return 0;
+}
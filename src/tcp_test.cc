@@ -159,4 +159,154 @@ TEST(TCPTest, ManyClients) {
   EXPECT_TRUE(status.Ok()) << status.ToStr();
 
   EXPECT_EQ(ping_pongs, 500);
-}
\ No newline at end of file
+}
+
+TEST(TCPTest, TransportInfo) {
+  static constexpr int kClients = 3;
+  static int received = 0;
+  static std::function<void()> all_received;
+
+  struct ClientConnection : tcp::Connection {
+    ClientConnection() {
+      Connect({.remote_port = 1234});
+      outbox.insert(outbox.end(), {1, 2, 3});
+      Send();
+    }
+    void NotifyReceived() override {}
+  };
+
+  struct ServerConnection : tcp::Connection {
+    ServerConnection(FD fd) { Adopt(std::move(fd)); }
+    void NotifyReceived() override {
+      if (inbox.size() == 3 && ++received == kClients) {
+        all_received();
+      }
+    }
+  };
+
+  struct Server : tcp::Server {
+    std::set<ServerConnection> connections;
+    void NotifyAcceptedTCP(FD fd, IP ip, U16 port) override {
+      connections.emplace(std::move(fd));
+    }
+  };
+
+  epoll::Init();
+  Server server;
+  server.Listen({
+      .local_ip = IP(127, 0, 0, 1),
+      .local_port = 1234,
+  });
+  std::set<ClientConnection> clients;
+  for (int i = 0; i < kClients; ++i) {
+    clients.emplace();
+  }
+
+  Vec<tcp::Connection *> worst;
+  all_received = [&]() {
+    tcp::SampleTransportInfo();
+    worst = tcp::WorstConnections(4);
+    server.StopListening();
+    for (auto &c : server.connections) {
+      const_cast<ServerConnection &>(c).Close();
+    }
+    for (auto &c : clients) {
+      const_cast<ClientConnection &>(c).Close();
+    }
+  };
+
+  Status status;
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+
+  ASSERT_EQ(worst.size(), 4);
+  for (int i = 0; i < worst.size(); ++i) {
+    auto &info = worst[i]->transport_info;
+    EXPECT_NE(info.sampled_at, std::chrono::steady_clock::time_point{});
+    EXPECT_GT(info.mss, 0);
+    EXPECT_GT(info.cwnd, 0);
+    if (i > 0) {
+      EXPECT_GE(worst[i - 1]->transport_info.rtt_us, info.rtt_us);
+    }
+  }
+  EXPECT_TRUE(tcp::WorstConnections(4).empty());
+}
+
+TEST(TCPTest, Timestamping) {
+  struct ClientConnection : tcp::Connection {
+    int pings = 3;
+    int timestamped = 0;
+    ClientConnection() {
+      Connect({.remote_port = 1234});
+      EnableTimestamping(true, true, status);
+      Ping();
+    }
+    void Ping() {
+      outbox.insert(outbox.end(), {'p', 'i', 'n', 'g'});
+      Send();
+    }
+    void NotifyReceived() override {
+      if (inbox.size() < 4) {
+        return;
+      }
+      inbox.clear();
+      if (received_at != Timestamping::Clock::time_point()) {
+        ++timestamped;
+        EXPECT_LE(received_at, Timestamping::Clock::now());
+      }
+      if (--pings > 0) {
+        Ping();
+      } else {
+        Close();
+      }
+    }
+  };
+
+  struct ServerConnection : tcp::Connection {
+    void NotifyReceived() override {
+      outbox.insert(outbox.end(), inbox.begin(), inbox.end());
+      inbox.clear();
+      Send();
+    }
+    void NotifyClosed() override { Close(); }
+  };
+
+  struct Server : tcp::Server {
+    ServerConnection connection;
+    void NotifyAcceptedTCP(FD fd, IP ip, U16 port) override {
+      connection.Adopt(std::move(fd));
+      StopListening();
+    }
+  };
+
+  epoll::Init();
+  Server server;
+  server.Listen({.local_ip = IP(127, 0, 0, 1), .local_port = 1234});
+  ClientConnection client;
+  Status status;
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_TRUE(client.status.Ok()) << client.status.ToStr();
+  // Kernel may take a moment to start RX timestamping.
+  EXPECT_GE(client.timestamped, 2);
+  EXPECT_EQ(client.timestamping.rx_latency_ns.count, client.timestamped);
+  // Timestamps of the sends are read from the error queue before each echo
+  // is handled.
+  EXPECT_EQ(client.timestamping.tx_latency_ns.count, 3)
+      << client.timestamping.tx_latency_ns.ToStr();
+  EXPECT_EQ(server.connection.timestamping.rx_latency_ns.count, 0);
+}
+
+TEST(TCPTest, TransportInfoSamplerDestroyedWhileRunning) {
+  epoll::Init();
+  Status status;
+  {
+    tcp::TransportInfoSampler sampler;
+    sampler.Start(std::chrono::milliseconds(1), status);
+    ASSERT_TRUE(status.Ok()) << status.ToStr();
+  }
+  // The destroyed sampler must not stay registered - the loop has nothing to
+  // wait for.
+  epoll::Loop(status);
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+}
@@ -0,0 +1,136 @@
+#include "thread_pool.hh"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+
+#include "epoll.hh"
+#include "int.hh"
+#include "log.hh"
+#include "vec.hh"
+
+namespace maf::thread_pool {
+
+// Finished jobs of a single thread. Wakes up its epoll loop through an eventfd.
+struct Completions : epoll::Listener {
+  std::mutex mutex;
+  Vec<Job *> finished; // guarded by `mutex`
+
+  // Touched only by the owning thread.
+  int pending = 0;
+  bool registered = false;
+
+  Completions() : epoll::Listener(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+  ~Completions() {
+    for (Job *job : finished) {
+      delete job;
+    }
+  }
+
+  // Called by the workers.
+  void Push(Job *job) {
+    {
+      std::lock_guard lock(mutex);
+      finished.push_back(job);
+    }
+    U64 one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+      ERROR << "Couldn't wake up the epoll loop: " << strerror(errno);
+    }
+  }
+
+  void NotifyRead(Status &epoll_status) override {
+    U64 count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+      errno = 0; // spurious wakeup
+    }
+    Vec<Job *> jobs;
+    {
+      std::lock_guard lock(mutex);
+      jobs.swap(finished);
+    }
+    for (Job *job : jobs) {
+      --pending;
+      job->Done();
+      delete job;
+    }
+    if (pending == 0 && registered) {
+      // Let the loop exit when nothing else is going on.
+      registered = false;
+      epoll::Del(this, epoll_status);
+    }
+  }
+
+  const char *Name() const override { return "thread_pool::Completions"; }
+};
+
+thread_local static Completions completions;
+
+static std::mutex mutex;
+static std::condition_variable queue_changed;
+static std::deque<std::pair<Job *, Completions *>> queue; // guarded by `mutex`
+static bool stopping = false;                             // guarded by `mutex`
+static Vec<std::thread> workers;
+
+static void Work() {
+  std::unique_lock lock(mutex);
+  while (true) {
+    queue_changed.wait(lock, [] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return; // stopping
+    }
+    auto [job, destination] = queue.front();
+    queue.pop_front();
+    lock.unlock();
+    job->Run();
+    destination->Push(job);
+    lock.lock();
+  }
+}
+
+void Start(int n) {
+  for (int i = 0; i < n; ++i) {
+    workers.emplace_back(Work);
+  }
+}
+
+void Stop() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  queue_changed.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  stopping = false;
+}
+
+bool Started() { return !workers.empty(); }
+
+void Submit(Job *job) {
+  if (!completions.registered) {
+    Status status;
+    epoll::Add(&completions, status);
+    if (!OK(status)) {
+      FATAL << "Couldn't listen for thread pool completions: " << status;
+    }
+    completions.registered = true;
+  }
+  ++completions.pending;
+  {
+    std::lock_guard lock(mutex);
+    queue.emplace_back(job, &completions);
+  }
+  queue_changed.notify_one();
+}
+
+int Pending() { return completions.pending; }
+
+} // namespace maf::thread_pool
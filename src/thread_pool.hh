@@ -0,0 +1,42 @@
+#pragma once
+
+// Worker threads for CPU-heavy work (for example handshake crypto) that would
+// otherwise stall the epoll loop.
+//
+// Jobs run on the workers & their completions are delivered back to the epoll
+// loop of the thread that submitted them (through an eventfd), so that the
+// submitter can continue without any locking.
+namespace maf::thread_pool {
+
+struct Job {
+  virtual ~Job() = default;
+
+  // Called on one of the worker threads. Must not touch the state owned by the
+  // epoll loop.
+  virtual void Run() = 0;
+
+  // Called from the `epoll::Loop` of the thread that submitted the job, after
+  // `Run` returned. The job is deleted afterwards.
+  virtual void Done() = 0;
+};
+
+// Start `n` worker threads.
+void Start(int n);
+
+// Wait for the queued jobs to run & join the worker threads. Their completions
+// are delivered by the next `epoll::Loop` of the submitting threads.
+void Stop();
+
+// Whether the worker threads are running.
+bool Started();
+
+// Queue the `job` for one of the workers. Takes ownership of it. Requires
+// `Start` & `epoll::Init` (on the calling thread).
+//
+// The epoll loop of the calling thread is kept alive until `Done` is called.
+void Submit(Job *job);
+
+// Number of jobs submitted by this thread that weren't `Done` yet.
+int Pending();
+
+} // namespace maf::thread_pool
@@ -0,0 +1,53 @@
+#include "thread_pool.hh"
+
+#include <algorithm>
+#include <thread>
+
+#include "epoll.hh"
+#include "gtest.hh"
+#include "vec.hh"
+
+using namespace maf;
+
+struct SquareJob : thread_pool::Job {
+  int x;
+  int result = 0;
+  std::thread::id run_on;
+  Vec<int> &results;
+
+  SquareJob(int x, Vec<int> &results) : x(x), results(results) {}
+
+  void Run() override {
+    run_on = std::this_thread::get_id();
+    result = x * x;
+  }
+
+  void Done() override {
+    EXPECT_NE(run_on, std::this_thread::get_id());
+    results.push_back(result);
+  }
+};
+
+TEST(ThreadPoolTest, CompletionsRunOnLoop) {
+  epoll::Init();
+  thread_pool::Start(4);
+  Vec<int> results;
+  for (int i = 0; i < 100; ++i) {
+    thread_pool::Submit(new SquareJob(i, results));
+  }
+  EXPECT_EQ(thread_pool::Pending(), 100);
+
+  // Loop exits once all of the completions are delivered.
+  Status status;
+  epoll::Loop(status);
+  EXPECT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_EQ(thread_pool::Pending(), 0);
+  thread_pool::Stop();
+  EXPECT_FALSE(thread_pool::Started());
+
+  ASSERT_EQ(results.size(), 100);
+  std::sort(results.begin(), results.end());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(results[i], i * i);
+  }
+}
@@ -0,0 +1,130 @@
+#include "timestamping.hh"
+
+#include <cstring>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+
+namespace maf {
+
+// Sends older than this many entries are assumed to never get a timestamp.
+static constexpr Size kMaxPendingSends = 4096;
+
+void Timestamping::Enable(FD &fd, bool rx, bool tx, Status &status) {
+  int flags = SOF_TIMESTAMPING_SOFTWARE;
+  if (rx) {
+    flags |= SOF_TIMESTAMPING_RX_SOFTWARE;
+  }
+  if (tx) {
+    flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+             SOF_TIMESTAMPING_OPT_TSONLY;
+  }
+  if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+    AppendErrorMessage(status) += "setsockopt(SO_TIMESTAMPING)";
+    return;
+  }
+  this->rx = rx;
+  this->tx = tx;
+  // OPT_ID counter starts from zero when the option is set.
+  pending.clear();
+  pending_pos = 0;
+  next_key = 0;
+}
+
+static Timestamping::Clock::time_point ToTimePoint(const timespec &ts) {
+  return Timestamping::Clock::time_point(std::chrono::duration_cast<
+                                         Timestamping::Clock::duration>(
+      std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+}
+
+// Software timestamp from a SCM_TIMESTAMPING control message.
+static const timespec *SoftwareTimestamp(cmsghdr *cmsg) {
+  if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) {
+    return nullptr;
+  }
+  // Software timestamp is the first of the three.
+  const timespec *ts = (const timespec *)CMSG_DATA(cmsg);
+  if (ts->tv_sec == 0 && ts->tv_nsec == 0) {
+    return nullptr;
+  }
+  return ts;
+}
+
+Timestamping::Clock::time_point Timestamping::ReceivedAt(msghdr &msg) {
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (const timespec *ts = SoftwareTimestamp(cmsg)) {
+      return ToTimePoint(*ts);
+    }
+  }
+  return {};
+}
+
+static U64 Nanoseconds(Timestamping::Clock::duration d) {
+  return std::max<I64>(
+      0, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+void Timestamping::RecordReceived(Clock::time_point received_at,
+                                  Clock::time_point now) {
+  if (received_at != Clock::time_point()) {
+    rx_latency_ns.Add(Nanoseconds(now - received_at));
+  }
+}
+
+void Timestamping::RecordSend(Size size, Clock::time_point now) {
+  if (!tx || size == 0) {
+    return;
+  }
+  next_key += size;
+  if (pending.size() - pending_pos >= kMaxPendingSends) {
+    ++pending_pos;
+  }
+  if (pending_pos > pending.size() / 2) {
+    pending.erase(pending.begin(), pending.begin() + pending_pos);
+    pending_pos = 0;
+  }
+  pending.push_back({.key = next_key - 1, .sent_at = now});
+}
+
+void Timestamping::RecordSent(U32 key, Clock::time_point sent_by_kernel) {
+  // Sends without a timestamp (for example dropped datagrams) are skipped.
+  while (pending_pos < pending.size() &&
+         (I32)(pending[pending_pos].key - key) < 0) {
+    ++pending_pos;
+  }
+  if (pending_pos < pending.size() && pending[pending_pos].key == key) {
+    tx_latency_ns.Add(Nanoseconds(sent_by_kernel - pending[pending_pos].sent_at));
+    ++pending_pos;
+  }
+}
+
+void Timestamping::ReadErrorQueue(FD &fd) {
+  alignas(cmsghdr) char control[256];
+  while (true) {
+    msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      errno = 0;
+      return;
+    }
+    const timespec *ts = nullptr;
+    const sock_extended_err *err = nullptr;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (const timespec *t = SoftwareTimestamp(cmsg)) {
+        ts = t;
+      } else if ((cmsg->cmsg_level == SOL_IP &&
+                  cmsg->cmsg_type == IP_RECVERR) ||
+                 (cmsg->cmsg_level == SOL_IPV6 &&
+                  cmsg->cmsg_type == IPV6_RECVERR)) {
+        err = (const sock_extended_err *)CMSG_DATA(cmsg);
+      }
+    }
+    if (ts && err && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+        err->ee_info == SCM_TSTAMP_SND) {
+      RecordSent(err->ee_data, ToTimePoint(*ts));
+    }
+  }
+}
+
+} // namespace maf
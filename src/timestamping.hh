@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <sys/socket.h>
+
+#include "fd.hh"
+#include "histogram.hh"
+#include "status.hh"
+#include "vec.hh"
+
+// Kernel packet timestamps (`SO_TIMESTAMPING`, software only).
+//
+// RX timestamps tell when the kernel received a packet, so the time until our
+// handler runs is the queueing delay of the socket & the epoll loop. TX
+// timestamps tell when the kernel handed a packet to the network device, so
+// the time since our `send` call is the queueing delay in the kernel.
+//
+// The kernel turns on RX timestamping asynchronously, so the first packets
+// after `Enable` may arrive without a timestamp.
+namespace maf {
+
+struct Timestamping {
+  // Software timestamps use CLOCK_REALTIME.
+  using Clock = std::chrono::system_clock;
+
+  bool rx = false;
+  bool tx = false;
+
+  // Nanoseconds from the kernel RX timestamp to the handler call.
+  Histogram rx_latency_ns;
+
+  // Nanoseconds from the `send` call to the kernel TX timestamp.
+  Histogram tx_latency_ns;
+
+  // Size of the control buffer needed by `ReceivedAt`.
+  static constexpr Size kControlSize = CMSG_SPACE(sizeof(timespec) * 3);
+
+  void Enable(FD &, bool rx, bool tx, Status &);
+
+  // Kernel RX time from the control messages of a received message. Returns
+  // a default-constructed time_point if it's missing.
+  static Clock::time_point ReceivedAt(msghdr &);
+
+  void RecordReceived(Clock::time_point received_at, Clock::time_point now);
+
+  // Remember the time of a successful send. `size` is the number of bytes for
+  // stream sockets. Datagram sockets should call this once per message, with
+  // `size` 1.
+  void RecordSend(Size size, Clock::time_point now);
+
+  // Read the TX timestamps from the error queue of the socket (when it
+  // reports EPOLLERR).
+  void ReadErrorQueue(FD &);
+
+private:
+  // Sends waiting for their TX timestamps, ordered by key (the
+  // SOF_TIMESTAMPING_OPT_ID counter of their last byte or message).
+  struct PendingSend {
+    U32 key;
+    Clock::time_point sent_at;
+  };
+  Vec<PendingSend> pending;
+  Size pending_pos = 0;
+  U32 next_key = 0;
+
+  void RecordSent(U32 key, Clock::time_point sent_by_kernel);
+};
+
+} // namespace maf
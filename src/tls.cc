@@ -1,20 +1,34 @@
 #include "tls.hh"
 
+#include <algorithm>
 #include <cstring>
 #include <initializer_list>
-
+#include <unordered_map>
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "aead_aes128_gcm.hh"
 #include "aead_chacha20_poly1305.hh"
 #include "big_endian.hh"
 #include "curve25519.hh"
+#include "curve25519_pool.hh"
 #include "format.hh"
+#include "fs.hh"
 #include "hex.hh"
 #include "hkdf.hh"
+#include "hmac.hh"
 #include "int.hh"
 #include "log.hh"
+#include "pem.hh"
 #include "poly1305.hh"
 #include "sha.hh"
+#include "slab.hh"
 #include "span.hh"
 #include "status.hh"
+#include "thread_pool.hh"
 
 namespace maf::tls {
 
@@ -47,14 +61,39 @@ struct RecordHeader {
 static_assert(sizeof(RecordHeader) == 5,
               "tls::RecordHeader should have 5 bytes");
 
+// Largest plaintext of a TLS record.
+static constexpr Size kMaxPlaintext = 1 << 14;
+
+// Plaintext of records that fit in a single TCP segment (1448 bytes of MSS
+// minus 22 bytes of record overhead). Used at the start of a connection (and
+// after idle), while the congestion window is small, so that the receiver can
+// decrypt the first bytes without waiting for a whole 16 KiB record.
+static constexpr Size kSmallPlaintext = 1400;
+
+// Bytes added to each record: header, content type & AEAD tag.
+static constexpr Size kRecordOverhead = 5 + 1 + 16;
+
+// Bytes sent in small records before switching to full-size ones.
+static constexpr Size kSmallRecordBytes = 32 * 1024;
+
+// Idle time after which records start small again (TCP also restarts slow
+// start after idle).
+static constexpr auto kRecordSizeIdleReset = std::chrono::seconds(1);
+
 void HKDF_Expand_Label(Span<> key, StrView label, Span<> ctx, Span<> out) {
-  Vec<> hkdf_label;
-  hkdf_label.Append(Big<U16>(out.size()));
-  hkdf_label.push_back(label.size());
-  hkdf_label.insert(hkdf_label.end(), label.begin(), label.end());
-  hkdf_label.push_back(ctx.size());
-  hkdf_label.insert(hkdf_label.end(), ctx.begin(), ctx.end());
-  HKDF_Expand<SHA256>(key, hkdf_label, out);
+  // Length, label & context - at most 2 + 1 + 255 + 1 + 255 bytes.
+  char hkdf_label[514];
+  Size n = 0;
+  Big<U16> length = out.size();
+  memcpy(hkdf_label, &length, 2);
+  n += 2;
+  hkdf_label[n++] = label.size();
+  memcpy(hkdf_label + n, label.data(), label.size());
+  n += label.size();
+  hkdf_label[n++] = ctx.size();
+  memcpy(hkdf_label + n, ctx.data(), ctx.size());
+  n += ctx.size();
+  HKDF_Expand<SHA256>(key, Span<>(hkdf_label, n), out);
 }
 
 Arr<char, 32> zero_key = {};
@@ -62,59 +101,149 @@ SHA256 early_secret = HKDF_Extract<SHA256>(Span<>("\x00", 1), zero_key);
 SHA256 empty_hash(kEmptySpan);
 Arr<char, 6> kClientChangeCipherSpec = HexArr("140303000101");
 
+// Limits of the session ticket cache.
+static constexpr Size kMaxTicketsPerServer = 4;
+static constexpr Size kMaxTicketServers = 1024;
+
+thread_local static std::unordered_map<Str, Vec<SessionTicket>> ticket_cache;
+
+void StoreSessionTicket(StrView server_name, SessionTicket ticket) {
+  auto it = ticket_cache.find(Str(server_name));
+  if (it == ticket_cache.end()) {
+    if (ticket_cache.size() >= kMaxTicketServers) {
+      ticket_cache.erase(ticket_cache.begin());
+    }
+    it = ticket_cache.emplace(Str(server_name), Vec<SessionTicket>()).first;
+  }
+  Vec<SessionTicket> &tickets = it->second;
+  if (tickets.size() >= kMaxTicketsPerServer) {
+    tickets.erase(tickets.begin()); // drop the oldest
+  }
+  tickets.push_back(std::move(ticket));
+}
+
+Optional<SessionTicket> TakeSessionTicket(StrView server_name) {
+  auto it = ticket_cache.find(Str(server_name));
+  if (it == ticket_cache.end()) {
+    return std::nullopt;
+  }
+  Vec<SessionTicket> &tickets = it->second;
+  auto now = std::chrono::steady_clock::now();
+  // Newest tickets are at the end.
+  while (!tickets.empty()) {
+    SessionTicket ticket = std::move(tickets.back());
+    tickets.pop_back();
+    if (now - ticket.received_at < ticket.lifetime) {
+      return ticket;
+    }
+  }
+  ticket_cache.erase(it);
+  return std::nullopt;
+}
+
+void ClearSessionTickets() { ticket_cache.clear(); }
+
+x509::ChainCache &VerifiedChains() {
+  thread_local static x509::ChainCache chain_cache;
+  return chain_cache;
+}
+
 static void XorIV(Arr<char, 12> &iv, U64 counter) {
   for (int i = 0; i < sizeof(counter); ++i) {
     iv[11 - i] ^= (counter >> (i * 8)) & 0xff;
   }
 }
 
+static constexpr U16 kTLS_AES_128_GCM_SHA256 = 0x1301;
+static constexpr U16 kTLS_CHACHA20_POLY1305_SHA256 = 0x1303;
+
 // Responsible for encrypting & decrypting TLS records
 struct RecordWrapper {
-  Arr<char, 32> key;
+  U16 cipher_suite;
+  Arr<char, 32> key; // AES-128 uses only the first 16 bytes
   Arr<char, 12> iv;
   U64 counter = 0;
+  Optional<AES128_GCM> aes; // expanded `key`, for TLS_AES_128_GCM_SHA256
 
   // Constructs uninitialized RecordWrapper
   RecordWrapper() = default;
 
-  RecordWrapper(Span<char, 32> secret) {
-    HKDF_Expand_Label(secret, "tls13 key", kEmptySpan, key);
+  RecordWrapper(Span<char, 32> secret, U16 cipher_suite)
+      : cipher_suite(cipher_suite) {
+    if (cipher_suite == kTLS_AES_128_GCM_SHA256) {
+      HKDF_Expand_Label(secret, "tls13 key", kEmptySpan,
+                        Span<>(key).first(16));
+      aes.emplace(Span<char, 16>(key.data(), 16));
+    } else {
+      HKDF_Expand_Label(secret, "tls13 key", kEmptySpan, key);
+    }
     HKDF_Expand_Label(secret, "tls13 iv", kEmptySpan, iv);
   }
 
-  void Wrap(Vec<> &buf, U8 record_type, std::function<void()> wrapped) {
+  // Nonce of the record with the given sequence number (RFC 8446, section
+  // 5.3).
+  Arr<char, 12> Nonce(U64 sequence_number) const {
+    Arr<char, 12> nonce = iv;
+    XorIV(nonce, sequence_number);
+    return nonce;
+  }
+
+  // Appends the header & the inner plaintext (`plaintext` followed by
+  // `record_type`) of a record to `buf`, followed by room for the tag.
+  // Returns the offset of the header.
+  static Size Frame(Vec<> &buf, U8 record_type, Span<> plaintext) {
     Size header_begin = buf.size();
-    buf.insert(buf.end(), {0x17, 0x03, 0x03, 0x00,
-                           0x00}); // application data, TLS 1.2, length
-    Size header_end = buf.size();
-    Size record_length_offset = buf.size() - 2;
-    Size record_begin = buf.size();
-    wrapped();
-    buf.push_back(record_type);
-    Size record_end = buf.size();
-    Size tag_begin = buf.size();
-    buf.insert(buf.end(), 16, 0); // Poly1305 tag
-    Size tag_end = buf.size();
-    buf.Span()
-        .RemovePrefix(record_length_offset)
-        .PutRef(Big<U16>(tag_end - record_begin));
-    XorIV(iv, counter);
-    auto data = Span<>(buf.begin() + record_begin, buf.begin() + record_end);
-    auto aad = Span<>(buf.begin() + header_begin, buf.begin() + header_end);
-    auto tag = Encrypt_AEAD_CHACHA20_POLY1305(key, iv, data, aad);
-    XorIV(iv, counter);
-    ++counter;
-    memcpy(buf.data() + tag_begin, tag.bytes, 16);
+    Size record_begin = header_begin + 5;
+    Size record_end = record_begin + plaintext.size() + 1;
+    Size tag_end = record_end + 16;
+    buf.resize(tag_end);
+    char *header = buf.data() + header_begin;
+    header[0] = 0x17; // application data
+    header[1] = 0x03; // TLS 1.2
+    header[2] = 0x03;
+    Big<U16> record_length = tag_end - record_begin;
+    memcpy(header + 3, &record_length, 2);
+    memcpy(buf.data() + record_begin, plaintext.data(), plaintext.size());
+    buf[record_end - 1] = record_type;
+    return header_begin;
+  }
+
+  // Appends an encrypted record with `plaintext` to `buf`. The record is
+  // assembled & encrypted in place, with a single resize of `buf`.
+  void Wrap(Vec<> &buf, U8 record_type, Span<> plaintext) {
+    Size header_begin = Frame(buf, record_type, plaintext);
+    char *header = buf.data() + header_begin;
+    auto data = Span<>(header + 5, plaintext.size() + 1);
+    auto aad = Span<>(header, 5);
+    char *tag_begin = data.data() + data.size();
+    auto nonce = Nonce(counter++);
+    if (aes) {
+      auto tag = Encrypt_AEAD_AES128_GCM(*aes, nonce, data, aad);
+      memcpy(tag_begin, tag.data(), 16);
+    } else {
+      auto tag = Encrypt_AEAD_CHACHA20_POLY1305(key, nonce, data, aad);
+      memcpy(tag_begin, tag.bytes, 16);
+    }
   }
 
   bool Unwrap(RecordHeader &record, Span<> &data, U8 &true_type) {
     auto contents = record.Contents();
-    Poly1305 tag(contents.last<16>());
+    auto tag = contents.last<16>();
     data = contents.first(contents.size() - 16);
-    XorIV(iv, counter);
+    auto nonce = Nonce(counter);
     bool decrypted_ok =
-        Decrypt_AEAD_CHACHA20_POLY1305(key, iv, data, record, tag);
-    XorIV(iv, counter);
+        aes ? Decrypt_AEAD_AES128_GCM(*aes, nonce, data, record, tag)
+            : Decrypt_AEAD_CHACHA20_POLY1305(key, nonce, data, record,
+                                             Poly1305(tag));
+    return Unwrapped(record, decrypted_ok, data, true_type);
+  }
+
+  // Same as `Unwrap`, for a record that was already decrypted in place (with
+  // the `Nonce` of the current `counter`).
+  bool Unwrapped(RecordHeader &record, bool decrypted_ok, Span<> &data,
+                 U8 &true_type) {
+    auto contents = record.Contents();
+    data = contents.first(contents.size() - 16);
     ++counter;
     if (decrypted_ok) {
       true_type = data.back();
@@ -124,6 +253,34 @@ struct RecordWrapper {
   }
 };
 
+// Pass the keys of `wrapper` to the kernel (kTLS). `direction` is TLS_TX or
+// TLS_RX.
+static bool InstallKernelKey(int fd, int direction, RecordWrapper &wrapper) {
+  Big<U64> rec_seq(wrapper.counter);
+  auto Install = [&](auto &info) {
+    memcpy(info.key, wrapper.key.data(), sizeof(info.key));
+    memcpy(info.rec_seq, &rec_seq, sizeof(info.rec_seq));
+    bool ok = setsockopt(fd, SOL_TLS, direction, &info, sizeof(info)) == 0;
+    memset(&info, 0, sizeof(info)); // don't leave keys on the stack
+    errno = 0;
+    return ok;
+  };
+  if (wrapper.cipher_suite == kTLS_AES_128_GCM_SHA256) {
+    tls12_crypto_info_aes_gcm_128 info = {};
+    info.info.version = TLS_1_3_VERSION;
+    info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    // Kernel splits the 12-byte IV into a 4-byte salt & 8-byte IV.
+    memcpy(info.salt, wrapper.iv.data(), sizeof(info.salt));
+    memcpy(info.iv, wrapper.iv.data() + sizeof(info.salt), sizeof(info.iv));
+    return Install(info);
+  }
+  tls12_crypto_info_chacha20_poly1305 info = {};
+  info.info.version = TLS_1_3_VERSION;
+  info.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+  memcpy(info.iv, wrapper.iv.data(), sizeof(info.iv));
+  return Install(info);
+}
+
 StrView AlertLevelToStr(U8 level) {
   switch (level) {
   case 1:
@@ -210,14 +367,114 @@ StrView AlertDescriptionToStr(U8 desc) {
 
 Phase::Phase(Connection &conn) : conn(conn) {}
 
+// Records the time of the `event`, unless it happened already.
+static void Trace(HandshakeTrace::Clock::time_point &event,
+                  HandshakeTrace::Clock::time_point now =
+                      HandshakeTrace::Clock::now()) {
+  if (event == HandshakeTrace::Clock::time_point()) {
+    event = now;
+  }
+}
+
+// CPU time used by the calling thread so far.
+static std::chrono::nanoseconds ThreadCpuTime() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// Adds the CPU time spent in its scope to `counter` (one of the counters in
+// `conn.trace`), if the connection traces CPU time.
+struct CpuTimeScope {
+  std::chrono::nanoseconds *counter = nullptr;
+  std::chrono::nanoseconds start;
+
+  CpuTimeScope(Connection &conn, std::chrono::nanoseconds &counter) {
+    if (conn.trace_cpu_time) {
+      this->counter = &counter;
+      start = ThreadCpuTime();
+    }
+  }
+
+  ~CpuTimeScope() {
+    if (counter) {
+      *counter += ThreadCpuTime() - start;
+    }
+  }
+};
+
+Str HandshakeTrace::ToStr() const {
+  auto Ms = [&](Clock::time_point event) {
+    if (event == Clock::time_point()) {
+      return Str("-");
+    }
+    return f("%.3fms",
+             std::chrono::duration<double, std::milli>(event - started)
+                 .count());
+  };
+  auto Us = [](std::chrono::nanoseconds cpu) {
+    return f("%.1fus", std::chrono::duration<double, std::micro>(cpu).count());
+  };
+  return "tcp_connected=" + Ms(tcp_connected) +
+         " client_hello_sent=" + Ms(client_hello_sent) +
+         " server_hello_received=" + Ms(server_hello_received) +
+         " handshake_keys_derived=" + Ms(handshake_keys_derived) +
+         " finished_sent=" + Ms(finished_sent) +
+         " first_application_byte=" + Ms(first_application_byte) +
+         " curve25519_cpu=" + Us(curve25519_cpu) +
+         " hkdf_cpu=" + Us(hkdf_cpu) + " aead_cpu=" + Us(aead_cpu) +
+         " signature_cpu=" + Us(signature_cpu);
+}
+
+struct Phase3;
+
+// Application records of many connections, encrypted & decrypted together
+// when the epoll loop iteration ends (see `Connection::batch_records`).
+struct RecordBatch : epoll::Listener {
+  // Connections with plaintext to encrypt & send.
+  Vec<Phase3 *> sending;
+  // Connections with received records to decrypt.
+  Vec<Phase3 *> receiving;
+
+  // The lists above while they're being flushed.
+  Vec<Phase3 *> flushing_sending;
+  Vec<Phase3 *> flushing_receiving;
+
+  void Add(Vec<Phase3 *> &list, Phase3 *phase) {
+    list.push_back(phase);
+    epoll::ScheduleFlush(this);
+  }
+
+  // Called when `phase` is destroyed.
+  void Remove(Phase3 *phase) {
+    for (auto *list :
+         {&sending, &receiving, &flushing_sending, &flushing_receiving}) {
+      std::replace(list->begin(), list->end(), phase, (Phase3 *)nullptr);
+    }
+  }
+
+  void NotifyRead(Status &) override {}
+  void NotifyFlush(Status &) override;
+  const char *Name() const override { return "tls::RecordBatch"; }
+};
+
+static thread_local RecordBatch record_batch;
+
 // Phase for the encrypted application part (after "Client/Server Handshake
 // Finished").
-struct Phase3 : Phase {
-  RecordWrapper server_wrapper;
-  RecordWrapper client_wrapper;
+struct Phase3 : Phase, Recycled<Phase3> {
+  RecordWrapper receive_wrapper;
+  RecordWrapper send_wrapper;
 
-  Phase3(Connection &conn, SHA256 handshake_secret, SHA256 handshake_hash)
+  // Source of the PSKs for session tickets.
+  Arr<char, 32> resumption_master_secret;
+
+  // `handshake_hash` covers the messages up to "Server Handshake Finished" &
+  // `client_finished_hash` up to "Client Handshake Finished".
+  Phase3(Connection &conn, SHA256 handshake_secret, SHA256 handshake_hash,
+         SHA256 client_finished_hash)
       : Phase(conn) {
+    CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
     Arr<char, 32> derived, client_secret, server_secret; // Hash-size-bytes
     HKDF_Expand_Label(handshake_secret, "tls13 derived", empty_hash, derived);
     auto master_secret = HKDF_Extract<SHA256>(derived, zero_key);
@@ -225,8 +482,18 @@ struct Phase3 : Phase {
                       client_secret);
     HKDF_Expand_Label(master_secret, "tls13 s ap traffic", handshake_hash,
                       server_secret);
-    server_wrapper = RecordWrapper(server_secret);
-    client_wrapper = RecordWrapper(client_secret);
+    HKDF_Expand_Label(master_secret, "tls13 res master", client_finished_hash,
+                      resumption_master_secret);
+    RecordWrapper server_wrapper(server_secret, conn.cipher_suite);
+    RecordWrapper client_wrapper(client_secret, conn.cipher_suite);
+    receive_wrapper = conn.is_server ? client_wrapper : server_wrapper;
+    send_wrapper = conn.is_server ? server_wrapper : client_wrapper;
+  }
+
+  ~Phase3() {
+    if (batched) {
+      record_batch.Remove(this);
+    }
   }
 
   void ProcessRecord(RecordHeader &record) override {
@@ -239,11 +506,48 @@ struct Phase3 : Phase {
     }
     Span<> data;
     U8 true_type;
-    if (!server_wrapper.Unwrap(record, data, true_type)) {
+    bool decrypted;
+    if (batch_results_pos < batch_results.size()) {
+      decrypted = receive_wrapper.Unwrapped(
+          record, batch_results[batch_results_pos++], data, true_type);
+    } else {
+      CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+      decrypted = receive_wrapper.Unwrap(record, data, true_type);
+    }
+    if (!decrypted) {
       AppendErrorMessage(conn) += "Couldn't decrypt TLS record";
       return;
     }
+    if (true_type == 23) { // Application Data
+      Trace(conn.trace.first_application_byte);
+      if (conn.receive_in_place) {
+        conn.plaintext.push_back(data);
+      } else {
+        conn.inbox.insert(conn.inbox.end(), data.begin(), data.end());
+      }
+      received = true;
+    } else {
+      // Application should see the data sent before the control record
+      // (for example before close_notify).
+      RecordsProcessed();
+      ProcessControlRecord(true_type, data);
+    }
+  }
+
+  // Whether application data was received since the last `NotifyReceived`.
+  bool received = false;
+
+  void RecordsProcessed() override {
+    if (!received) {
+      return;
+    }
+    received = false;
+    conn.NotifyReceived();
+    conn.plaintext.clear();
+  }
 
+  // Process a decrypted record other than application data.
+  void ProcessControlRecord(U8 true_type, Span<> data) {
     if (true_type == 21) { // Alert
       if (data.size() != 2) {
         AppendErrorMessage(conn) +=
@@ -251,7 +555,9 @@ struct Phase3 : Phase {
         return;
       }
       U8 level = data[0];
-      if (level == 1) {
+      if (data[1] == 0) { // close_notify
+        conn.Close();
+      } else if (level == 1) {
         // Ignore warnings
       } else {
         U8 description = data[1];
@@ -263,28 +569,362 @@ struct Phase3 : Phase {
         return;
       }
     } else if (true_type == 22) { // Handshake
-      return;                     // Ignore because we don't use tickets anyway
-    } else if (true_type == 23) { // Application Data
-      conn.inbox.insert(conn.inbox.end(), data.begin(), data.end());
-      conn.NotifyReceived();
+      ProcessPostHandshake(data);
     } else {
       AppendErrorMessage(conn) +=
           f("Received unknown TLS record type %d", true_type);
     }
   }
 
+  void ProcessPostHandshake(Span<> data) {
+    Status &status = conn;
+    while (!data.empty() && OK(status)) {
+      U8 handshake_type = data.Consume<U8>(status);
+      U24 handshake_length = data.Consume<Big<U24>>(status);
+      Span<> message = data.ConsumeSpan(handshake_length, status);
+      if (!OK(status)) {
+        AppendErrorMessage(status) += "Invalid post-handshake message";
+        return;
+      }
+      if (handshake_type == 4) {
+        ProcessNewSessionTicket(message);
+      }
+      // Other messages (KeyUpdate, CertificateRequest) are not supported.
+    }
+  }
+
+  void ProcessNewSessionTicket(Span<> message) {
+    Status &status = conn;
+    SessionTicket ticket;
+    ticket.received_at = std::chrono::steady_clock::now();
+    ticket.lifetime =
+        std::chrono::seconds(message.Consume<Big<U32>>(status).Get());
+    ticket.age_add = message.Consume<Big<U32>>(status).Get();
+    U8 nonce_length = message.Consume<U8>(status);
+    Span<> nonce = message.ConsumeSpan(nonce_length, status);
+    U16 ticket_length = message.Consume<Big<U16>>(status).Get();
+    Span<> opaque_ticket = message.ConsumeSpan(ticket_length, status);
+    U16 extensions_length = message.Consume<Big<U16>>(status).Get();
+    Span<> extensions = message.ConsumeSpan(extensions_length, status);
+    while (!extensions.empty() && OK(status)) {
+      U16 extension_type = extensions.Consume<Big<U16>>(status).Get();
+      U16 extension_length = extensions.Consume<Big<U16>>(status).Get();
+      Span<> extension_data = extensions.ConsumeSpan(extension_length, status);
+      if (extension_type == 0x2a && extension_data.size() == 4) { // early_data
+        ticket.max_early_data_size = extension_data.Consume<Big<U32>>().Get();
+      }
+    }
+    if (!OK(status)) {
+      AppendErrorMessage(status) += "Invalid NewSessionTicket";
+      return;
+    }
+    if (conn.server_name.empty() || ticket.lifetime.count() == 0) {
+      return; // can't be used
+    }
+    ticket.cipher_suite = conn.cipher_suite;
+    ticket.trust_store = conn.trust_store;
+    ticket.ticket.assign(opaque_ticket.begin(), opaque_ticket.end());
+    {
+      CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+      HKDF_Expand_Label(resumption_master_secret, "tls13 resumption", nonce,
+                        ticket.psk);
+    }
+    StoreSessionTicket(conn.server_name, std::move(ticket));
+  }
+
+  // Move the encryption (or decryption) to the kernel, if possible.
+  //
+  // Keys can be handed over only at record boundaries: TX once everything
+  // encrypted in user space was passed to the kernel, RX once every record
+  // read from the socket was decrypted in user space.
+  void TryKernelTLS() {
+    if (!conn.kernel_tls) {
+      return;
+    }
+    auto &tcp = conn.tcp_connection;
+    if (!ulp_attached) {
+      if (setsockopt(tcp.fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        errno = 0;
+        conn.kernel_tls = false; // no kTLS in this kernel
+        return;
+      }
+      ulp_attached = true;
+    }
+    if (!conn.ktls_tx && tcp.outbox.empty() && !send_batched) {
+      conn.ktls_tx = InstallKernelKey(tcp.fd, TLS_TX, send_wrapper);
+      if (!conn.ktls_tx) {
+        conn.kernel_tls = false; // keep encrypting in user space
+        return;
+      }
+    }
+    if (!conn.ktls_rx && tcp.inbox.empty() && !receive_batched) {
+      conn.ktls_rx = InstallKernelKey(tcp.fd, TLS_RX, receive_wrapper);
+      if (!conn.ktls_rx) {
+        conn.kernel_tls = false; // keep decrypting in user space
+        return;
+      }
+    }
+    if (conn.ktls_tx && conn.ktls_rx) {
+      conn.kernel_tls = false; // nothing more to do
+    }
+  }
+
+  void InboxDrained() override { TryKernelTLS(); }
+
   void PhaseSend() override {
-    client_wrapper.Wrap(conn.tcp_connection.outbox, 0x17, [&]() {
-      conn.tcp_connection.outbox.insert(conn.tcp_connection.outbox.end(),
-                                        conn.outbox.begin(), conn.outbox.end());
-    });
+    TryKernelTLS();
+    auto &send_tcp = conn.tcp_connection.outbox;
+    if (conn.ktls_tx) {
+      // Kernel splits the plaintext into records.
+      send_tcp.insert(send_tcp.end(), conn.outbox.begin(), conn.outbox.end());
+    } else if (CanBatch()) {
+      batch_plaintext.insert(batch_plaintext.end(), conn.outbox.begin(),
+                             conn.outbox.end());
+      if (!send_batched) {
+        send_batched = batched = true;
+        record_batch.Add(record_batch.sending, this);
+      }
+    } else {
+      SealRecords(conn.outbox, nullptr);
+    }
+    conn.outbox.clear();
+    if (!send_batched) {
+      conn.tcp_connection.Send();
+    }
+  }
+
+  // Splits `plaintext` into records (following the record size policy) &
+  // appends them, encrypted, to the TCP outbox. With `jobs` the records are
+  // only framed - their encryption is left to the caller, as `jobs`.
+  //
+  // Nothing is sent from here - a failed send closes the connection & user
+  // code may delete it in `NotifyClosed`.
+  void SealRecords(Span<> plaintext, Vec<ChaCha20Poly1305Job> *jobs) {
+    auto &send_tcp = conn.tcp_connection.outbox;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_send > kRecordSizeIdleReset) {
+      bytes_since_idle = 0;
+    }
+    last_send = now;
+    // Reserve for the worst case (all records small) so that the loop below
+    // never reallocates.
+    Size max_records = plaintext.size() / kSmallPlaintext + 1;
+    send_tcp.reserve(send_tcp.size() + plaintext.size() +
+                     max_records * kRecordOverhead);
+    for (Size pos = 0; pos < plaintext.size();) {
+      Size limit = conn.dynamic_record_size &&
+                           bytes_since_idle < kSmallRecordBytes
+                       ? kSmallPlaintext
+                       : kMaxPlaintext;
+      Size n = std::min(limit, plaintext.size() - pos);
+      Span<> chunk(plaintext.data() + pos, n);
+      if (jobs) {
+        char *header =
+            send_tcp.data() + RecordWrapper::Frame(send_tcp, 0x17, chunk);
+        jobs->push_back({
+            .key = send_wrapper.key,
+            .nonce = send_wrapper.Nonce(send_wrapper.counter++),
+            .data = Span<>(header + 5, n + 1),
+            .aad = Span<>(header, 5),
+        });
+      } else {
+        CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+        send_wrapper.Wrap(send_tcp, 0x17, chunk);
+      }
+      pos += n;
+      bytes_since_idle += n;
+    }
+  }
+
+  bool CanBatch() const {
+    return conn.batch_records &&
+           conn.cipher_suite == kTLS_CHACHA20_POLY1305_SHA256;
+  }
+
+  // Complete application data record at offset `pos` of the TCP inbox (or
+  // nullptr).
+  RecordHeader *BatchableRecord(Size pos) {
+    Vec<> &inbox = conn.tcp_connection.inbox;
+    if (inbox.size() - pos < sizeof(RecordHeader)) {
+      return nullptr;
+    }
+    auto *record = (RecordHeader *)(inbox.data() + pos);
+    Size length = record->length.Get();
+    if (record->type != 23 || length < 17 ||
+        inbox.size() - pos < sizeof(RecordHeader) + length) {
+      return nullptr;
+    }
+    return record;
+  }
+
+  void RecordsReceived() override {
+    if (receive_batched || batch_results_pos < batch_results.size() ||
+        conn.ktls_rx || !CanBatch() || !BatchableRecord(0)) {
+      return;
+    }
+    receive_batched = batched = true;
+    waiting = true; // until the batch is decrypted
+    record_batch.Add(record_batch.receiving, this);
+  }
+
+  // Appends the complete records at the start of the TCP inbox to `jobs`.
+  // Stops at the first record that isn't application data - it's left to
+  // `ProcessRecord`.
+  void GatherReceived(Vec<ChaCha20Poly1305Job> &jobs) {
+    U64 sequence_number = receive_wrapper.counter;
+    Size pos = 0;
+    while (RecordHeader *record = BatchableRecord(pos)) {
+      auto contents = record->Contents();
+      jobs.push_back({
+          .key = receive_wrapper.key,
+          .nonce = receive_wrapper.Nonce(sequence_number++),
+          .data = contents.first(contents.size() - 16),
+          .aad = *record,
+          .tag = Poly1305(contents.last<16>()),
+      });
+      pos += sizeof(RecordHeader) + contents.size();
+    }
+  }
+
+  void FlushBatch() override {
+    if (batch_plaintext.empty()) {
+      return;
+    }
+    SealRecords(batch_plaintext, nullptr);
+    batch_plaintext.clear();
     conn.tcp_connection.Send();
   }
+
+  // Whether this phase was ever added to `record_batch`.
+  bool batched = false;
+
+  // Whether this phase is in `record_batch.sending`.
+  bool send_batched = false;
+  // Plaintext passed to `Send`, waiting for the batch.
+  Vec<> batch_plaintext;
+
+  // Whether this phase is in `record_batch.receiving`.
+  bool receive_batched = false;
+  // Whether the records at the start of the TCP inbox were authenticated by
+  // the batch (& decrypted in place) - consumed by `ProcessRecord`.
+  Vec<bool> batch_results;
+  Size batch_results_pos = 0;
+
+  bool ulp_attached = false;
+
+  // State of the record size policy.
+  std::chrono::steady_clock::time_point last_send;
+  Size bytes_since_idle = 0;
 };
 
+void RecordBatch::NotifyFlush(Status &) {
+  // Sending & receiving may enroll connections again (for example replies sent
+  // from `NotifyReceived`). They end up in a new batch, flushed right after
+  // this one.
+  flushing_sending.swap(sending);
+  flushing_receiving.swap(receiving);
+
+  Vec<ChaCha20Poly1305Job> jobs;
+  for (Phase3 *phase : flushing_sending) {
+    if (phase == nullptr || phase->conn.tcp_connection.IsClosed()) {
+      continue;
+    }
+    phase->SealRecords(phase->batch_plaintext, &jobs);
+    phase->batch_plaintext.clear();
+    phase->send_batched = false;
+  }
+  EncryptBatch_AEAD_CHACHA20_POLY1305(jobs);
+  for (auto &job : jobs) {
+    memcpy(job.data.data() + job.data.size(), job.tag.bytes, 16);
+  }
+
+  jobs.clear();
+  Vec<Size> jobs_end; // of each phase in `flushing_receiving`
+  for (Phase3 *phase : flushing_receiving) {
+    if (phase && !phase->conn.tcp_connection.IsClosed()) {
+      phase->GatherReceived(jobs);
+    }
+    jobs_end.push_back(jobs.size());
+  }
+  DecryptBatch_AEAD_CHACHA20_POLY1305(jobs);
+  for (Size i = 0; i < flushing_receiving.size(); ++i) {
+    Phase3 *phase = flushing_receiving[i];
+    if (phase == nullptr) {
+      continue;
+    }
+    Size begin = i ? jobs_end[i - 1] : 0;
+    phase->batch_results.clear();
+    for (Size j = begin; j < jobs_end[i]; ++j) {
+      phase->batch_results.push_back(jobs[j].ok);
+    }
+    phase->batch_results_pos = 0;
+    phase->receive_batched = false;
+    phase->waiting = false;
+  }
+
+  // Callbacks may close connections & destroy phases - `Remove` clears them
+  // from the lists.
+  for (Phase3 *phase : flushing_sending) {
+    if (phase) {
+      phase->conn.tcp_connection.Send();
+    }
+  }
+  for (Phase3 *phase : flushing_receiving) {
+    if (phase && !phase->conn.tcp_connection.IsClosed()) {
+      phase->conn.tcp_connection.NotifyReceived();
+    }
+  }
+  flushing_sending.clear();
+  flushing_receiving.clear();
+}
+
+// Checks that the ALPN `protocols` fit in the extension - names must have
+// between 1 & 255 bytes (RFC 7301).
+static bool ValidateALPN(const Vec<Str> &protocols, Status &status) {
+  for (auto &protocol : protocols) {
+    if (protocol.empty() || protocol.size() > 255) {
+      AppendErrorMessage(status) +=
+          f("Invalid ALPN protocol name \"%s\" (must have 1 to 255 bytes)",
+            protocol.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// Appends the ALPN extension (RFC 7301) with the given `protocols`.
+static void AppendALPN(Vec<> &buf, const Vec<Str> &protocols) {
+  Size list_length = 0;
+  for (auto &protocol : protocols) {
+    list_length += 1 + protocol.size();
+  }
+  buf.Append(Big<U16>(0x10)); // extension type: ALPN
+  buf.Append(Big<U16>(2 + list_length));
+  buf.Append(Big<U16>(list_length));
+  for (auto &protocol : protocols) {
+    buf.push_back(protocol.size());
+    buf.insert(buf.end(), protocol.begin(), protocol.end());
+  }
+}
+
+// Parses the protocol names from the data of the ALPN extension.
+static Vec<Str> ParseALPN(Span<> extension_data, Status &status) {
+  Vec<Str> protocols;
+  U16 list_length = extension_data.Consume<Big<U16>>(status);
+  Span<> list = extension_data.ConsumeSpan(list_length, status);
+  while (!list.empty() && OK(status)) {
+    U8 length = list.Consume<U8>(status);
+    Span<> name = list.ConsumeSpan(length, status);
+    if (OK(status)) {
+      protocols.push_back(name.ToStr());
+    }
+  }
+  return protocols;
+}
+
 // Phase for the encrypted handshake part (between "Server Hello" & "Server
 // Handshake Finished").
-struct Phase2 : Phase {
+struct Phase2 : Phase, Recycled<Phase2> {
   SHA256::Builder handshake_hash_builder;
   SHA256 handshake_secret;
   Arr<char, 32> client_secret;
@@ -292,22 +932,46 @@ struct Phase2 : Phase {
   RecordWrapper client_wrapper;
   bool send_tls_requested;
 
+  // Set if 0-RTT data was sent. Encrypts "End Of Early Data" once the server
+  // accepts it.
+  Optional<RecordWrapper> early_wrapper;
+  // Number of bytes at the start of `conn.outbox` sent as 0-RTT data.
+  Size early_data_size;
+
+  // Application protocols offered with ALPN (the server may select one).
+  Vec<Str> alpn;
+
+  // With `conn.trust_store`: key of the verified server certificate & whether
+  // the server proved that it holds it ("Certificate Verify").
+  Optional<x509::PublicKey> server_key;
+  bool server_authenticated = false;
+
+  // `early_secret` is derived from the PSK when resuming a session (or from
+  // zeros otherwise).
   Phase2(Connection &conn, SHA256::Builder sha_builder,
-         curve25519::Shared shared_secret, bool send_tls_requested)
+         curve25519::Shared shared_secret, bool send_tls_requested,
+         SHA256 early_secret, Optional<RecordWrapper> early_wrapper,
+         Size early_data_size, Vec<Str> alpn)
       : Phase(conn), handshake_hash_builder(std::move(sha_builder)),
-        send_tls_requested(send_tls_requested) {
+        send_tls_requested(send_tls_requested),
+        early_wrapper(std::move(early_wrapper)),
+        early_data_size(early_data_size), alpn(std::move(alpn)) {
     auto hello_hash_builder = handshake_hash_builder;
     auto hello_hash = hello_hash_builder.Finalize();
     Arr<char, 32> derived, server_secret; // Hash-size-bytes
 
-    HKDF_Expand_Label(early_secret, "tls13 derived", empty_hash, derived);
-    handshake_secret = HKDF_Extract<SHA256>(derived, shared_secret);
-    HKDF_Expand_Label(handshake_secret, "tls13 c hs traffic", hello_hash,
-                      client_secret);
-    HKDF_Expand_Label(handshake_secret, "tls13 s hs traffic", hello_hash,
-                      server_secret);
-    server_wrapper = RecordWrapper(server_secret);
-    client_wrapper = RecordWrapper(client_secret);
+    {
+      CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+      HKDF_Expand_Label(early_secret, "tls13 derived", empty_hash, derived);
+      handshake_secret = HKDF_Extract<SHA256>(derived, shared_secret);
+      HKDF_Expand_Label(handshake_secret, "tls13 c hs traffic", hello_hash,
+                        client_secret);
+      HKDF_Expand_Label(handshake_secret, "tls13 s hs traffic", hello_hash,
+                        server_secret);
+      server_wrapper = RecordWrapper(server_secret, conn.cipher_suite);
+      client_wrapper = RecordWrapper(client_secret, conn.cipher_suite);
+    }
+    Trace(conn.trace.handshake_keys_derived);
   }
 
   void ProcessRecord(RecordHeader &record) override {
@@ -321,7 +985,12 @@ struct Phase2 : Phase {
     }
     Span<> data;
     U8 true_type;
-    if (!server_wrapper.Unwrap(record, data, true_type)) {
+    bool decrypted;
+    {
+      CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+      decrypted = server_wrapper.Unwrap(record, data, true_type);
+    }
+    if (!decrypted) {
       AppendErrorMessage(conn) += "Couldn't decrypt TLS record";
       return;
     }
@@ -332,9 +1001,9 @@ struct Phase2 : Phase {
             true_type);
       return;
     }
-    handshake_hash_builder.Update(data);
 
     while (!data.empty()) {
+      Span<> message = data;
       U8 handshake_type = data.Consume<U8>();
       U24 handshake_length = data.Consume<Big<U24>>();
       if (handshake_length > data.size()) {
@@ -344,36 +1013,99 @@ struct Phase2 : Phase {
       }
       auto handshake_data = data.subspan(0, handshake_length);
       data = data.subspan(handshake_length);
+      message = message.subspan(0, 4 + handshake_length);
+
+      // "Certificate Verify" signs the transcript up to (excluding) itself.
+      if (handshake_type == 15 && conn.trust_store) {
+        auto transcript_hash_builder = handshake_hash_builder;
+        ProcessCertificateVerify(handshake_data,
+                                 transcript_hash_builder.Finalize());
+        if (!OK(conn)) {
+          return;
+        }
+      }
+      handshake_hash_builder.Update(message);
 
       if (handshake_type == 8) {
         // "Server Encrypted Extensions"
+        ProcessEncryptedExtensions(handshake_data);
+        if (!OK(conn)) {
+          return;
+        }
       } else if (handshake_type == 11) {
         // "Server Certificate"
+        if (conn.trust_store) {
+          ProcessCertificate(handshake_data);
+          if (!OK(conn)) {
+            return;
+          }
+        }
       } else if (handshake_type == 15) {
-        // "Server Certificate Verify"
+        // "Server Certificate Verify" - checked above
       } else if (handshake_type == 20) {
         // "Server Handshake Finished"
+        if (conn.trust_store && !server_authenticated && !conn.resumed) {
+          AppendErrorMessage(conn) +=
+              "TLS handshake failed because the server didn't authenticate";
+          return;
+        }
+        auto client_finished_hash_builder = handshake_hash_builder;
         auto handshake_hash = handshake_hash_builder.Finalize();
 
+        // "End Of Early Data" is part of the transcript signed by "Client
+        // Handshake Finished".
+        Arr<char, 4> end_of_early_data = {0x05, 0, 0, 0}; // handshake
+        if (conn.early_data_accepted) {
+          client_finished_hash_builder.Update(end_of_early_data);
+        }
+        auto verified_hash_builder = client_finished_hash_builder;
+        auto verified_hash = verified_hash_builder.Finalize();
+
+        Arr<char, 32> finished_key; // Hash-size-bytes
+        SHA256 verify_data;
+        {
+          CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+          HKDF_Expand_Label(client_secret, "tls13 finished", kEmptySpan,
+                            finished_key);
+          verify_data = HMAC<SHA256>(finished_key, verified_hash);
+        }
+        Arr<char, 4 + 32> client_finished = {0x14, 0, 0, 32}; // handshake
+        memcpy(client_finished.data() + 4, verify_data.bytes, 32);
+        client_finished_hash_builder.Update(client_finished);
+        auto client_finished_hash = client_finished_hash_builder.Finalize();
+
         conn.tcp_connection.outbox.insert(conn.tcp_connection.outbox.end(),
                                           kClientChangeCipherSpec.begin(),
                                           kClientChangeCipherSpec.end());
 
-        client_wrapper.Wrap(conn.tcp_connection.outbox, 0x16, [&]() {
-          Arr<char, 32> finished_key; // Hash-size-bytes
-          HKDF_Expand_Label(client_secret, "tls13 finished", kEmptySpan,
-                            finished_key);
-          SHA256 verify_data = HMAC<SHA256>(finished_key, handshake_hash);
-          auto &buf = conn.tcp_connection.outbox;
-          buf.push_back(0x14); // handshake
-          buf.Append(Big<U24>(32));
-          buf.insert(buf.end(), verify_data.bytes, verify_data.bytes + 32);
-        });
+        if (conn.early_data_accepted) {
+          CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+          early_wrapper->Wrap(conn.tcp_connection.outbox, 0x16,
+                              end_of_early_data);
+          // Server has the 0-RTT data already.
+          conn.outbox.erase(conn.outbox.begin(),
+                            conn.outbox.begin() + early_data_size);
+          if (conn.outbox.empty()) {
+            send_tls_requested = false;
+          }
+        } else if (early_data_size) {
+          // Server skipped the 0-RTT data - send it again with the
+          // application keys.
+          send_tls_requested = true;
+        }
+
+        {
+          CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+          client_wrapper.Wrap(conn.tcp_connection.outbox, 0x16,
+                              client_finished);
+        }
 
         bool send_tls_requested =
             this->send_tls_requested; // copy to avoid use-after-free
         Connection &conn2 = conn;
-        conn2.phase.reset(new Phase3(conn2, handshake_secret, handshake_hash));
+        conn2.phase.reset(new Phase3(conn2, handshake_secret, handshake_hash,
+                                     client_finished_hash));
+        Trace(conn2.trace.finished_sent);
         if (send_tls_requested) {
           // Encrypt contents of `send_tls` and send it along with `Client
           // Verify`.
@@ -390,30 +1122,239 @@ struct Phase2 : Phase {
     }
   }
 
+  void ProcessCertificate(Span<> data) {
+    Status &status = conn;
+    U8 context_length = data.Consume<U8>(status);
+    data.ConsumeSpan(context_length, status);
+    U24 list_length = data.Consume<Big<U24>>(status).Get();
+    Span<> list = data.ConsumeSpan(list_length, status);
+    Vec<Span<>> chain;
+    while (!list.empty() && OK(status)) {
+      U24 certificate_length = list.Consume<Big<U24>>(status).Get();
+      chain.push_back(list.ConsumeSpan(certificate_length, status));
+      U16 extensions_length = list.Consume<Big<U16>>(status).Get();
+      list.ConsumeSpan(extensions_length, status);
+    }
+    if (!OK(status)) {
+      AppendErrorMessage(status) += "Invalid Certificate";
+      return;
+    }
+    CpuTimeScope cpu(conn, conn.trace.signature_cpu);
+    auto verified = VerifiedChains().Verify(
+        chain, conn.server_name, *conn.trust_store, x509::Clock::now(), status);
+    if (!OK(status)) {
+      AppendErrorMessage(status) += "Server certificate didn't verify";
+      return;
+    }
+    server_key = verified.leaf_key;
+  }
+
+  void ProcessCertificateVerify(Span<> data, SHA256 transcript_hash) {
+    Status &status = conn;
+    U16 algorithm = data.Consume<Big<U16>>(status).Get();
+    U16 signature_length = data.Consume<Big<U16>>(status).Get();
+    Span<> signature = data.ConsumeSpan(signature_length, status);
+    if (!OK(status)) {
+      AppendErrorMessage(status) += "Invalid Certificate Verify";
+      return;
+    }
+    if (!server_key) {
+      AppendErrorMessage(status) += "Certificate Verify without a certificate";
+      return;
+    }
+    Vec<> signed_content(64, ' ');
+    StrView context = "TLS 1.3, server CertificateVerify";
+    signed_content.insert(signed_content.end(), context.begin(), context.end());
+    signed_content.push_back(0);
+    signed_content.insert(signed_content.end(), transcript_hash.bytes,
+                          transcript_hash.bytes + 32);
+    CpuTimeScope cpu(conn, conn.trace.signature_cpu);
+    using Algorithm = x509::PublicKey::Algorithm;
+    if (algorithm == 0x0807 && server_key->algorithm == Algorithm::kEd25519 &&
+        signature.size() == 64) {
+      ed25519::Signature ed25519_signature;
+      memcpy(ed25519_signature.bytes.data(), signature.data(), 64);
+      server_authenticated =
+          ed25519_signature.Verify(signed_content, server_key->ed25519);
+    } else if (algorithm == 0x0804 &&
+               server_key->algorithm == Algorithm::kRSA) {
+      server_authenticated =
+          rsa::VerifyPSS_SHA256(server_key->rsa, signed_content, signature);
+    }
+    if (!server_authenticated) {
+      AppendErrorMessage(status) += f(
+          "Server signature (algorithm 0x%04x) didn't verify", algorithm);
+    }
+  }
+
+  void ProcessEncryptedExtensions(Span<> data) {
+    Status &status = conn;
+    U16 extensions_length = data.Consume<Big<U16>>(status).Get();
+    Span<> extensions = data.ConsumeSpan(extensions_length, status);
+    while (!extensions.empty() && OK(status)) {
+      U16 extension_type = extensions.Consume<Big<U16>>(status).Get();
+      U16 extension_length = extensions.Consume<Big<U16>>(status).Get();
+      Span<> extension_data = extensions.ConsumeSpan(extension_length, status);
+      if (extension_type == 0x10) { // ALPN
+        Vec<Str> selected = ParseALPN(extension_data, status);
+        if (OK(status) &&
+            (selected.size() != 1 ||
+             std::find(alpn.begin(), alpn.end(), selected[0]) == alpn.end())) {
+          AppendErrorMessage(status) +=
+              "Server selected an application protocol which wasn't offered";
+          return;
+        }
+        if (OK(status)) {
+          conn.alpn_protocol = std::move(selected[0]);
+        }
+      } else if (extension_type == 0x2a) { // early_data
+        if (!early_wrapper) {
+          AppendErrorMessage(status) +=
+              "Server accepted 0-RTT data which wasn't offered";
+          return;
+        }
+        conn.early_data_accepted = true;
+      }
+    }
+    if (!OK(status)) {
+      AppendErrorMessage(status) += "Invalid Encrypted Extensions";
+    }
+  }
+
   void PhaseSend() override { send_tls_requested = true; }
 };
 
+struct Phase1;
+
+// Key exchange step of `Phase1`, offloaded to the thread pool (if it was
+// started) so that connection bursts don't stall the epoll loop.
+struct HandshakeJob : thread_pool::Job {
+  // Cleared when the phase ends before the job is done.
+  Phase1 *phase;
+
+  // CPU time of `Run`.
+  std::chrono::nanoseconds cpu_time{0};
+
+  HandshakeJob(Phase1 *phase) : phase(phase) {}
+};
+
+// Generates the client key share (when the key pool ran dry).
+struct KeyShareJob : HandshakeJob {
+  Status status;
+  curve25519::KeyPair pair;
+
+  using HandshakeJob::HandshakeJob;
+
+  void Run() override {
+    auto start = ThreadCpuTime();
+    pair = curve25519::KeyPair::Generate(status);
+    cpu_time = ThreadCpuTime() - start;
+  }
+
+  void Done() override;
+};
+
+// Computes the shared secret from the server key share.
+struct SharedSecretJob : HandshakeJob {
+  curve25519::Private client_secret;
+  curve25519::Public server_public;
+  curve25519::Shared shared_secret;
+
+  SharedSecretJob(Phase1 *phase, const curve25519::Private &client_secret,
+                  const curve25519::Public &server_public)
+      : HandshakeJob(phase), client_secret(client_secret),
+        server_public(server_public) {}
+
+  void Run() override {
+    auto start = ThreadCpuTime();
+    shared_secret =
+        curve25519::Shared::FromPrivateAndPublic(client_secret, server_public);
+    cpu_time = ThreadCpuTime() - start;
+  }
+
+  void Done() override;
+};
+
 // Phase for the plaintext handshake part (before "Server Hello").
-struct Phase1 : Phase {
+struct Phase1 : Phase, Recycled<Phase1> {
   SHA256::Builder sha_builder;
   curve25519::Private client_secret;
   bool send_tls_requested = false;
 
-  Phase1(Connection &conn, Connection::Config &config) : Phase(conn) {
-    client_secret = curve25519::Private::FromDevUrandom(conn);
-    if (!OK(conn)) {
-      AppendErrorMessage(conn) += "Couldn't generate private key for TLS";
+  // Ticket offered in the "Client Hello" (if any) & the early secret derived
+  // from its PSK.
+  Optional<SessionTicket> ticket;
+  SHA256 psk_early_secret;
+
+  // Encrypts the 0-RTT data (the first `early_data_size` bytes of
+  // `conn.outbox`), if it's sent.
+  Optional<RecordWrapper> early_wrapper;
+  Size early_data_size = 0;
+
+  // Set while the key exchange runs on the thread pool.
+  HandshakeJob *job = nullptr;
+
+  // Application protocols offered with ALPN.
+  Vec<Str> alpn;
+
+  // Whether the server accepted the PSK of the `ticket`.
+  bool psk_accepted = false;
+
+  // Whether the "Client Hello" was put in the TCP outbox.
+  bool client_hello_queued = false;
+
+  Phase1(Connection &conn, Connection::Config &config)
+      : Phase(conn), alpn(std::move(config.alpn)) {
+    if (config.server_name && config.resume_session) {
+      ticket = TakeSessionTicket(*config.server_name);
+      if (ticket && conn.trust_store &&
+          ticket->trust_store != conn.trust_store) {
+        ticket.reset(); // server of that session wasn't verified
+      }
+    }
+    if (config.early_data && ticket && !conn.outbox.empty() &&
+        conn.outbox.size() <= ticket->max_early_data_size &&
+        conn.outbox.size() <= kMaxPlaintext) {
+      early_data_size = conn.outbox.size();
+    }
+    Status status;
+    if (auto pair = curve25519::TakePooledKeyPair()) {
+      KeyShareReady(status, *pair);
+      return;
+    }
+    if (thread_pool::Started()) {
+      job = new KeyShareJob(this);
+      thread_pool::Submit(job);
+      return;
+    }
+    curve25519::KeyPair pair;
+    {
+      CpuTimeScope cpu(conn, conn.trace.curve25519_cpu);
+      pair = curve25519::KeyPair::Generate(status);
+    }
+    KeyShareReady(status, pair);
+  }
+
+  ~Phase1() {
+    if (job) {
+      job->phase = nullptr; // the result is no longer needed
+    }
+  }
+
+  void KeyShareReady(Status &status, const curve25519::KeyPair &pair) {
+    if (!OK(status)) {
+      AppendErrorMessage(conn) +=
+          "Couldn't generate private key for TLS: " + ErrorMessage(status);
       conn.tcp_connection.Close();
       return;
     }
-    SendClientHello(config);
+    client_secret = pair.private_key;
+    SendClientHello(pair.public_key);
   }
 
-  void SendClientHello(Connection::Config &config) {
+  void SendClientHello(const curve25519::Public &client_public) {
     constexpr bool kCompatibleWithTLS12 = false;
     auto &send_tcp = conn.tcp_connection.outbox;
-    // Generate encryption keys.
-    auto client_public = curve25519::Public::FromPrivate(client_secret);
 
     // Send "Client Hello"
     auto Append = [&](const std::initializer_list<char> bytes) {
@@ -458,8 +1399,18 @@ struct Phase1 : Phase {
       Append({0x13, 0x02}); // TLS_AES_256_GCM_SHA384
       Append({0x00, 0xff}); // TLS_EMPTY_RENEGOTIATION_INFO_SCSV
     } else {
-      Append({0x00, 0x02}); // cipher suites length: 2 (one cipher suite)
-      Append({0x13, 0x03}); // TLS_CHACHA20_POLY1305_SHA256
+      // Prefer AES-GCM only when it's accelerated by the CPU. 0-RTT data is
+      // accepted only with the cipher suite of the original session.
+      U16 preferred = aes128_gcm_hardware ? kTLS_AES_128_GCM_SHA256
+                                          : kTLS_CHACHA20_POLY1305_SHA256;
+      if (early_data_size) {
+        preferred = ticket->cipher_suite;
+      }
+      Append({0x00, 0x04}); // cipher suites length: 4 (two cipher suites)
+      send_tcp.Append(Big<U16>(preferred));
+      send_tcp.Append(Big<U16>(preferred == kTLS_AES_128_GCM_SHA256
+                                   ? kTLS_CHACHA20_POLY1305_SHA256
+                                   : kTLS_AES_128_GCM_SHA256));
     }
 
     Append({0x01}); // compression methods length: 1
@@ -469,8 +1420,8 @@ struct Phase1 : Phase {
     Append({0x00, 0x00}); // placeholder for extensions length
     Size extensions_begin = send_tcp.size();
 
-    if (config.server_name) {
-      auto hostname_length = config.server_name->size();
+    if (!conn.server_name.empty()) {
+      auto hostname_length = conn.server_name.size();
       auto entry_length = hostname_length + 3;
       auto extension_length = entry_length + 2;
       Append({0x00, 0x00}); // extension type: server name
@@ -478,8 +1429,12 @@ struct Phase1 : Phase {
       send_tcp.Append(Big<U16>(entry_length));
       Append({0x00}); // entry type: DNS hostname
       send_tcp.Append(Big<U16>(hostname_length));
-      send_tcp.insert(send_tcp.end(), config.server_name->begin(),
-                      config.server_name->end());
+      send_tcp.insert(send_tcp.end(), conn.server_name.begin(),
+                      conn.server_name.end());
+    }
+
+    if (!alpn.empty()) {
+      AppendALPN(send_tcp, alpn);
     }
 
     if constexpr (kCompatibleWithTLS12) {
@@ -521,22 +1476,32 @@ struct Phase1 : Phase {
     Append({0x00, 0x00}); // extension length: 0
 
     Append({0x00, 0x0d}); // extension type: signature algorithms
-    Append({0x00, 0x1e}); // extension length: 30
-    Append({0x00, 0x1c}); // signature algorithms length: 28
-    Append({0x08, 0x07}); // ED25519
-    Append({0x04, 0x03}); // ECDSA-SECP256r1-SHA256
-    Append({0x05, 0x03}); // ECDSA-SECP384r1-SHA384
-    Append({0x06, 0x03}); // ECDSA-SECP521r1-SHA512
-    Append({0x08, 0x08}); // ED448
-    Append({0x08, 0x09}); // RSA-PSS-PSS-SHA256
-    Append({0x08, 0x0a}); // RSA-PSS-PSS-SHA384
-    Append({0x08, 0x0b}); // RSA-PSS-PSS-SHA512
-    Append({0x08, 0x04}); // RSA-PSS-RSAE-SHA256
-    Append({0x08, 0x05}); // RSA-PSS-RSAE-SHA384
-    Append({0x08, 0x06}); // RSA-PSS-RSAE-SHA512
-    Append({0x04, 0x01}); // RSA-PKCS1-SHA256
-    Append({0x05, 0x01}); // RSA-PKCS1-SHA384
-    Append({0x06, 0x01}); // RSA-PKCS1-SHA512
+    if (conn.trust_store) {
+      // Only the algorithms that can be verified.
+      Append({0x00, 0x0a}); // extension length: 10
+      Append({0x00, 0x08}); // signature algorithms length: 8
+      Append({0x08, 0x07}); // ED25519
+      Append({0x08, 0x04}); // RSA-PSS-RSAE-SHA256
+      Append({0x04, 0x01}); // RSA-PKCS1-SHA256 (certificates only)
+      Append({0x06, 0x01}); // RSA-PKCS1-SHA512 (certificates only)
+    } else {
+      Append({0x00, 0x1e}); // extension length: 30
+      Append({0x00, 0x1c}); // signature algorithms length: 28
+      Append({0x08, 0x07}); // ED25519
+      Append({0x04, 0x03}); // ECDSA-SECP256r1-SHA256
+      Append({0x05, 0x03}); // ECDSA-SECP384r1-SHA384
+      Append({0x06, 0x03}); // ECDSA-SECP521r1-SHA512
+      Append({0x08, 0x08}); // ED448
+      Append({0x08, 0x09}); // RSA-PSS-PSS-SHA256
+      Append({0x08, 0x0a}); // RSA-PSS-PSS-SHA384
+      Append({0x08, 0x0b}); // RSA-PSS-PSS-SHA512
+      Append({0x08, 0x04}); // RSA-PSS-RSAE-SHA256
+      Append({0x08, 0x05}); // RSA-PSS-RSAE-SHA384
+      Append({0x08, 0x06}); // RSA-PSS-RSAE-SHA512
+      Append({0x04, 0x01}); // RSA-PKCS1-SHA256
+      Append({0x05, 0x01}); // RSA-PKCS1-SHA384
+      Append({0x06, 0x01}); // RSA-PKCS1-SHA512
+    }
 
     Append({0x00, 0x2b}); // extension type: supported versions
     Append({0x00, 0x03}); // extension length: 3
@@ -556,6 +1521,32 @@ struct Phase1 : Phase {
     send_tcp.insert(send_tcp.end(), client_public.bytes.begin(),
                     client_public.bytes.end());
 
+    if (early_data_size) {
+      Append({0x00, 0x2a}); // extension type: early data
+      Append({0x00, 0x00}); // extension length: 0
+    }
+
+    // Pre-shared key must be the last extension because its binder signs the
+    // "Client Hello" up to this point.
+    Size binders_begin = 0;
+    if (ticket) {
+      auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - ticket->received_at);
+      U32 obfuscated_age = (U32)age.count() + ticket->age_add;
+      Size identity_length = 2 + ticket->ticket.size() + 4;
+      Append({0x00, 0x29}); // extension type: pre-shared key
+      send_tcp.Append(Big<U16>(2 + identity_length + 2 + 1 + 32));
+      send_tcp.Append(Big<U16>(identity_length));
+      send_tcp.Append(Big<U16>(ticket->ticket.size()));
+      send_tcp.insert(send_tcp.end(), ticket->ticket.begin(),
+                      ticket->ticket.end());
+      send_tcp.Append(Big<U32>(obfuscated_age));
+      binders_begin = send_tcp.size();
+      Append({0x00, 0x21}); // binders length: 33
+      Append({0x20});       // binder length: 32
+      send_tcp.insert(send_tcp.end(), 32, 0); // placeholder for binder
+    }
+
     send_tcp.Span()
         .RemovePrefix(extensions_length_offset)
         .PutRef(Big<U16>(send_tcp.size() - extensions_begin));
@@ -566,10 +1557,54 @@ struct Phase1 : Phase {
         .RemovePrefix(record_length_offset)
         .PutRef(Big<U16>(send_tcp.size() - record_begin));
 
+    if (ticket) {
+      CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+      psk_early_secret = HKDF_Extract<SHA256>(Span<>("\x00", 1), ticket->psk);
+      Arr<char, 32> binder_key, finished_key; // Hash-size-bytes
+      HKDF_Expand_Label(psk_early_secret, "tls13 res binder", empty_hash,
+                        binder_key);
+      HKDF_Expand_Label(binder_key, "tls13 finished", kEmptySpan,
+                        finished_key);
+      auto truncated_hello_builder = sha_builder;
+      truncated_hello_builder.Update(Span<>((char *)&send_tcp[record_begin],
+                                            binders_begin - record_begin));
+      SHA256 binder =
+          HMAC<SHA256>(finished_key, truncated_hello_builder.Finalize());
+      memcpy(&send_tcp[send_tcp.size() - 32], binder.bytes, 32);
+    }
+
     sha_builder.Update(Span<>((char *)&send_tcp[record_begin],
                               send_tcp.size() - record_begin));
 
+    if (early_data_size) {
+      auto hello_hash_builder = sha_builder;
+      auto hello_hash = hello_hash_builder.Finalize();
+      Arr<char, 32> early_traffic_secret; // Hash-size-bytes
+      {
+        CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+        HKDF_Expand_Label(psk_early_secret, "tls13 c e traffic", hello_hash,
+                          early_traffic_secret);
+        early_wrapper.emplace(early_traffic_secret, ticket->cipher_suite);
+      }
+      CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+      early_wrapper->Wrap(send_tcp, 0x17,
+                          Span<>(conn.outbox.data(), early_data_size));
+    }
+
+    client_hello_queued = true;
+    // Timestamps are taken before `send` because it may switch to the thread
+    // of a local peer.
+    auto now = HandshakeTrace::Clock::now();
     conn.tcp_connection.Send();
+    OutboxFlushed(now);
+  }
+
+  void OutboxFlushed(HandshakeTrace::Clock::time_point sent_at) override {
+    if (client_hello_queued && conn.tcp_connection.outbox.empty()) {
+      // Data can't be flushed before the connection is established.
+      Trace(conn.trace.tcp_connected, sent_at);
+      Trace(conn.trace.client_hello_sent, sent_at);
+    }
   }
 
   void ProcessHandshake(Connection &conn, Span<> handshake) {
@@ -590,6 +1625,7 @@ struct Phase1 : Phase {
             handshake_type);
       return;
     }
+    Trace(conn.trace.server_hello_received);
 
     U8 server_version_major = server_hello.Consume<U8>();
     U8 server_version_minor = server_hello.Consume<U8>();
@@ -597,6 +1633,13 @@ struct Phase1 : Phase {
     U8 session_id_length = server_hello.Consume<U8>();
     server_hello = server_hello.subspan(session_id_length);
     U16 cipher_suite = server_hello.Consume<Big<U16>>();
+    if (cipher_suite != kTLS_AES_128_GCM_SHA256 &&
+        cipher_suite != kTLS_CHACHA20_POLY1305_SHA256) {
+      AppendErrorMessage(conn) +=
+          f("Server Hello selected cipher suite 0x%04x which wasn't offered",
+            cipher_suite);
+      return;
+    }
     U8 compression_method = server_hello.Consume<U8>();
     U16 extensions_length = server_hello.Consume<Big<U16>>();
     if (extensions_length != server_hello.size()) {
@@ -610,6 +1653,7 @@ struct Phase1 : Phase {
     U8 supported_version_major = 3;
     U8 supported_version_minor = 4;
     curve25519::Public server_public;
+    bool psk_accepted = false;
 
     while (!server_hello.empty()) {
       U16 extension_type = server_hello.Consume<Big<U16>>();
@@ -659,15 +1703,47 @@ struct Phase1 : Phase {
         }
         break;
       }
+      case 0x29: { // pre-shared key
+        U16 selected_identity = extension_data.Consume<Big<U16>>();
+        if (!ticket || selected_identity != 0) {
+          AppendErrorMessage(conn) +=
+              f("Server Hello selected PSK identity %d which wasn't offered",
+                selected_identity);
+          return;
+        }
+        psk_accepted = true;
+        break;
+      }
       } // switch (extension_type)
     } // while (!server_hello.empty())
 
     sha_builder.Update(handshake);
-    curve25519::Shared shared_secret =
-        curve25519::Shared::FromPrivateAndPublic(client_secret, server_public);
+    conn.cipher_suite = cipher_suite;
+    conn.resumed = psk_accepted;
+    this->psk_accepted = psk_accepted;
+    if (thread_pool::Started()) {
+      // Records that follow "Server Hello" wait for the handshake keys.
+      waiting = true;
+      job = new SharedSecretJob(this, client_secret, server_public);
+      thread_pool::Submit(job);
+      return;
+    }
+    curve25519::Shared shared_secret;
+    {
+      CpuTimeScope cpu(conn, conn.trace.curve25519_cpu);
+      shared_secret =
+          curve25519::Shared::FromPrivateAndPublic(client_secret, server_public);
+    }
+    SharedSecretReady(shared_secret);
+  }
 
+  void SharedSecretReady(const curve25519::Shared &shared_secret) {
     conn.phase.reset(new Phase2(conn, std::move(sha_builder), shared_secret,
-                                send_tls_requested));
+                                send_tls_requested,
+                                psk_accepted ? psk_early_secret
+                                             : early_secret,
+                                std::move(early_wrapper), early_data_size,
+                                std::move(alpn)));
   }
 
   void ProcessRecord(RecordHeader &record) override {
@@ -684,29 +1760,592 @@ struct Phase1 : Phase {
   void PhaseSend() override { send_tls_requested = true; }
 };
 
+// Server phase for the encrypted handshake part (after "Server Handshake
+// Finished"). Waits for "Client Handshake Finished".
+struct ServerPhase2 : Phase, Recycled<ServerPhase2> {
+  SHA256::Builder handshake_hash_builder;
+  SHA256 handshake_secret;
+  SHA256 handshake_hash; // up to "Server Handshake Finished"
+  Arr<char, 32> client_secret;
+  RecordWrapper client_wrapper;
+  bool send_tls_requested;
+
+  // Set when the client offered 0-RTT data. It's not accepted, so records that
+  // fail to decrypt are skipped until the first one that decrypts.
+  bool skip_early_data;
+
+  // Bytes of records that can still be skipped (see
+  // `Server::max_skipped_early_data`).
+  Size skippable_early_data;
+
+  ServerPhase2(Connection &conn, SHA256::Builder handshake_hash_builder,
+               SHA256 handshake_secret, Arr<char, 32> client_secret,
+               bool send_tls_requested, bool skip_early_data,
+               Size skippable_early_data)
+      : Phase(conn), handshake_hash_builder(handshake_hash_builder),
+        handshake_secret(handshake_secret), client_secret(client_secret),
+        client_wrapper(client_secret, conn.cipher_suite),
+        send_tls_requested(send_tls_requested),
+        skip_early_data(skip_early_data),
+        skippable_early_data(skippable_early_data) {
+    auto builder = handshake_hash_builder;
+    handshake_hash = builder.Finalize();
+  }
+
+  void ProcessRecord(RecordHeader &record) override {
+    if (record.type == 20) { // Change Cipher Spec - ignore
+      return;
+    }
+    if (record.type != 23) { // Application Data
+      AppendErrorMessage(conn) += f("Received TLS record type %d", record.type);
+      return;
+    }
+    Span<> data;
+    U8 true_type;
+    bool decrypted;
+    {
+      CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+      decrypted = client_wrapper.Unwrap(record, data, true_type);
+    }
+    if (!decrypted) {
+      Size record_size = sizeof(RecordHeader) + record.length.Get();
+      if (skip_early_data && record_size <= skippable_early_data) {
+        skippable_early_data -= record_size;
+        --client_wrapper.counter; // record wasn't ours
+        return;
+      }
+      if (skip_early_data) {
+        AppendErrorMessage(conn) += "Client sent too much 0-RTT data";
+        return;
+      }
+      AppendErrorMessage(conn) += "Couldn't decrypt TLS record";
+      return;
+    }
+    skip_early_data = false;
+    if (true_type != 22) { // Handshake
+      AppendErrorMessage(conn) +=
+          f("Received TLS record type %d but expected 22 (Handshake Record)",
+            true_type);
+      return;
+    }
+    Status &status = conn;
+    U8 handshake_type = data.Consume<U8>(status);
+    U24 handshake_length = data.Consume<Big<U24>>(status);
+    if (!OK(status) || handshake_type != 20 || handshake_length != 32 ||
+        data.size() != 32) {
+      AppendErrorMessage(conn) += "Expected Client Handshake Finished";
+      return;
+    }
+    Arr<char, 32> finished_key; // Hash-size-bytes
+    SHA256 verify_data;
+    {
+      CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+      HKDF_Expand_Label(client_secret, "tls13 finished", kEmptySpan,
+                        finished_key);
+      verify_data = HMAC<SHA256>(finished_key, handshake_hash);
+    }
+    char diff = 0; // constant-time comparison
+    for (int i = 0; i < 32; ++i) {
+      diff |= verify_data.bytes[i] ^ data[i];
+    }
+    if (diff != 0) {
+      AppendErrorMessage(conn) += "Client Handshake Finished doesn't match";
+      return;
+    }
+    handshake_hash_builder.Update(
+        Span<>(record.Contents().data(), 4 + 32)); // decrypted in place
+    auto client_finished_hash = handshake_hash_builder.Finalize();
+
+    bool send_tls_requested = this->send_tls_requested;
+    Connection &conn2 = conn;
+    conn2.phase.reset(new Phase3(conn2, handshake_secret, handshake_hash,
+                                 client_finished_hash));
+    if (send_tls_requested) {
+      conn2.phase->PhaseSend();
+    }
+  }
+
+  void PhaseSend() override { send_tls_requested = true; }
+};
+
+// Fills `buf` with random bytes from the kernel CSPRNG.
+static bool FillRandom(Span<> buf, Status &status) {
+  for (Size filled = 0; filled < buf.size();) {
+    SSize r = getrandom(buf.data() + filled, buf.size() - filled, 0);
+    if (r < 0) {
+      if (errno == EINTR) {
+        errno = 0;
+        continue;
+      }
+      status() += "getrandom()";
+      return false;
+    }
+    filled += r;
+  }
+  return true;
+}
+
+static void AppendHandshake(Vec<> &buf, U8 type, Span<> body) {
+  buf.push_back(type);
+  buf.Append(Big<U24>(body.size()));
+  buf.insert(buf.end(), body.begin(), body.end());
+}
+
+// Server phase for the plaintext handshake part (before "Client Hello").
+struct ServerPhase1 : Phase, Recycled<ServerPhase1> {
+  const Credentials &credentials;
+  const Vec<Str> &alpn;
+  Size max_skipped_early_data;
+  bool send_tls_requested = false;
+
+  ServerPhase1(Connection &conn, const Server &server)
+      : Phase(conn), credentials(server.credentials), alpn(server.alpn),
+        max_skipped_early_data(server.max_skipped_early_data) {}
+
+  void ProcessRecord(RecordHeader &record) override {
+    if (record.type != 0x16) { // handshake
+      AppendErrorMessage(conn) +=
+          f("Received TLS record type %d but expected 22 "
+            "(TLS Handshake)",
+            record.type);
+      return;
+    }
+    ProcessClientHello(record.Contents());
+  }
+
+  void ProcessClientHello(Span<> client_hello) {
+    Status &status = conn;
+    Span<> data = client_hello;
+    U8 handshake_type = data.Consume<U8>(status);
+    U24 handshake_length = data.Consume<Big<U24>>(status);
+    if (!OK(status) || handshake_type != 1 ||
+        handshake_length != data.size()) {
+      AppendErrorMessage(status) +=
+          "Expected a single Client Hello in the first TLS record";
+      return;
+    }
+    data.ConsumeSpan(2 + 32, status); // legacy version & client random
+    U8 session_id_length = data.Consume<U8>(status);
+    Span<> session_id = data.ConsumeSpan(session_id_length, status);
+    U16 cipher_suites_length = data.Consume<Big<U16>>(status);
+    Span<> cipher_suites = data.ConsumeSpan(cipher_suites_length, status);
+    U8 compression_methods_length = data.Consume<U8>(status);
+    data.ConsumeSpan(compression_methods_length, status);
+    U16 extensions_length = data.Consume<Big<U16>>(status);
+    Span<> extensions = data.ConsumeSpan(extensions_length, status);
+
+    bool offers_aes = false, offers_chacha = false;
+    while (!cipher_suites.empty() && OK(status)) {
+      U16 cipher_suite = cipher_suites.Consume<Big<U16>>(status);
+      offers_aes |= cipher_suite == kTLS_AES_128_GCM_SHA256;
+      offers_chacha |= cipher_suite == kTLS_CHACHA20_POLY1305_SHA256;
+    }
+
+    bool offers_tls13 = false, offers_ed25519 = false;
+    bool offers_early_data = false;
+    Optional<curve25519::Public> client_public;
+    Optional<Vec<Str>> client_alpn;
+    while (!extensions.empty() && OK(status)) {
+      U16 extension_type = extensions.Consume<Big<U16>>(status);
+      U16 extension_length = extensions.Consume<Big<U16>>(status);
+      Span<> extension_data = extensions.ConsumeSpan(extension_length, status);
+      switch (extension_type) {
+      case 0x00: { // server name
+        extension_data.Consume<Big<U16>>(status); // list length
+        U8 name_type = extension_data.Consume<U8>(status);
+        U16 name_length = extension_data.Consume<Big<U16>>(status);
+        Span<> name = extension_data.ConsumeSpan(name_length, status);
+        if (OK(status) && name_type == 0) { // DNS hostname
+          conn.server_name = name.ToStr();
+        }
+        break;
+      }
+      case 0x0d: { // signature algorithms
+        U16 length = extension_data.Consume<Big<U16>>(status);
+        Span<> algorithms = extension_data.ConsumeSpan(length, status);
+        while (!algorithms.empty() && OK(status)) {
+          offers_ed25519 |= algorithms.Consume<Big<U16>>(status) == 0x0807;
+        }
+        break;
+      }
+      case 0x10: // ALPN
+        client_alpn = ParseALPN(extension_data, status);
+        break;
+      case 0x2a: // early data
+        offers_early_data = true;
+        break;
+      case 0x2b: { // supported versions
+        U8 length = extension_data.Consume<U8>(status);
+        Span<> versions = extension_data.ConsumeSpan(length, status);
+        while (!versions.empty() && OK(status)) {
+          offers_tls13 |= versions.Consume<Big<U16>>(status) == 0x0304;
+        }
+        break;
+      }
+      case 0x33: { // key share
+        U16 length = extension_data.Consume<Big<U16>>(status);
+        Span<> shares = extension_data.ConsumeSpan(length, status);
+        while (!shares.empty() && OK(status)) {
+          U16 group = shares.Consume<Big<U16>>(status);
+          U16 key_length = shares.Consume<Big<U16>>(status);
+          Span<> key = shares.ConsumeSpan(key_length, status);
+          if (OK(status) && group == 0x1d && key_length == 32) { // x25519
+            client_public.emplace();
+            memcpy(client_public->bytes.data(), key.data(), 32);
+          }
+        }
+        break;
+      }
+      } // switch (extension_type)
+    }
+    if (!OK(status)) {
+      AppendErrorMessage(status) += "Invalid Client Hello";
+      return;
+    }
+    if (!offers_tls13) {
+      AppendErrorMessage(status) += "Client doesn't support TLS 1.3";
+      return;
+    }
+    if (!client_public) {
+      // HelloRetryRequest is not supported.
+      AppendErrorMessage(status) += "Client Hello has no x25519 key share";
+      return;
+    }
+    if (!offers_ed25519) {
+      AppendErrorMessage(status) += "Client doesn't accept Ed25519 signatures";
+      return;
+    }
+    if (offers_aes && (aes128_gcm_hardware || !offers_chacha)) {
+      conn.cipher_suite = kTLS_AES_128_GCM_SHA256;
+    } else if (offers_chacha) {
+      conn.cipher_suite = kTLS_CHACHA20_POLY1305_SHA256;
+    } else {
+      AppendErrorMessage(status) +=
+          "Client Hello has no supported cipher suite";
+      return;
+    }
+    if (client_alpn && !alpn.empty()) {
+      for (auto &protocol : alpn) {
+        if (std::find(client_alpn->begin(), client_alpn->end(), protocol) !=
+            client_alpn->end()) {
+          conn.alpn_protocol = protocol;
+          break;
+        }
+      }
+      if (conn.alpn_protocol.empty()) {
+        AppendErrorMessage(status) += "Client offered no supported "
+                                      "application protocol (ALPN)";
+        return;
+      }
+    }
+
+    SHA256::Builder sha_builder;
+    sha_builder.Update(client_hello);
+
+    Optional<curve25519::KeyPair> pair = curve25519::TakePooledKeyPair();
+    curve25519::Shared shared_secret;
+    {
+      CpuTimeScope cpu(conn, conn.trace.curve25519_cpu);
+      if (!pair) {
+        pair = curve25519::KeyPair::Generate(status);
+        if (!OK(status)) {
+          AppendErrorMessage(status) +=
+              "Couldn't generate private key for TLS";
+          return;
+        }
+      }
+      shared_secret = curve25519::Shared::FromPrivateAndPublic(
+          pair->private_key, *client_public);
+    }
+
+    // "Server Hello"
+    auto &send_tcp = conn.tcp_connection.outbox;
+    Vec<> server_hello;
+    server_hello.insert(server_hello.end(), {0x03, 0x03}); // TLS 1.2
+    server_hello.resize(server_hello.size() + 32); // server random
+    if (!FillRandom(Span<>(server_hello.data() + 2, 32), status)) {
+      AppendErrorMessage(status) += "Couldn't generate TLS server random";
+      return;
+    }
+    server_hello.push_back(session_id.size()); // echoed
+    server_hello.insert(server_hello.end(), session_id.begin(),
+                        session_id.end());
+    server_hello.Append(Big<U16>(conn.cipher_suite));
+    server_hello.push_back(0); // compression method: null
+    server_hello.Append(Big<U16>(6 + 40)); // extensions length
+    server_hello.insert(server_hello.end(), {0x00, 0x2b, 0x00, 0x02, 0x03,
+                                             0x04}); // supported version
+    server_hello.insert(server_hello.end(),
+                        {0x00, 0x33, 0x00, 0x24, 0x00, 0x1d, 0x00,
+                         0x20}); // key share: x25519, 32 bytes
+    server_hello.insert(server_hello.end(), pair->public_key.bytes.begin(),
+                        pair->public_key.bytes.end());
+    Vec<> handshake;
+    AppendHandshake(handshake, 2, server_hello);
+    send_tcp.insert(send_tcp.end(), {0x16, 0x03, 0x03});
+    send_tcp.Append(Big<U16>(handshake.size()));
+    send_tcp.insert(send_tcp.end(), handshake.begin(), handshake.end());
+    sha_builder.Update(handshake);
+    if (!session_id.empty()) { // middlebox compatibility mode
+      send_tcp.insert(send_tcp.end(), kClientChangeCipherSpec.begin(),
+                      kClientChangeCipherSpec.end());
+    }
+
+    // Handshake keys
+    auto hello_hash_builder = sha_builder;
+    auto hello_hash = hello_hash_builder.Finalize();
+    Arr<char, 32> derived, client_secret, server_secret; // Hash-size-bytes
+    SHA256 handshake_secret;
+    {
+      CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+      HKDF_Expand_Label(early_secret, "tls13 derived", empty_hash, derived);
+      handshake_secret = HKDF_Extract<SHA256>(derived, shared_secret);
+      HKDF_Expand_Label(handshake_secret, "tls13 c hs traffic", hello_hash,
+                        client_secret);
+      HKDF_Expand_Label(handshake_secret, "tls13 s hs traffic", hello_hash,
+                        server_secret);
+    }
+    Trace(conn.trace.handshake_keys_derived);
+
+    // "Encrypted Extensions", "Certificate", "Certificate Verify" & "Finished"
+    Vec<> messages;
+    Vec<> encrypted_extensions = {0, 0}; // placeholder for length
+    if (!conn.alpn_protocol.empty()) {
+      AppendALPN(encrypted_extensions, {conn.alpn_protocol});
+    }
+    encrypted_extensions.Span().PutRef(
+        Big<U16>(encrypted_extensions.size() - 2));
+    AppendHandshake(messages, 8, encrypted_extensions);
+
+    Vec<> certificate;
+    certificate.push_back(0); // request context
+    Size certificates_size = 0;
+    for (auto &der : credentials.certificates) {
+      certificates_size += 3 + der.size() + 2;
+    }
+    certificate.Append(Big<U24>(certificates_size));
+    for (auto &der : credentials.certificates) {
+      certificate.Append(Big<U24>(der.size()));
+      certificate.insert(certificate.end(), der.begin(), der.end());
+      certificate.Append(Big<U16>(0)); // extensions
+    }
+    AppendHandshake(messages, 11, certificate);
+    sha_builder.Update(messages);
+
+    auto certificate_hash_builder = sha_builder;
+    auto certificate_hash = certificate_hash_builder.Finalize();
+    Vec<> signed_content(64, ' ');
+    StrView context = "TLS 1.3, server CertificateVerify";
+    signed_content.insert(signed_content.end(), context.begin(), context.end());
+    signed_content.push_back(0);
+    signed_content.insert(signed_content.end(), certificate_hash.bytes,
+                          certificate_hash.bytes + 32);
+    ed25519::Signature signature;
+    {
+      CpuTimeScope cpu(conn, conn.trace.signature_cpu);
+      signature = ed25519::Signature::Sign(
+          signed_content, credentials.private_key, credentials.public_key);
+    }
+    Vec<> certificate_verify;
+    certificate_verify.Append(Big<U16>(0x0807)); // ed25519
+    certificate_verify.Append(Big<U16>(64));
+    certificate_verify.insert(certificate_verify.end(),
+                              signature.bytes.begin(), signature.bytes.end());
+    Size certificate_verify_begin = messages.size();
+    AppendHandshake(messages, 15, certificate_verify);
+    sha_builder.Update(Span<>(messages).subspan(certificate_verify_begin));
+
+    auto verified_hash_builder = sha_builder;
+    auto verified_hash = verified_hash_builder.Finalize();
+    Arr<char, 32> finished_key; // Hash-size-bytes
+    SHA256 verify_data;
+    {
+      CpuTimeScope cpu(conn, conn.trace.hkdf_cpu);
+      HKDF_Expand_Label(server_secret, "tls13 finished", kEmptySpan,
+                        finished_key);
+      verify_data = HMAC<SHA256>(finished_key, verified_hash);
+    }
+    Size finished_begin = messages.size();
+    AppendHandshake(messages, 20, verify_data);
+    sha_builder.Update(Span<>(messages).subspan(finished_begin));
+
+    {
+      CpuTimeScope cpu(conn, conn.trace.aead_cpu);
+      RecordWrapper server_wrapper(server_secret, conn.cipher_suite);
+      for (Size pos = 0; pos < messages.size(); pos += kMaxPlaintext) {
+        Size n = std::min(kMaxPlaintext, messages.size() - pos);
+        server_wrapper.Wrap(send_tcp, 0x16, Span<>(messages.data() + pos, n));
+      }
+    }
+
+    bool send_tls_requested = this->send_tls_requested;
+    Connection &conn2 = conn;
+    conn2.phase.reset(new ServerPhase2(conn2, sha_builder, handshake_secret,
+                                       client_secret, send_tls_requested,
+                                       offers_early_data,
+                                       max_skipped_early_data));
+    Trace(conn2.trace.finished_sent);
+    conn2.tcp_connection.Send();
+  }
+
+  void PhaseSend() override { send_tls_requested = true; }
+};
+
+void KeyShareJob::Done() {
+  if (phase == nullptr) {
+    return;
+  }
+  phase->job = nullptr; // deleted after `Done`
+  if (phase->conn.tcp_connection.IsClosed()) {
+    return;
+  }
+  phase->conn.trace.curve25519_cpu += cpu_time;
+  phase->KeyShareReady(status, pair);
+}
+
+void SharedSecretJob::Done() {
+  if (phase == nullptr) {
+    return;
+  }
+  phase->job = nullptr; // deleted after `Done`
+  if (phase->conn.tcp_connection.IsClosed()) {
+    return;
+  }
+  Connection &conn = phase->conn;
+  conn.trace.curve25519_cpu += cpu_time;
+  phase->SharedSecretReady(shared_secret); // replaces the phase
+  // Process the records that arrived in the meantime.
+  conn.tcp_connection.NotifyReceived();
+}
+
 void Connection::Connect(Config config) {
+  trace = HandshakeTrace();
+  trace.started = HandshakeTrace::Clock::now();
+  trace_cpu_time = config.trace_cpu_time;
+  kernel_tls = config.kernel_tls;
+  dynamic_record_size = config.dynamic_record_size;
+  receive_in_place = config.receive_in_place;
+  batch_records = config.batch_records;
+  trust_store = config.trust_store;
+  server_name = config.server_name.value_or("");
+  if (!ValidateALPN(config.alpn, *this)) {
+    phase.reset();
+    return;
+  }
   tcp_connection.Connect(config);
 
   phase.reset(new Phase1(*this, config));
 }
 
-void Connection::Send() { phase->PhaseSend(); }
+void Connection::Adopt(FD fd, Server &server) {
+  is_server = true;
+  trace = HandshakeTrace();
+  trace.started = HandshakeTrace::Clock::now();
+  trace.tcp_connected = trace.started;
+  tcp_connection.Adopt(std::move(fd));
+  phase.reset(new ServerPhase1(*this, server));
+}
 
-void Connection::Close() { tcp_connection.Close(); }
+// PKCS #8 header of an Ed25519 private key (RFC 8410), followed by the 32-byte
+// seed.
+static const auto kEd25519PrivateKeyPrefix =
+    HexArr("302e020100300506032b657004220420");
+
+void Credentials::LoadPEM(StrView certificates_pem, StrView private_key_pem,
+                          Status &status) {
+  certificates.clear();
+  for (auto &block : pem::Decode(certificates_pem, status)) {
+    if (block.label == "CERTIFICATE") {
+      certificates.push_back(std::move(block.der));
+    }
+  }
+  if (OK(status) && certificates.empty()) {
+    AppendErrorMessage(status) += "No certificates found";
+  }
+  Vec<pem::Block> key_blocks = pem::Decode(private_key_pem, status);
+  if (!OK(status)) {
+    AppendErrorMessage(status) += "Couldn't load TLS credentials";
+    return;
+  }
+  for (auto &block : key_blocks) {
+    if (block.label != "PRIVATE KEY") {
+      continue;
+    }
+    Span<> der = block.der;
+    Span<> prefix(kEd25519PrivateKeyPrefix.data(),
+                  kEd25519PrivateKeyPrefix.size());
+    if (der.size() != prefix.size() + 32 || !der.StartsWith(prefix)) {
+      AppendErrorMessage(status) += "Only Ed25519 private keys are supported";
+      return;
+    }
+    private_key = ed25519::Private::From32Bytes(
+        der.subspan(prefix.size()).first<32>());
+    public_key = ed25519::Public::FromPrivate(private_key);
+    return;
+  }
+  AppendErrorMessage(status) += "No private key found";
+}
 
-Size ConsumeRecord(Connection &conn) {
+void Credentials::LoadFiles(const char *certificates_path,
+                            const char *private_key_path, Status &status) {
+  Str error;
+  Str certificates_pem = ReadFile(certificates_path, error);
+  if (!error.empty()) {
+    AppendErrorMessage(status) +=
+        f("Couldn't read %s: %s", certificates_path, error.c_str());
+    return;
+  }
+  Str private_key_pem = ReadFile(private_key_path, error);
+  if (!error.empty()) {
+    AppendErrorMessage(status) +=
+        f("Couldn't read %s: %s", private_key_path, error.c_str());
+    return;
+  }
+  LoadPEM(certificates_pem, private_key_pem, status);
+}
+
+void Server::Listen(Config config) {
+  if (!ValidateALPN(alpn, status)) {
+    return;
+  }
+  if (!config.certificates_path.empty()) {
+    credentials.LoadFiles(config.certificates_path.c_str(),
+                          config.private_key_path.c_str(), status);
+    if (!OK(status)) {
+      return;
+    }
+  }
+  tcp::Server::Listen(config);
+}
+
+void Connection::Send() {
+  if (phase) { // not set when `Connect` failed early
+    phase->PhaseSend();
+  }
+}
+
+void Connection::Close() {
+  if (phase) {
+    phase->FlushBatch();
+  }
+  tcp_connection.Close();
+}
+
+// Process the record at offset `pos` of the TCP inbox. Returns its size (or 0
+// if it's not complete yet).
+Size ConsumeRecord(Connection &conn, Size pos) {
   Vec<> &received_tcp = conn.tcp_connection.inbox;
-  if (received_tcp.size() < 5) {
+  if (received_tcp.size() - pos < 5) {
     return 0; // wait for more data
   }
-  RecordHeader &record_header = *(RecordHeader *)received_tcp.data();
+  RecordHeader &record_header = *(RecordHeader *)(received_tcp.data() + pos);
   record_header.Validate(conn);
   if (!OK(conn)) {
     AppendErrorMessage(conn) += "TLS stream corrupted";
     return 0;
   }
   Size record_size = sizeof(RecordHeader) + record_header.length.Get();
-  if (received_tcp.size() < record_size) {
+  if (received_tcp.size() - pos < record_size) {
     return 0; // wait for more data
   }
   conn.phase->ProcessRecord(record_header);
@@ -722,8 +2361,12 @@ void Connection::TCP_Connection::NotifyReceived() {
   // Get the pointer to the Connection object from the pointer to the
   // TCP_Connection
   tls::Connection &conn = Upcast(*this);
-  while (true) {
-    Size n = ConsumeRecord(conn);
+  // Records are decrypted in place. They're released all at once, after the
+  // application has seen their plaintext.
+  conn.phase->RecordsReceived();
+  Size pos = 0;
+  while (!conn.phase->waiting) {
+    Size n = ConsumeRecord(conn, pos);
     if (IsClosed()) {
       return;
     }
@@ -733,9 +2376,92 @@ void Connection::TCP_Connection::NotifyReceived() {
       return;
     }
     if (n == 0) {
+      break;
+    }
+    pos += n;
+  }
+  conn.phase->RecordsProcessed();
+  if (IsClosed()) {
+    return;
+  }
+  inbox.erase(inbox.begin(), inbox.begin() + pos);
+  if (inbox.empty()) {
+    conn.phase->InboxDrained();
+  }
+}
+
+// Reads records decrypted by the kernel (kTLS). Application data is appended
+// directly to `conn.inbox` (or, with `receive_in_place`, read into the unused
+// TCP inbox & passed as a view).
+void Connection::TCP_Connection::NotifyRead(Status &epoll_status) {
+  tls::Connection &conn = Upcast(*this);
+  if (!conn.ktls_rx) {
+    tcp::Connection::NotifyRead(epoll_status);
+    return;
+  }
+  Vec<> &inbox = conn.receive_in_place ? this->inbox : conn.inbox;
+  Size old_size = inbox.size();
+  inbox.resize(old_size + kMaxPlaintext);
+  iovec iov = {.iov_base = inbox.data() + old_size, .iov_len = kMaxPlaintext};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(U8))];
+  msghdr msg = {.msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control,
+                .msg_controllen = sizeof(control)};
+  ssize_t count = recvmsg(fd, &msg, 0);
+  inbox.resize(old_size + std::max<ssize_t>(count, 0));
+  if (count == 0) { // EOF
+    Close();
+    return;
+  }
+  if (count == -1) {
+    if (errno == EWOULDBLOCK) {
+      errno = 0;
       return;
     }
-    inbox.erase(inbox.begin(), inbox.begin() + n);
+    status() += "recvmsg() from kTLS socket";
+    Close();
+    return;
+  }
+  U8 record_type = 23;
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_TLS &&
+      cmsg->cmsg_type == TLS_GET_RECORD_TYPE) {
+    record_type = *(U8 *)CMSG_DATA(cmsg);
+  }
+  if (record_type == 23) {
+    Trace(conn.trace.first_application_byte);
+    if (conn.receive_in_place) {
+      conn.plaintext.push_back(Span<>(inbox.data() + old_size, count));
+      conn.NotifyReceived();
+      conn.plaintext.clear();
+      inbox.resize(old_size);
+    } else {
+      conn.NotifyReceived();
+    }
+    return;
+  }
+  // Control records are never mixed with application data by `recvmsg`.
+  Vec<> data(inbox.begin() + old_size, inbox.end());
+  inbox.resize(old_size);
+  static_cast<Phase3 &>(*conn.phase).ProcessControlRecord(record_type, data);
+  if (!OK(conn)) {
+    ERROR << f("%p ", &conn) << ErrorMessage(conn);
+    conn.Close();
+  }
+}
+
+void Connection::TCP_Connection::NotifyWrite(Status &epoll_status) {
+  tls::Connection &conn = Upcast(*this);
+  // The first write notification comes when the connection is established.
+  auto now = HandshakeTrace::Clock::now();
+  Trace(conn.trace.tcp_connected, now);
+  tcp::Connection::NotifyWrite(epoll_status);
+  if (IsClosed()) {
+    return;
+  }
+  if (outbox.empty()) {
+    conn.phase->OutboxFlushed(now);
   }
 }
 
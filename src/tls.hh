@@ -1,20 +1,24 @@
 #pragma once
 
+#include <chrono>
+
 #include "arr.hh"
+#include "ed25519.hh"
 #include "optional.hh"
 #include "span.hh"
 #include "stream.hh"
 #include "tcp.hh"
 #include "unique_ptr.hh"
+#include "x509.hh"
 
-// Bare-minimum TLS 1.3 implementation.
+// Bare-minimum TLS 1.3 implementation (client & server).
 //
-// Doesn't check peer certificates (can be MITM-ed).
+// Clients check server certificates only when given a trust store (see
+// `Config::trust_store`) - otherwise they can be MITM-ed. Servers authenticate
+// with Ed25519 keys only & don't issue session tickets.
 //
 // Not compliant with RFC 8446 due to lack of several features:
-// - TLS_AES_128_GCM_SHA256 cipher
-// - rsa_pkcs1_sha256 signatures
-// - rsa_pss_rsae_sha256 signatures
+// - rsa_pkcs1_sha256 signatures (in certificates they're supported)
 // - ecdsa_secp256r1_sha256 signatures
 // - secp256r1 key exchange
 // - TLS Cookies
@@ -23,21 +27,168 @@ namespace maf::tls {
 struct Connection;
 struct RecordHeader;
 
+// Timeline of a handshake & the CPU time spent on its cryptography - tells
+// whether slow handshakes are caused by the network, the peer or us.
+//
+// Time points stay default-constructed until the event happens. Servers
+// don't set `client_hello_sent` & `server_hello_received`.
+struct HandshakeTrace {
+  using Clock = std::chrono::steady_clock;
+
+  // `Connect` or `Adopt` was called.
+  Clock::time_point started;
+
+  // The TCP connection was established. When the kernel doesn't report it
+  // before the "Client Hello" is flushed, this is the time of the flush.
+  Clock::time_point tcp_connected;
+
+  // The `send` call which handed the rest of the "Client Hello" to the kernel
+  // was made.
+  Clock::time_point client_hello_sent;
+
+  Clock::time_point server_hello_received;
+
+  // Handshake traffic keys were derived from the shared secret.
+  Clock::time_point handshake_keys_derived;
+
+  // Our "Finished" message was passed to `send` (or queued after data that
+  // the kernel didn't accept yet).
+  Clock::time_point finished_sent;
+
+  // The first application data was decrypted.
+  Clock::time_point first_application_byte;
+
+  // CPU time of the threads which did the work (CLOCK_THREAD_CPUTIME_ID).
+  // Only measured when `Connection::trace_cpu_time` is set - except for the
+  // key exchange on the thread pool, which is always measured. Key pairs taken
+  // from the pool (see curve25519_pool.hh) were generated in advance & don't
+  // count. With kTLS the AEAD of application records runs in the kernel.
+  // Records encrypted in a batch (`batch_records`) aren't counted either.
+  std::chrono::nanoseconds curve25519_cpu{0};
+  std::chrono::nanoseconds hkdf_cpu{0}; // key schedule, including HMACs
+  std::chrono::nanoseconds aead_cpu{0};
+  std::chrono::nanoseconds signature_cpu{0};
+
+  // Milliseconds from `started` to each of the events, followed by the CPU
+  // times in microseconds.
+  Str ToStr() const;
+};
+
 // Responsible for data & logic specific to a single phase of TLS.
 struct Phase {
   Connection &conn;
 
+  // Set while the phase can't process more records (for example while its
+  // crypto runs on the thread pool). They're kept in the TCP inbox until then.
+  bool waiting = false;
+
   Phase(Connection &conn);
   virtual ~Phase() = default;
 
   virtual void ProcessRecord(RecordHeader &) = 0;
   virtual void PhaseSend() = 0;
+
+  // Called when new data arrived in the TCP inbox, before its records are
+  // processed.
+  virtual void RecordsReceived() {}
+
+  // Called after a batch of received records was processed, before their
+  // memory is released.
+  virtual void RecordsProcessed() {}
+
+  // Called when all of the records received so far were processed.
+  virtual void InboxDrained() {}
+
+  // Called when a write notification emptied the TCP outbox. `sent_at` is
+  // the time of the `send` call.
+  virtual void OutboxFlushed(HandshakeTrace::Clock::time_point sent_at) {}
+
+  // Called by `Connection::Close`, before the TCP connection is closed. Sends
+  // the data that waits for a batch (see `Connection::batch_records`).
+  virtual void FlushBatch() {}
 };
 
 void HKDF_Expand_Label(Span<> key, StrView label, Span<> ctx, Span<> out);
 
+// Ticket which allows the client to resume a session, skipping the server
+// certificate (RFC 8446, section 4.6.1).
+struct SessionTicket {
+  // Opaque ticket, as sent by the server.
+  Vec<> ticket;
+  // Pre-shared key derived from the resumption master secret.
+  Arr<char, 32> psk;
+  // Obfuscates the ticket age sent to the server.
+  U32 age_add = 0;
+  std::chrono::steady_clock::time_point received_at;
+  std::chrono::seconds lifetime;
+  // Maximum amount of 0-RTT data accepted by the server (0 if none).
+  U32 max_early_data_size = 0;
+  // Cipher suite of the session - used to encrypt the 0-RTT data.
+  U16 cipher_suite = 0;
+  // Trust store which verified the server certificate of the session (null if
+  // it wasn't verified). Verifying connections resume only such sessions.
+  const x509::TrustStore *trust_store = nullptr;
+};
+
+// Per-thread cache of session tickets, keyed by server name.
+//
+// Tickets are taken out of the cache when offered, so that each one is used
+// only once. Servers send fresh tickets on every connection.
+void StoreSessionTicket(StrView server_name, SessionTicket);
+Optional<SessionTicket> TakeSessionTicket(StrView server_name);
+void ClearSessionTickets();
+
+// Per-thread cache of the server certificate chains verified by clients (see
+// `Config::trust_store`). Lets repeated handshakes skip the signature checks.
+x509::ChainCache &VerifiedChains();
+
+// Certificate chain & private key of a server.
+struct Credentials {
+  // DER-encoded certificates, leaf first.
+  Vec<Vec<>> certificates;
+
+  ed25519::Private private_key;
+  ed25519::Public public_key;
+
+  // Load certificates (PEM "CERTIFICATE" blocks) & an Ed25519 private key (PEM
+  // "PRIVATE KEY" in PKCS #8).
+  void LoadPEM(StrView certificates_pem, StrView private_key_pem, Status &);
+
+  void LoadFiles(const char *certificates_path, const char *private_key_path,
+                 Status &);
+};
+
+// Accepts TLS connections. Like with `tcp::Server`, accepted sockets are
+// passed to `NotifyAcceptedTCP` - they should be passed to
+// `Connection::Adopt` along with this server.
+struct Server : tcp::Server {
+  Credentials credentials;
+
+  struct Config : tcp::Server::Config {
+    // If set, `credentials` are loaded from these files.
+    Str certificates_path;
+    Str private_key_path;
+  };
+
+  // Application protocols (ALPN) supported by this server, in order of
+  // preference. When the client offers some of them, the first one (in this
+  // order) is selected. Clients offering none of them are rejected. Empty
+  // means that ALPN is ignored. Names must have 1 to 255 bytes (otherwise
+  // `Listen` fails).
+  Vec<Str> alpn;
+
+  // 0-RTT data can't be decrypted (this server doesn't issue session tickets)
+  // so it's skipped. When clients send more than this many bytes of records
+  // before their "Finished", the handshake fails.
+  Size max_skipped_early_data = 64 * 1024;
+
+  void Listen(Config);
+};
+
 struct Connection : Stream {
   struct TCP_Connection : tcp::Connection {
+    void NotifyRead(Status &) override;
+    void NotifyWrite(Status &) override;
     void NotifyReceived() override;
     void NotifyClosed() override;
     const char *Name() const override;
@@ -49,11 +200,115 @@ struct Connection : Stream {
 
   struct Config : public tcp::Connection::Config {
     Optional<Str> server_name;
+
+    // Verify the certificate chain of the server against these roots (and
+    // `server_name`). Fails the handshake if it doesn't verify. Null means that
+    // the server isn't authenticated. Must outlive the handshake.
+    //
+    // Verified chains are cached (see `VerifiedChains`) so only the first
+    // handshake with a given server pays for the signature checks. The
+    // "Certificate Verify" of each handshake is always checked.
+    const x509::TrustStore *trust_store = nullptr;
+
+    // Hand the record encryption to the kernel (kTLS) once the handshake is
+    // done. Falls back to user space if the kernel doesn't support it.
+    bool kernel_tls = true;
+
+    // Offer a cached session ticket for `server_name` (if there is one).
+    bool resume_session = true;
+
+    // Send the contents of `outbox` at the time of `Connect` as 0-RTT data,
+    // if the cached session ticket allows it. Saves one round trip.
+    //
+    // Early data can be replayed by an attacker so it should be used only for
+    // idempotent requests. When the server rejects it, it's sent again after
+    // the handshake.
+    bool early_data = false;
+
+    // Start with small (single TCP segment) records, so that the peer can
+    // decrypt the first bytes sooner, & switch to 16 KiB records after 32 KiB.
+    // Starts over after a second of idle. When disabled, all records are
+    // 16 KiB. With kTLS the kernel picks the record sizes.
+    bool dynamic_record_size = true;
+
+    // Pass the received plaintext to `NotifyReceived` as `plaintext` views,
+    // instead of copying it to `inbox`.
+    bool receive_in_place = false;
+
+    // Measure the CPU time of the cryptography (see `HandshakeTrace`). Costs
+    // two extra system calls for every record.
+    bool trace_cpu_time = false;
+
+    // Application protocols to offer with ALPN (RFC 7301), in order of
+    // preference - for example "h2" or "http/1.1". The one selected by the
+    // server ends up in `alpn_protocol`. Names must have 1 to 255 bytes
+    // (otherwise `Connect` fails).
+    Vec<Str> alpn;
+
+    // Encrypt & decrypt the application records of many connections together,
+    // at the end of each epoll loop iteration, with ChaCha20 running in SIMD
+    // lanes (see `EncryptBatch_AEAD_CHACHA20_POLY1305`). Helps when many
+    // connections exchange small messages. `Send` only queues the data - it's
+    // sent when the loop iteration ends (or on `Close`). Applies only to
+    // TLS_CHACHA20_POLY1305_SHA256 & records that don't go through kTLS.
+    bool batch_records = false;
   };
 
+  // Server name (SNI) of this connection. New session tickets are stored in
+  // the cache under this name.
+  Str server_name;
+
+  // Cipher suite selected by the server (TLS_AES_128_GCM_SHA256 = 0x1301 or
+  // TLS_CHACHA20_POLY1305_SHA256 = 0x1303).
+  U16 cipher_suite = 0;
+
+  // Application protocol negotiated with ALPN. Empty if the server didn't
+  // select any (or none was offered).
+  Str alpn_protocol;
+
+  // Whether the server accepted the offered session ticket.
+  bool resumed = false;
+
+  // Whether the server accepted the 0-RTT data.
+  bool early_data_accepted = false;
+
+  // Whether this is the server side of the connection (see `Adopt`).
+  bool is_server = false;
+
+  // Timestamps (& CPU times) of the handshake steps of this connection.
+  HandshakeTrace trace;
+
+  // Options described in `Config`. `Connect` copies them from its `Config`.
+  // Server connections have no `Config` - set these directly, before `Adopt`.
+  // `trust_store` only matters for clients.
+  bool trace_cpu_time = false;
+  bool dynamic_record_size = true;
+  bool receive_in_place = false;
+  bool batch_records = false;
+  const x509::TrustStore *trust_store = nullptr;
+
+  // With `receive_in_place`: plaintext of the records received since the last
+  // `NotifyReceived`, in order. Views point into the buffers of
+  // `tcp_connection` (records are decrypted in place) & are valid only until
+  // `NotifyReceived` returns - data needed later must be copied.
+  Vec<Span<>> plaintext;
+
+  // Whether kTLS may still be enabled for this connection.
+  bool kernel_tls = false;
+
+  // Whether records are encrypted (TX) & decrypted (RX) by the kernel.
+  bool ktls_tx = false;
+  bool ktls_rx = false;
+
   void Connect(Config);
 
-  // Encrypt & send the contents of `send_tls`.
+  // Start the server side of a connection accepted by `server`. The `server`
+  // (its `credentials`) must outlive the handshake. Options such as
+  // `kernel_tls`, `receive_in_place`, `trace_cpu_time` or `batch_records` can
+  // be set on this connection before.
+  void Adopt(FD, Server &server);
+
+  // Encrypt & send (and clear) the contents of `outbox`.
   void Send() override;
 
   void Close() override;
@@ -0,0 +1,320 @@
+#pragma maf main
+
+// Benchmark of `tls::Connection` & `tls::Server`.
+//
+// Usage: tls_bench [port] [certificates.pem private_key.pem]
+//
+// Without the certificates, needs a TLS 1.3 echo server on localhost (for
+// example the TLS terminating proxy, or):
+//
+//   openssl s_server -accept 4433 -cert cert.pem -key key.pem -tls1_3 -rev
+//
+// With the certificates (& an Ed25519 key), runs an echo `tls::Server` on its
+// own thread instead - so the two can be compared.
+//
+// Measures handshakes per second, time to first byte (how long until the
+// server echoes the first line of a large write) & bulk throughput, with &
+// without dynamic record sizing. With the in-process server, also measures
+// many connections exchanging small messages, with & without batched records.
+// Results are printed as JSON Lines (see bench.hh).
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+#include "aead_aes128_gcm.hh"
+#include "bench.hh"
+#include "epoll.hh"
+#include "fn.hh"
+#include "log.hh"
+#include "tls.hh"
+#include "unique_ptr.hh"
+
+using namespace maf;
+using bench::Clock;
+
+namespace {
+
+U16 port = 4433;
+
+// "in_process" or "external"
+const char *server_kind = "external";
+
+// `batch_records` of the connections accepted by the in-process server.
+std::atomic<bool> server_batch_records = false;
+
+void RunLoop() {
+  Status status;
+  epoll::Loop(status);
+  if (!OK(status)) {
+    FATAL << status;
+  }
+}
+
+// Appends `n` bytes of text, broken into lines (the echo server works on
+// lines).
+void AppendLines(Vec<> &buf, Size n) {
+  for (Size i = 0; i < n; ++i) {
+    buf.push_back(i % 1024 == 1023 || i == n - 1 ? '\n' : 'x');
+  }
+}
+
+struct EchoClient : tls::Connection {
+  Size received = 0;
+  Fn<void()> on_received = []() {};
+
+  EchoClient(bool dynamic_record_size, bool trace_cpu_time = false) {
+    Config config = {tcp::Connection::Config{
+                         .remote_ip = IP(127, 0, 0, 1),
+                         .remote_port = port,
+                     },
+                     "localhost"};
+    config.dynamic_record_size = dynamic_record_size;
+    config.trace_cpu_time = trace_cpu_time;
+    config.resume_session = false;
+    config.receive_in_place = true; // echo is only counted
+    Connect(config);
+    // Kernel RX timestamps tell when the echo arrived, even if we were busy
+    // encrypting at that time.
+    tcp_connection.EnableTimestamping(true, false, *this);
+    if (!OK(*this)) {
+      FATAL << "Couldn't connect to port " << port << ": " << ErrorMessage(*this);
+    }
+  }
+
+  void NotifyReceived() override {
+    for (Span<> view : plaintext) {
+      received += view.size();
+    }
+    on_received();
+  }
+
+  void NotifyClosed() override {
+    if (!OK(*this)) {
+      FATAL << ErrorMessage(*this);
+    }
+  }
+};
+
+// Echo server run on a separate thread (with its own epoll loop).
+struct EchoServer : tls::Server {
+  struct Connection : tls::Connection {
+    void NotifyReceived() override {
+      outbox.insert(outbox.end(), inbox.begin(), inbox.end());
+      inbox.clear();
+      Send();
+    }
+  };
+
+  Vec<UniquePtr<Connection>> connections;
+
+  void NotifyAcceptedTCP(FD fd, IP ip, U16 port) override {
+    std::erase_if(connections, [](auto &conn) {
+      return conn->tcp_connection.IsClosed();
+    });
+    auto &conn = connections.emplace_back(new Connection());
+    conn->batch_records = server_batch_records;
+    conn->Adopt(std::move(fd), *this);
+  }
+};
+
+void StartEchoServer(const char *certificates_path,
+                     const char *private_key_path) {
+  std::atomic<bool> listening = false;
+  std::thread([&]() {
+    epoll::Init();
+    EchoServer server;
+    server.Listen({{.local_ip = IP(127, 0, 0, 1), .local_port = port},
+                   certificates_path,
+                   private_key_path});
+    if (!OK(server.status)) {
+      FATAL << "Couldn't start the echo server: " << server.status;
+    }
+    listening = true;
+    RunLoop();
+  }).detach();
+  while (!listening) {
+    std::this_thread::yield();
+  }
+  server_kind = "in_process";
+}
+
+// Full handshakes (no session resumption) per second, each followed by a
+// single line echo.
+//
+// With `trace_cpu_time`, also reports where the time of a handshake goes: the
+// server's response time (from "Client Hello" to "Server Hello") & our own
+// crypto (see `tls::HandshakeTrace`).
+void BenchHandshakes(Size connections, bool trace_cpu_time) {
+  bench::Samples server_us, crypto_cpu_us;
+  auto Us = [](auto duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+  };
+  auto start = Clock::now();
+  for (Size i = 0; i < connections; ++i) {
+    EchoClient client(true, trace_cpu_time);
+    client.outbox.insert(client.outbox.end(), {'p', '\n'});
+    client.Send();
+    client.on_received = [&]() { client.Close(); };
+    RunLoop();
+    auto &trace = client.trace;
+    server_us.Add(Us(trace.server_hello_received - trace.client_hello_sent));
+    crypto_cpu_us.Add(Us(trace.curve25519_cpu + trace.hkdf_cpu +
+                         trace.aead_cpu));
+  }
+  double seconds = bench::Seconds(Clock::now() - start);
+  auto report = bench::Report("tls_handshakes");
+  report.Set("server", server_kind)
+      .Set("trace_cpu_time", trace_cpu_time ? "true" : "false")
+      .Set("connections", connections)
+      .Set("handshakes_per_sec", connections / seconds);
+  if (trace_cpu_time) {
+    report.SetPercentiles("server_hello_us", server_us)
+        .SetPercentiles("crypto_cpu_us", crypto_cpu_us);
+  }
+}
+
+// Time from the start of a `message_size` write until its first line is echoed
+// back, on a fresh connection (after the handshake).
+void BenchTimeToFirstByte(bool dynamic_record_size, Size message_size,
+                          Size connections) {
+  bench::Samples ttfb_us;
+  for (Size i = 0; i < connections; ++i) {
+    EchoClient client(dynamic_record_size);
+    Timestamping::Clock::time_point sent_at;
+    // Warm-up line completes the handshake.
+    client.outbox.insert(client.outbox.end(), {'p', '\n'});
+    client.Send();
+    client.on_received = [&]() {
+      if (sent_at == Timestamping::Clock::time_point()) {
+        sent_at = Timestamping::Clock::now();
+        AppendLines(client.outbox, message_size);
+        client.Send();
+      } else {
+        auto received_at = client.tcp_connection.received_at;
+        if (received_at == Timestamping::Clock::time_point()) {
+          received_at = Timestamping::Clock::now();
+        }
+        ttfb_us.Add(std::chrono::duration<double, std::micro>(received_at -
+                                                              sent_at)
+                        .count());
+        client.Close();
+      }
+    };
+    RunLoop();
+  }
+  bench::Report("tls_time_to_first_byte")
+      .Set("server", server_kind)
+      .Set("dynamic_record_size", dynamic_record_size ? "true" : "false")
+      .Set("message_size", message_size)
+      .SetPercentiles("ttfb_us", ttfb_us);
+}
+
+// Echo `total_bytes` through a single connection, keeping up to `window` bytes
+// in flight.
+void BenchThroughput(bool dynamic_record_size, Size total_bytes) {
+  constexpr Size kChunk = 256 * 1024;
+  constexpr Size kWindow = 4 * 1024 * 1024;
+  EchoClient client(dynamic_record_size);
+  Size sent = 0;
+  Clock::time_point start;
+  auto Pump = [&]() {
+    while (sent < total_bytes && sent - client.received < kWindow) {
+      Size n = std::min(kChunk, total_bytes - sent);
+      AppendLines(client.outbox, n);
+      sent += n;
+      client.Send();
+    }
+  };
+  client.outbox.insert(client.outbox.end(), {'p', '\n'});
+  client.Send();
+  client.on_received = [&]() {
+    if (start == Clock::time_point()) {
+      start = Clock::now();
+      client.received = 0;
+    }
+    if (client.received >= total_bytes) {
+      client.Close();
+      return;
+    }
+    Pump();
+  };
+  RunLoop();
+  double seconds = bench::Seconds(Clock::now() - start);
+  bench::Report("tls_echo_throughput")
+      .Set("server", server_kind)
+      .Set("dynamic_record_size", dynamic_record_size ? "true" : "false")
+      .Set("bytes", total_bytes)
+      .Set("bytes_per_sec", total_bytes / seconds);
+}
+
+// `connections` clients, each echoing `round_trips` lines of `message_size`
+// bytes, all at once. With `batch_records` both sides batch their
+// ChaCha20-Poly1305 records (kTLS is disabled in both modes).
+void BenchSmallMessages(bool batch_records, Size connections,
+                        Size message_size, Size round_trips) {
+  // Batching applies only to ChaCha20-Poly1305.
+  bool aes_hardware = aes128_gcm_hardware;
+  aes128_gcm_hardware = false;
+  server_batch_records = batch_records;
+  Vec<UniquePtr<EchoClient>> clients;
+  Vec<Size> done(connections, 0);
+  auto start = Clock::now();
+  for (Size i = 0; i < connections; ++i) {
+    auto &client = *clients.emplace_back(new EchoClient(true));
+    client.kernel_tls = false;
+    client.batch_records = batch_records;
+    AppendLines(client.outbox, message_size);
+    client.Send();
+    client.on_received = [&client, &done = done[i], message_size,
+                          round_trips]() {
+      if (client.received < message_size) {
+        return;
+      }
+      client.received -= message_size;
+      if (++done == round_trips) {
+        client.Close();
+        return;
+      }
+      AppendLines(client.outbox, message_size);
+      client.Send();
+    };
+  }
+  RunLoop();
+  double seconds = bench::Seconds(Clock::now() - start);
+  aes128_gcm_hardware = aes_hardware;
+  server_batch_records = false;
+  bench::Report("tls_small_messages")
+      .Set("server", server_kind)
+      .Set("batch_records", batch_records ? "true" : "false")
+      .Set("connections", connections)
+      .Set("message_size", message_size)
+      .Set("messages_per_sec", connections * round_trips / seconds);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    port = atoi(argv[1]);
+  }
+  epoll::Init();
+  if (argc > 3) {
+    StartEchoServer(argv[2], argv[3]);
+  }
+  for (bool trace_cpu_time : {false, true}) {
+    BenchHandshakes(1000, trace_cpu_time);
+  }
+  for (bool dynamic_record_size : {true, false}) {
+    for (Size message_size : {16 * 1024, 256 * 1024}) {
+      BenchTimeToFirstByte(dynamic_record_size, message_size, 200);
+    }
+    BenchThroughput(dynamic_record_size, 256 << 20);
+  }
+  if (StrView(server_kind) == "in_process") {
+    for (bool batch_records : {false, true}) {
+      BenchSmallMessages(batch_records, 64, 64, 1000);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+#pragma maf main
+
+// Loopback benchmark of `epoll::UDPListener`.
+//
+// Usage: udp_bench [datagrams]
+//
+// Measures datagrams/s received with:
+//   - `sendto` & `recvfrom` (one syscall per datagram),
+//   - `sendmmsg` & `recvmmsg` (batched),
+//   - `sendmmsg` & `recvmmsg` with segmentation offload (GSO & GRO).
+//
+// The sender sends a window of datagrams & waits until the receiver gets all
+// of them, so that the receive buffer never overflows. Results are printed as
+// JSON Lines (see bench.hh).
+
+#include <cstdlib>
+#include <sys/socket.h>
+
+#include "bench.hh"
+#include "epoll.hh"
+#include "epoll_udp.hh"
+#include "log.hh"
+
+using namespace maf;
+using bench::Clock;
+
+static constexpr U16 kPort = 12346;
+static constexpr Size kWindow = 64;
+
+namespace {
+
+enum class Mode { kSingle, kBatched, kOffload };
+
+const char *ModeName(Mode mode) {
+  switch (mode) {
+  case Mode::kSingle:
+    return "sendto_recvfrom";
+  case Mode::kBatched:
+    return "sendmmsg_recvmmsg";
+  case Mode::kOffload:
+    return "gso_gro";
+  }
+  return "";
+}
+
+struct Sender : epoll::UDPListener {
+  Mode mode;
+  Str datagram;
+
+  Sender(Mode mode, Size datagram_size)
+      : mode(mode), datagram(datagram_size, 'd') {
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    gso = mode == Mode::kOffload;
+    Status status;
+    epoll::Add(this, status);
+    if (!OK(status)) {
+      FATAL << status;
+    }
+  }
+
+  void SendWindow() {
+    for (Size i = 0; i < kWindow; ++i) {
+      if (mode == Mode::kSingle) {
+        Str error;
+        fd.SendTo(IP(127, 0, 0, 1), kPort, datagram, error);
+        if (!error.empty()) {
+          FATAL << error;
+        }
+      } else {
+        QueueSendTo(IP(127, 0, 0, 1), kPort, datagram);
+      }
+    }
+  }
+
+  void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {}
+  const char *Name() const override { return "Sender"; }
+};
+
+struct Receiver : epoll::UDPListener {
+  Sender &sender;
+  Size expected;
+  Size received = 0;
+  Size received_bytes = 0;
+  // Number of `HandleBatch` calls (stays 0 with `recvfrom`).
+  Size reads = 0;
+
+  Receiver(Mode mode, Sender &sender, Size expected)
+      : sender(sender), expected(expected) {
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // Room for a full window of the largest datagrams.
+    int rcvbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    Status status;
+    fd.Bind(IP(127, 0, 0, 1), kPort, status);
+    if (mode != Mode::kSingle) {
+      recv_batch_size = kWindow;
+    }
+    if (mode == Mode::kOffload) {
+      EnableGRO(status);
+    }
+    epoll::Add(this, status);
+    if (!OK(status)) {
+      FATAL << status;
+    }
+  }
+
+  void HandleBatch(Span<Datagram> batch) override {
+    ++reads;
+    UDPListener::HandleBatch(batch);
+  }
+
+  void HandleRequest(StrView buf, IP source_ip, U16 source_port) override {
+    ++received;
+    received_bytes += buf.size();
+    if (received == expected) {
+      Status ignore;
+      epoll::Del(this, ignore);
+      fd.Close();
+      epoll::Del(&sender, ignore);
+      sender.fd.Close();
+    } else if (received % kWindow == 0) {
+      sender.SendWindow();
+    }
+  }
+
+  const char *Name() const override { return "Receiver"; }
+};
+
+void Bench(Mode mode, Size datagram_size, Size datagrams) {
+  datagrams = datagrams / kWindow * kWindow;
+  Sender sender(mode, datagram_size);
+  Receiver receiver(mode, sender, datagrams);
+  auto start = Clock::now();
+  sender.SendWindow();
+  Status status;
+  epoll::Loop(status);
+  if (!OK(status)) {
+    FATAL << status;
+  }
+  double seconds = bench::Seconds(Clock::now() - start);
+  bench::Report("udp_loopback")
+      .Set("mode", ModeName(mode))
+      .Set("datagram_size", datagram_size)
+      .Set("datagrams", receiver.received)
+      .Set("datagrams_per_sec", receiver.received / seconds)
+      .Set("bytes_per_sec", receiver.received_bytes / seconds)
+      .Set("datagrams_per_read",
+           receiver.reads ? (double)receiver.received / receiver.reads : 1)
+      .Set("gso", sender.gso ? "enabled" : "disabled");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Size datagrams = argc > 1 ? atoi(argv[1]) : 500'000;
+  epoll::Init();
+  for (Size datagram_size : {64, 1200, 8000}) {
+    for (Mode mode : {Mode::kSingle, Mode::kBatched, Mode::kOffload}) {
+      Bench(mode, datagram_size, datagrams);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,329 @@
+#include "uds.hh"
+
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace maf::uds {
+
+// Maximum number of file descriptors passed in a single message.
+static constexpr int kMaxFDs = 16;
+
+static bool MakeAddress(StrView path, sockaddr_un &addr, socklen_t &addrlen,
+                        Status &status) {
+  addr = {.sun_family = AF_UNIX};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    status() += "Unix socket path \"" + Str(path) + "\" is too long";
+    return false;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+  addrlen = offsetof(sockaddr_un, sun_path) + path.size();
+  if (path.starts_with('@')) {
+    addr.sun_path[0] = 0; // abstract namespace - no null terminator
+  } else {
+    addrlen += 1;
+  }
+  return true;
+}
+
+// Removes the socket file at `path` if it was left behind by a server that's
+// gone. Fails if `path` is a live socket or not a socket at all.
+static bool RemoveStaleSocket(const Str &path, const sockaddr_un &addr,
+                              socklen_t addrlen, Type type, Status &status) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) < 0) {
+    if (errno == ENOENT) {
+      errno = 0;
+      return true;
+    }
+    status() += "lstat(\"" + path + "\") failed";
+    return false;
+  }
+  if (S_ISSOCK(st.st_mode)) {
+    FD probe = socket(AF_UNIX, (int)type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+      status() += "socket() failed";
+      return false;
+    }
+    if (connect(probe, (sockaddr *)&addr, addrlen) < 0 &&
+        errno == ECONNREFUSED) {
+      errno = 0;
+      unlink(path.c_str());
+      return true;
+    }
+  }
+  errno = EADDRINUSE;
+  status() += "Can't listen on \"" + path + "\"";
+  return false;
+}
+
+void Server::Listen(Config config) {
+  sockaddr_un addr;
+  socklen_t addrlen;
+  if (!MakeAddress(config.path, addr, addrlen, status)) {
+    return;
+  }
+
+  fd = socket(AF_UNIX, (int)config.type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    status() += "socket() failed";
+    return;
+  }
+
+  bool in_filesystem = !config.path.starts_with('@');
+  if (in_filesystem &&
+      !RemoveStaleSocket(config.path, addr, addrlen, config.type, status)) {
+    StopListening();
+    return;
+  }
+
+  if (bind(fd, (sockaddr *)&addr, addrlen) < 0) {
+    status() += "bind() failed";
+    StopListening();
+    return;
+  }
+  if (in_filesystem) {
+    path = config.path; // only now it's our socket file
+  }
+
+  if (int r = listen(fd, SOMAXCONN); r < 0) {
+    status() += "listen() failed";
+    StopListening();
+    return;
+  }
+
+  epoll::Add(this, status);
+  if (!status.Ok()) {
+    StopListening();
+    return;
+  }
+}
+
+void Server::StopListening() {
+  Status ignore;
+  epoll::Del(this, ignore);
+  shutdown(fd, SHUT_RDWR);
+  fd.Close();
+  if (!path.empty()) {
+    unlink(path.c_str());
+    path.clear();
+  }
+}
+
+void Server::NotifyRead(Status &epoll_status) {
+  while (status.Ok() && fd != -1) {
+    FD conn_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn_fd == -1) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        // We have processed all incoming connections.
+        errno = 0;
+        break;
+      }
+      status() += "accept4()";
+      return;
+    }
+    NotifyAcceptedUDS(std::move(conn_fd));
+  }
+}
+
+const char *Server::Name() const { return "uds::Server"; }
+
+void Connection::Adopt(FD fd) {
+  this->fd = std::move(fd);
+  int so_type;
+  socklen_t so_type_len = sizeof(so_type);
+  if (getsockopt(this->fd, SOL_SOCKET, SO_TYPE, &so_type, &so_type_len) == 0) {
+    type = (Type)so_type;
+  }
+  epoll::Add(this, status);
+}
+
+void Connection::Connect(Config config) {
+  sockaddr_un addr;
+  socklen_t addrlen;
+  if (!MakeAddress(config.path, addr, addrlen, status)) {
+    return;
+  }
+
+  fd = socket(AF_UNIX, (int)config.type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    status() += "socket() failed";
+    return;
+  }
+  type = config.type;
+
+  if (int r = connect(fd, (sockaddr *)&addr, addrlen); r < 0) {
+    if (errno != EINPROGRESS) {
+      status() += "connect() failed";
+      return;
+    }
+    errno = 0;
+  }
+  epoll::Add(this, status);
+  if (!status.Ok()) {
+    status() += "epoll::Add()";
+    return;
+  }
+}
+
+Connection::~Connection() { Close(); }
+
+static void UpdateEpoll(Connection &c) {
+  bool current = c.notify_write;
+  bool desired = !c.outbox.empty();
+  if (current != desired) {
+    c.notify_write = desired;
+    epoll::Mod(&c, c.status);
+  }
+}
+
+void Connection::Send() {
+  if (fd < 0) {
+    return;
+  }
+  if (type == Type::kSeqPacket) {
+    Size queued = 0;
+    for (Size packet_size : outbox_packets) {
+      queued += packet_size;
+    }
+    if (outbox.size() > queued) {
+      outbox_packets.push_back(outbox.size() - queued);
+    }
+  }
+  if (outbox.empty()) {
+    return;
+  }
+  if (write_buffer_full) {
+    return;
+  }
+  while (!outbox.empty()) {
+    // Packets must keep their boundaries so each one gets its own `sendmsg`.
+    Size len = outbox.size();
+    if (type == Type::kSeqPacket) {
+      len = outbox_packets.front();
+    }
+    iovec iov = {.iov_base = outbox.data(), .iov_len = len};
+    msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    int n_fds = std::min<int>(outbox_fds.size(), kMaxFDs);
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFDs)];
+    if (n_fds) {
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+      int *fds = (int *)CMSG_DATA(cmsg);
+      for (int i = 0; i < n_fds; ++i) {
+        fds[i] = outbox_fds[i];
+      }
+    }
+    ssize_t count = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (count == -1) {
+      if (errno == EWOULDBLOCK || errno == EAGAIN) {
+        // We must wait for the data to be sent before writing more.
+        errno = 0;
+        write_buffer_full = true;
+        UpdateEpoll(*this);
+        return;
+      }
+      status() += "sendmsg()";
+      Close();
+      return;
+    }
+    // Kernel now holds its own references to the sent file descriptors.
+    outbox_fds.erase(outbox_fds.begin(), outbox_fds.begin() + n_fds);
+    outbox.erase(outbox.begin(), outbox.begin() + count);
+    if (type != Type::kSeqPacket) {
+      break;
+    }
+    // SEQPACKET sockets send whole packets or nothing.
+    outbox_packets.erase(outbox_packets.begin());
+  }
+  if (closing && outbox.empty()) {
+    Close();
+    return;
+  }
+  if (!outbox.empty()) {
+    // Kernel was unable to accept whole buffer - it's probably full.
+    write_buffer_full = true;
+  }
+
+  UpdateEpoll(*this);
+}
+
+void Connection::Close() {
+  if (IsClosed()) {
+    return;
+  }
+  epoll::Del(this, status);
+  shutdown(fd, SHUT_RDWR);
+  fd.Close();
+  NotifyClosed();
+}
+
+bool Connection::IsClosed() const { return fd == -1; }
+
+thread_local static U8 read_buffer[1024 * 1024];
+
+void Connection::NotifyRead(Status &epoll_status) {
+  iovec iov = {.iov_base = read_buffer, .iov_len = sizeof(read_buffer)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFDs)];
+  msghdr msg = {.msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control,
+                .msg_controllen = sizeof(control)};
+  ssize_t count = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (count == -1) {
+    if (errno == EWOULDBLOCK) {
+      // We must wait for more data to arrive to process this request.
+      errno = 0;
+      return;
+    }
+    // Connection is broken. Discard it.
+    status() += "recvmsg()";
+    Close();
+    return;
+  }
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      int *fds = (int *)CMSG_DATA(cmsg);
+      for (int i = 0; i < n; ++i) {
+        inbox_fds.emplace_back(fds[i]);
+      }
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    status() += "Received more file descriptors than expected";
+  }
+  if (count == 0) { // EOF
+    Close();
+    return;
+  }
+
+  inbox.insert(inbox.end(), read_buffer, read_buffer + count);
+  NotifyReceived();
+}
+
+void Connection::NotifyWrite(Status &epoll_status) {
+  write_buffer_full = false;
+  Send();
+}
+
+const char *Connection::Name() const { return "uds::Connection"; }
+
+void Pair(Connection &a, Connection &b, Type type, Status &status) {
+  int fds[2];
+  if (socketpair(AF_UNIX, (int)type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) <
+      0) {
+    status() += "socketpair() failed";
+    return;
+  }
+  a.Adopt(fds[0]);
+  b.Adopt(fds[1]);
+}
+
+} // namespace maf::uds
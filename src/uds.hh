@@ -0,0 +1,119 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include "epoll.hh"
+#include "str.hh"
+#include "stream.hh"
+#include "vec.hh"
+
+// Unix domain sockets.
+//
+// Named `uds` rather than `unix` because GNU C++ predefines the `unix` macro.
+namespace maf::uds {
+
+enum class Type {
+  kStream = SOCK_STREAM,
+  // Like kStream but each `Send` is delivered as a single packet and each
+  // received packet triggers a separate `NotifyReceived`.
+  kSeqPacket = SOCK_SEQPACKET,
+};
+
+struct Server : epoll::Listener {
+  Status status;
+
+  struct Config {
+    // Filesystem path of the socket. Paths starting with '@' are placed in the
+    // abstract namespace (see `man 7 unix`).
+    //
+    // A socket file left at `path` by a server that's gone (connecting to it
+    // is refused) is replaced. When `path` is a live socket or some other
+    // file, `Listen` fails with EADDRINUSE.
+    Str path;
+    Type type = Type::kStream;
+  };
+
+  // Path of the socket file - removed by `StopListening`.
+  Str path;
+
+  void Listen(Config);
+
+  void StopListening();
+
+  virtual void NotifyAcceptedUDS(FD) = 0;
+
+  /////////////////////////////////////
+  // epoll interface - not for users //
+  /////////////////////////////////////
+
+  void NotifyRead(Status &) override;
+
+  const char *Name() const override;
+};
+
+// Unix domain counterpart of `tcp::Connection`.
+//
+// Apart from bytes it can also transfer file descriptors (SCM_RIGHTS).
+struct Connection : epoll::Listener, Stream {
+  // Status of this connection.
+  Status status;
+
+  // Type of the socket - set by `Adopt`, `Connect` & `Pair`.
+  Type type = Type::kStream;
+
+  // Flag indicating whether kernel write buffer is full or not.
+  bool write_buffer_full = false;
+
+  // Flag indicating that when all of the data is written, this connection
+  // should be closed.
+  bool closing = false;
+
+  // File descriptors that should be sent along with the next `Send`. They're
+  // closed (on our side) once they're handed over to the kernel.
+  //
+  // Since file descriptors have to accompany regular data, `outbox` must not
+  // be empty when there are file descriptors to send.
+  Vec<FD> outbox_fds;
+
+  // Sizes of the packets waiting in `outbox` (only for `kSeqPacket`). Each
+  // `Send` appends the size of the bytes added to `outbox` since the previous
+  // one so that every packet is sent with a separate `sendmsg`, even when they
+  // had to wait for the kernel write buffer.
+  Vec<Size> outbox_packets;
+
+  // File descriptors received from the peer. Their ownership is passed to the
+  // user of this connection.
+  Vec<FD> inbox_fds;
+
+  struct Config {
+    Str path;
+    Type type = Type::kStream;
+  };
+
+  Connection() = default;
+  ~Connection();
+
+  void Adopt(FD);
+  void Connect(Config);
+
+  void Send() override;
+  void Close() override;
+
+  bool IsClosed() const;
+
+  /////////////////////////////////////
+  // epoll interface - not for users //
+  /////////////////////////////////////
+
+  void NotifyRead(Status &) override;
+  void NotifyWrite(Status &) override;
+
+  const char *Name() const override;
+
+  operator Status &() override { return status; }
+};
+
+// Connect two `Connection`s using `socketpair`.
+void Pair(Connection &a, Connection &b, Type, Status &);
+
+} // namespace maf::uds
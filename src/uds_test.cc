@@ -0,0 +1,224 @@
+#include "epoll.hh"
+#include "uds.hh"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gtest.hh"
+
+using namespace maf;
+
+TEST(UDSTest, SimpleExchange) {
+
+  struct ServerConnection : uds::Connection {
+    void NotifyReceived() override { Close(); }
+  };
+
+  struct ClientConnection : uds::Connection {
+    ClientConnection() {
+      Connect({.path = "@maf_uds_test"});
+      outbox.push_back(0x11);
+      Send();
+    }
+
+    void NotifyReceived() override { Close(); }
+  };
+
+  struct Server : uds::Server {
+    ServerConnection connection;
+    void NotifyAcceptedUDS(FD fd) override {
+      connection.Adopt(std::move(fd));
+      connection.outbox.push_back(0x22);
+      connection.Send();
+      StopListening();
+    }
+  };
+
+  epoll::Init();
+  Server server;
+  server.Listen({.path = "@maf_uds_test"});
+  ClientConnection client_connection;
+
+  Status status;
+  epoll::Loop(status);
+
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_TRUE(server.status.Ok()) << server.status.ToStr();
+  EXPECT_TRUE(server.connection.status.Ok())
+      << server.connection.status.ToStr();
+  EXPECT_TRUE(client_connection.status.Ok())
+      << client_connection.status.ToStr();
+
+  EXPECT_EQ(server.connection.inbox, Vec<char>{0x11});
+  EXPECT_EQ(client_connection.inbox, Vec<char>{0x22});
+}
+
+TEST(UDSTest, SeqPacketBoundaries) {
+  struct Receiver : uds::Connection {
+    Vec<Vec<>> packets;
+    void NotifyReceived() override {
+      packets.push_back(inbox);
+      inbox.clear();
+      if (packets.size() == 2) {
+        Close();
+      }
+    }
+  };
+
+  struct Sender : uds::Connection {
+    void NotifyReceived() override {}
+  };
+
+  epoll::Init();
+  Sender sender;
+  Receiver receiver;
+  Status status;
+  uds::Pair(sender, receiver, uds::Type::kSeqPacket, status);
+  ASSERT_TRUE(status.Ok()) << status.ToStr();
+
+  sender.outbox.insert(sender.outbox.end(), {1, 2, 3});
+  sender.Send();
+  sender.outbox.insert(sender.outbox.end(), {4, 5});
+  sender.Send();
+
+  epoll::Loop(status);
+  sender.Close();
+
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  ASSERT_EQ(receiver.packets.size(), 2);
+  EXPECT_EQ(receiver.packets[0], (Vec<>{1, 2, 3}));
+  EXPECT_EQ(receiver.packets[1], (Vec<>{4, 5}));
+}
+
+TEST(UDSTest, SeqPacketBoundariesWhenBufferFull) {
+  struct Receiver : uds::Connection {
+    Vec<Vec<>> packets;
+    Size expected = 0;
+    void NotifyReceived() override {
+      packets.push_back(inbox);
+      inbox.clear();
+      if (packets.size() == expected) {
+        Close();
+      }
+    }
+  };
+
+  struct Sender : uds::Connection {
+    void NotifyReceived() override {}
+  };
+
+  epoll::Init();
+  Sender sender;
+  Receiver receiver;
+  Status status;
+  uds::Pair(sender, receiver, uds::Type::kSeqPacket, status);
+  ASSERT_TRUE(status.Ok()) << status.ToStr();
+
+  // Fill the kernel buffer so that the following packets have to wait in the
+  // outbox.
+  Vec<Size> sizes;
+  while (!sender.write_buffer_full) {
+    sizes.push_back(1000);
+    sender.outbox.insert(sender.outbox.end(), 1000, (char)sizes.size());
+    sender.Send();
+  }
+  for (Size size : {10, 20, 30}) {
+    sizes.push_back(size);
+    sender.outbox.insert(sender.outbox.end(), size, (char)sizes.size());
+    sender.Send();
+  }
+  receiver.expected = sizes.size();
+
+  epoll::Loop(status);
+  sender.Close();
+
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_TRUE(sender.status.Ok()) << sender.status.ToStr();
+  EXPECT_TRUE(receiver.status.Ok()) << receiver.status.ToStr();
+  ASSERT_EQ(receiver.packets.size(), sizes.size());
+  for (Size i = 0; i < sizes.size(); ++i) {
+    EXPECT_EQ(receiver.packets[i], Vec<>(sizes[i], (char)(i + 1))) << i;
+  }
+}
+
+TEST(UDSTest, PassFileDescriptor) {
+  struct Receiver : uds::Connection {
+    void NotifyReceived() override { Close(); }
+  };
+
+  struct Sender : uds::Connection {
+    void NotifyReceived() override {}
+  };
+
+  epoll::Init();
+  Sender sender;
+  Receiver receiver;
+  Status status;
+  uds::Pair(sender, receiver, uds::Type::kStream, status);
+  ASSERT_TRUE(status.Ok()) << status.ToStr();
+
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  FD pipe_read(pipe_fds[0]), pipe_write(pipe_fds[1]);
+
+  sender.outbox_fds.emplace_back(std::move(pipe_read));
+  sender.outbox.push_back('x');
+  sender.Send();
+  EXPECT_TRUE(sender.outbox_fds.empty());
+
+  epoll::Loop(status);
+  sender.Close();
+  EXPECT_TRUE(status.Ok()) << status.ToStr();
+  EXPECT_TRUE(receiver.status.Ok()) << receiver.status.ToStr();
+  EXPECT_EQ(receiver.inbox, Vec<>{'x'});
+  ASSERT_EQ(receiver.inbox_fds.size(), 1);
+
+  ASSERT_EQ(write(pipe_write, "hi", 2), 2);
+  char buf[2];
+  ASSERT_EQ(read(receiver.inbox_fds[0], buf, 2), 2);
+  EXPECT_EQ(StrView(buf, 2), "hi");
+}
+
+TEST(UDSTest, ListenReplacesOnlyStaleSockets) {
+  struct Server : uds::Server {
+    void NotifyAcceptedUDS(FD fd) override {}
+  };
+
+  Str path = "/tmp/maf_uds_test_" + std::to_string(getpid());
+  struct stat st;
+
+  // Regular files are left alone.
+  FD file = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+  ASSERT_GE(file, 0);
+  file.Close();
+  epoll::Init();
+  Server not_a_socket;
+  not_a_socket.Listen({.path = path});
+  EXPECT_FALSE(not_a_socket.status.Ok());
+  ASSERT_EQ(lstat(path.c_str(), &st), 0);
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+  unlink(path.c_str());
+
+  // Socket file of a server that's gone.
+  sockaddr_un addr = {.sun_family = AF_UNIX};
+  memcpy(addr.sun_path, path.data(), path.size());
+  FD stale = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ASSERT_EQ(bind(stale, (sockaddr *)&addr, sizeof(addr)), 0);
+  stale.Close();
+  Server server;
+  server.Listen({.path = path});
+  EXPECT_TRUE(server.status.Ok()) << server.status.ToStr();
+
+  // Live socket of `server`.
+  Server second;
+  second.Listen({.path = path});
+  EXPECT_FALSE(second.status.Ok());
+  FD client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  EXPECT_EQ(connect(client, (sockaddr *)&addr, sizeof(addr)), 0);
+
+  server.StopListening();
+  EXPECT_NE(lstat(path.c_str(), &st), 0);
+}
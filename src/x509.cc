@@ -0,0 +1,390 @@
+#include "x509.hh"
+
+#include <cstring>
+
+#include "der.hh"
+#include "format.hh"
+#include "fs.hh"
+#include "hex.hh"
+#include "pem.hh"
+#include "sha.hh"
+
+namespace maf::x509 {
+
+// Object identifiers (contents of their DER elements).
+static const auto kOID_Ed25519 = HexArr("2b6570"); // 1.3.101.112
+static const auto kOID_RSA = HexArr("2a864886f70d010101");
+static const auto kOID_RSA_SHA256 = HexArr("2a864886f70d01010b");
+static const auto kOID_RSA_SHA512 = HexArr("2a864886f70d01010d");
+static const auto kOID_KeyUsage = HexArr("551d0f");         // 2.5.29.15
+static const auto kOID_SubjectAltName = HexArr("551d11");   // 2.5.29.17
+static const auto kOID_BasicConstraints = HexArr("551d13"); // 2.5.29.19
+static const auto kOID_ExtKeyUsage = HexArr("551d25");      // 2.5.29.37
+
+template <Size N> static bool IsOID(Span<> oid, const Arr<char, N> &expected) {
+  return oid.size() == N && memcmp(oid.data(), expected.data(), N) == 0;
+}
+
+// Parse UTCTime ("YYMMDDHHMMSSZ") or GeneralizedTime ("YYYYMMDDHHMMSSZ").
+static Clock::time_point ReadTime(Span<> &in, Status &status) {
+  der::Element element = der::Read(in, status);
+  if (!OK(status)) {
+    return {};
+  }
+  StrView text(element.contents.data(), element.contents.size());
+  Size year_digits = element.tag == der::kUTCTime          ? 2
+                     : element.tag == der::kGeneralizedTime ? 4
+                                                            : 0;
+  if (year_digits == 0 || text.size() != year_digits + 11 ||
+      text.back() != 'Z') {
+    AppendErrorMessage(status) += "Unsupported certificate time format";
+    return {};
+  }
+  Size pos = 0;
+  auto Number = [&](Size digits) {
+    int value = 0;
+    for (Size i = 0; i < digits; ++i) {
+      char c = text[pos++];
+      if (c < '0' || c > '9') {
+        AppendErrorMessage(status) += "Invalid digit in certificate time";
+        return 0;
+      }
+      value = value * 10 + (c - '0');
+    }
+    return value;
+  };
+  int year = Number(year_digits);
+  if (year_digits == 2) {
+    year += year < 50 ? 2000 : 1900; // RFC 5280, section 4.1.2.5.1
+  }
+  int month = Number(2);
+  int day = Number(2);
+  int hour = Number(2);
+  int minute = Number(2);
+  int second = Number(2);
+  if (!OK(status)) {
+    return {};
+  }
+  using namespace std::chrono;
+  year_month_day date{std::chrono::year(year), std::chrono::month(month),
+                      std::chrono::day(day)};
+  if (!date.ok() || hour > 23 || minute > 59 || second > 60) {
+    AppendErrorMessage(status) += "Invalid certificate time";
+    return {};
+  }
+  return sys_days(date) + hours(hour) + minutes(minute) + seconds(second);
+}
+
+static PublicKey ReadPublicKey(Span<> &in, Status &status) {
+  PublicKey key;
+  Span<> key_info = der::Read(in, der::kSequence, status);
+  Span<> algorithm = der::Read(key_info, der::kSequence, status);
+  Span<> oid = der::Read(algorithm, der::kObjectIdentifier, status);
+  Span<> key_bytes = der::ReadBitStringBytes(key_info, status);
+  if (!OK(status)) {
+    return key;
+  }
+  if (IsOID(oid, kOID_Ed25519)) {
+    if (key_bytes.size() != 32) {
+      AppendErrorMessage(status) += "Invalid Ed25519 public key";
+      return key;
+    }
+    key.algorithm = PublicKey::Algorithm::kEd25519;
+    memcpy(key.ed25519.bytes.data(), key_bytes.data(), 32);
+  } else if (IsOID(oid, kOID_RSA)) {
+    key.rsa = rsa::Public::FromDER(key_bytes, status);
+    key.algorithm = PublicKey::Algorithm::kRSA;
+  }
+  return key;
+}
+
+static SignatureAlgorithm ReadSignatureAlgorithm(Span<> algorithm,
+                                                 Status &status) {
+  Span<> oid = der::Read(algorithm, der::kObjectIdentifier, status);
+  if (IsOID(oid, kOID_Ed25519)) {
+    return SignatureAlgorithm::kEd25519;
+  } else if (IsOID(oid, kOID_RSA_SHA256)) {
+    return SignatureAlgorithm::kRSA_PKCS1_SHA256;
+  } else if (IsOID(oid, kOID_RSA_SHA512)) {
+    return SignatureAlgorithm::kRSA_PKCS1_SHA512;
+  }
+  return SignatureAlgorithm::kUnsupported;
+}
+
+static void ReadExtensions(Span<> extensions, Certificate &certificate,
+                           Status &status) {
+  Span<> list = der::Read(extensions, der::kSequence, status);
+  while (!list.empty() && OK(status)) {
+    Span<> extension = der::Read(list, der::kSequence, status);
+    Span<> oid = der::Read(extension, der::kObjectIdentifier, status);
+    bool critical = false;
+    if (der::Peek(extension, der::kBoolean)) {
+      Span<> value = der::Read(extension, der::kBoolean, status);
+      critical = value.size() == 1 && value[0] != 0;
+    }
+    Span<> value = der::Read(extension, der::kOctetString, status);
+    if (!OK(status)) {
+      return;
+    }
+    if (IsOID(oid, kOID_BasicConstraints)) {
+      Span<> constraints = der::Read(value, der::kSequence, status);
+      if (der::Peek(constraints, der::kBoolean)) {
+        Span<> ca = der::Read(constraints, der::kBoolean, status);
+        certificate.is_ca = ca.size() == 1 && ca[0] != 0;
+      }
+    } else if (IsOID(oid, kOID_SubjectAltName)) {
+      Span<> names = der::Read(value, der::kSequence, status);
+      while (!names.empty() && OK(status)) {
+        der::Element name = der::Read(names, status);
+        if (name.tag == der::Implicit(2)) { // dNSName
+          certificate.dns_names.push_back(
+              StrView(name.contents.data(), name.contents.size()));
+        }
+      }
+    } else if (IsOID(oid, kOID_KeyUsage) || IsOID(oid, kOID_ExtKeyUsage)) {
+      // Not enforced.
+    } else if (critical) {
+      AppendErrorMessage(status) +=
+          "Unsupported critical certificate extension " + BytesToHex(oid);
+      return;
+    }
+  }
+}
+
+Certificate Certificate::Parse(Span<> der, Status &status) {
+  Certificate certificate;
+  certificate.der = der;
+  Span<> rest = der;
+  Span<> outer = der::Read(rest, der::kSequence, status);
+  der::Element tbs = der::Read(outer, status);
+  Span<> signature_algorithm = der::Read(outer, der::kSequence, status);
+  certificate.signature = der::ReadBitStringBytes(outer, status);
+  if (OK(status) && (tbs.tag != der::kSequence || !rest.empty())) {
+    AppendErrorMessage(status) += "Unexpected certificate structure";
+  }
+  certificate.tbs = tbs.encoded;
+
+  Span<> fields = tbs.contents;
+  if (der::Peek(fields, der::Explicit(0))) {
+    der::Read(fields, status); // version
+  }
+  der::Read(fields, der::kInteger, status); // serial number
+  Span<> inner_signature_algorithm = der::Read(fields, der::kSequence, status);
+  certificate.issuer = der::Read(fields, status).encoded;
+  Span<> validity = der::Read(fields, der::kSequence, status);
+  certificate.not_before = ReadTime(validity, status);
+  certificate.not_after = ReadTime(validity, status);
+  certificate.subject = der::Read(fields, status).encoded;
+  certificate.public_key = ReadPublicKey(fields, status);
+  for (U8 unique_id : {der::Implicit(1), der::Implicit(2)}) {
+    if (der::Peek(fields, unique_id)) {
+      der::Read(fields, status);
+    }
+  }
+  if (der::Peek(fields, der::Explicit(3))) {
+    ReadExtensions(der::Read(fields, der::Explicit(3), status), certificate,
+                   status);
+  }
+  if (!OK(status)) {
+    AppendErrorMessage(status) += "Invalid certificate";
+    return certificate;
+  }
+  if (Span<>(inner_signature_algorithm) != signature_algorithm) {
+    AppendErrorMessage(status) += "Certificate signature algorithms differ";
+    return certificate;
+  }
+  certificate.signature_algorithm =
+      ReadSignatureAlgorithm(signature_algorithm, status);
+  return certificate;
+}
+
+bool Certificate::SignedBy(const PublicKey &issuer_key) const {
+  switch (signature_algorithm) {
+  case SignatureAlgorithm::kEd25519: {
+    if (issuer_key.algorithm != PublicKey::Algorithm::kEd25519 ||
+        signature.size() != 64) {
+      return false;
+    }
+    ed25519::Signature ed25519_signature;
+    memcpy(ed25519_signature.bytes.data(), signature.data(), 64);
+    return ed25519_signature.Verify(tbs, issuer_key.ed25519);
+  }
+  case SignatureAlgorithm::kRSA_PKCS1_SHA256:
+    return issuer_key.algorithm == PublicKey::Algorithm::kRSA &&
+           rsa::VerifyPKCS1_SHA256(issuer_key.rsa, tbs, signature);
+  case SignatureAlgorithm::kRSA_PKCS1_SHA512:
+    return issuer_key.algorithm == PublicKey::Algorithm::kRSA &&
+           rsa::VerifyPKCS1_SHA512(issuer_key.rsa, tbs, signature);
+  default:
+    return false;
+  }
+}
+
+static bool EqualsIgnoreCase(StrView a, StrView b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (Size i = 0; i < a.size(); ++i) {
+    if (tolower((U8)a[i]) != tolower((U8)b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Certificate::MatchesName(StrView server_name) const {
+  for (StrView name : dns_names) {
+    if (EqualsIgnoreCase(name, server_name)) {
+      return true;
+    }
+    if (name.starts_with("*.")) {
+      Size dot = server_name.find('.');
+      if (dot != 0 && dot != StrView::npos &&
+          EqualsIgnoreCase(name.substr(1), server_name.substr(dot))) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void TrustStore::Add(Vec<> der, Status &status) {
+  Root &root = roots.emplace_back();
+  root.der = std::move(der);
+  root.certificate = Certificate::Parse(root.der, status);
+  if (!OK(status)) {
+    roots.pop_back();
+  }
+}
+
+void TrustStore::LoadPEM(StrView pem, Status &status) {
+  for (auto &block : pem::Decode(pem, status)) {
+    if (block.label == "CERTIFICATE" && OK(status)) {
+      Add(std::move(block.der), status);
+    }
+  }
+  if (!OK(status)) {
+    AppendErrorMessage(status) += "Couldn't load trusted certificates";
+  }
+}
+
+void TrustStore::LoadFile(const char *path, Status &status) {
+  Str error;
+  Str pem = ReadFile(path, error);
+  if (!error.empty()) {
+    AppendErrorMessage(status) +=
+        f("Couldn't read %s: %s", path, error.c_str());
+    return;
+  }
+  LoadPEM(pem, status);
+}
+
+void TrustStore::LoadSystem(Status &status) {
+  LoadFile("/etc/ssl/certs/ca-certificates.crt", status);
+}
+
+VerifiedChain VerifyChain(Span<Span<>> chain, StrView server_name,
+                          const TrustStore &trust_store, Clock::time_point now,
+                          Status &status) {
+  VerifiedChain result;
+  if (chain.empty()) {
+    AppendErrorMessage(status) += "Empty certificate chain";
+    return result;
+  }
+  Vec<Certificate> certificates;
+  for (Span<> der : chain) {
+    certificates.push_back(Certificate::Parse(der, status));
+    if (!OK(status)) {
+      return result;
+    }
+  }
+  Certificate &leaf = certificates[0];
+  if (!leaf.MatchesName(server_name)) {
+    AppendErrorMessage(status) +=
+        f("Certificate is not valid for \"%.*s\"", (int)server_name.size(),
+          server_name.data());
+    return result;
+  }
+  result.leaf_key = leaf.public_key;
+  result.not_before = Clock::time_point::min();
+  result.not_after = Clock::time_point::max();
+  auto Narrow = [&](const Certificate &certificate) {
+    result.not_before = std::max(result.not_before, certificate.not_before);
+    result.not_after = std::min(result.not_after, certificate.not_after);
+  };
+
+  // Walk from the leaf towards a root, picking the issuer of each certificate
+  // from the chain. Each certificate is used at most once.
+  Vec<bool> used(certificates.size(), false);
+  Size current = 0;
+  while (true) {
+    Certificate &certificate = certificates[current];
+    used[current] = true;
+    if (!certificate.ValidAt(now)) {
+      AppendErrorMessage(status) +=
+          "Certificate has expired (or isn't valid yet)";
+      return result;
+    }
+    Narrow(certificate);
+    for (auto &root : trust_store.roots) {
+      if (root.certificate.subject == certificate.issuer &&
+          root.certificate.ValidAt(now) &&
+          certificate.SignedBy(root.certificate.public_key)) {
+        Narrow(root.certificate);
+        return result;
+      }
+    }
+    Size next = current;
+    for (Size i = 0; i < certificates.size(); ++i) {
+      Certificate &issuer = certificates[i];
+      if (!used[i] && issuer.is_ca && issuer.subject == certificate.issuer &&
+          certificate.SignedBy(issuer.public_key)) {
+        next = i;
+        break;
+      }
+    }
+    if (next == current) {
+      AppendErrorMessage(status) +=
+          "Certificate chain doesn't lead to a trusted root";
+      return result;
+    }
+    current = next;
+  }
+}
+
+VerifiedChain ChainCache::Verify(Span<Span<>> chain, StrView server_name,
+                                 const TrustStore &trust_store,
+                                 Clock::time_point now, Status &status) {
+  if (chain.empty()) {
+    return VerifyChain(chain, server_name, trust_store, now, status);
+  }
+  SHA256 leaf_hash(chain[0]);
+  Str key(leaf_hash.bytes, sizeof(leaf_hash.bytes));
+  if (auto it = entries.find(key); it != entries.end()) {
+    Entry &entry = it->second;
+    if (entry.server_name == server_name && entry.trust_store == &trust_store &&
+        entry.chain.not_before <= now && now <= entry.chain.not_after) {
+      ++hits;
+      return entry.chain;
+    }
+  }
+  ++misses;
+  VerifiedChain verified =
+      VerifyChain(chain, server_name, trust_store, now, status);
+  if (!OK(status)) {
+    return verified;
+  }
+  if (entries.size() >= capacity && !entries.contains(key)) {
+    entries.erase(entries.begin());
+  }
+  entries[key] = Entry{Str(server_name), &trust_store, verified};
+  return verified;
+}
+
+void ChainCache::Clear() {
+  entries.clear();
+  hits = 0;
+  misses = 0;
+}
+
+} // namespace maf::x509
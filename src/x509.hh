@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+
+#include "ed25519.hh"
+#include "rsa.hh"
+#include "span.hh"
+#include "status.hh"
+#include "str.hh"
+#include "vec.hh"
+
+// X.509 certificates (RFC 5280) - parsing & verification of the chains sent by
+// TLS servers.
+//
+// Keys can be Ed25519 or RSA. Signatures can be Ed25519 or RSASSA-PKCS1-v1_5
+// with SHA-256 or SHA-512 - certificates signed with anything else (ECDSA,
+// RSA-PSS, SHA-384) don't verify. Revocation (CRL, OCSP), name constraints,
+// path length limits & key usages aren't checked.
+namespace maf::x509 {
+
+// Certificate validity is in UTC.
+using Clock = std::chrono::system_clock;
+
+struct PublicKey {
+  enum class Algorithm { kUnsupported, kEd25519, kRSA };
+  Algorithm algorithm = Algorithm::kUnsupported;
+  ed25519::Public ed25519;
+  rsa::Public rsa;
+};
+
+enum class SignatureAlgorithm {
+  kUnsupported,
+  kEd25519,
+  kRSA_PKCS1_SHA256,
+  kRSA_PKCS1_SHA512,
+};
+
+// Parsed certificate. Views point into the DER buffer that it was parsed from.
+struct Certificate {
+  Span<> der;
+
+  // The signed part ("TBSCertificate").
+  Span<> tbs;
+
+  // DER-encoded names. Issuers are matched to subjects byte for byte.
+  Span<> issuer;
+  Span<> subject;
+
+  Clock::time_point not_before;
+  Clock::time_point not_after;
+
+  PublicKey public_key;
+
+  SignatureAlgorithm signature_algorithm = SignatureAlgorithm::kUnsupported;
+  Span<> signature;
+
+  // Whether the certificate can sign other certificates (basic constraints).
+  bool is_ca = false;
+
+  // DNS names from the subject alternative name extension.
+  Vec<StrView> dns_names;
+
+  // Fails only on malformed certificates. Unsupported algorithms are reported
+  // as `kUnsupported`.
+  static Certificate Parse(Span<> der, Status &);
+
+  // Whether `signature` was made by `issuer_key`.
+  bool SignedBy(const PublicKey &issuer_key) const;
+
+  // Whether `server_name` matches one of the `dns_names`, ignoring case. A
+  // wildcard ("*.example.com") matches a single label.
+  bool MatchesName(StrView server_name) const;
+
+  bool ValidAt(Clock::time_point now) const {
+    return not_before <= now && now <= not_after;
+  }
+};
+
+// Root certificates trusted to sign server certificates.
+struct TrustStore {
+  struct Root {
+    Vec<> der;
+    Certificate certificate; // views into `der`
+  };
+  Vec<Root> roots;
+
+  void Add(Vec<> der, Status &);
+
+  // Add all of the "CERTIFICATE" blocks.
+  void LoadPEM(StrView pem, Status &);
+
+  void LoadFile(const char *path, Status &);
+
+  // Load the bundle of the operating system (ca-certificates).
+  void LoadSystem(Status &);
+};
+
+struct VerifiedChain {
+  PublicKey leaf_key;
+
+  // Intersection of the validity periods of the certificates in the chain
+  // (including the root).
+  Clock::time_point not_before;
+  Clock::time_point not_after;
+};
+
+// Verifies that `chain` (DER certificates, leaf first - as sent by a TLS
+// server) is valid at `now` & leads from a certificate for `server_name` to
+// one of the `trust_store` roots. Certificates that aren't needed for the path
+// are ignored.
+VerifiedChain VerifyChain(Span<Span<>> chain, StrView server_name,
+                          const TrustStore &, Clock::time_point now, Status &);
+
+// Cache of verified chains, keyed by the SHA-256 of the leaf certificate.
+//
+// Verifying a chain takes a few signature checks (milliseconds with RSA). A
+// cache hit costs one hash & a lookup. Entries remember the server name &
+// trust store that they were verified for & are only used within the validity
+// period of the whole chain. Failures aren't cached.
+struct ChainCache {
+  // Maximum number of entries. When full, an arbitrary entry is evicted.
+  Size capacity = 1024;
+
+  // Number of `Verify` calls answered from the cache & verified from scratch.
+  Size hits = 0;
+  Size misses = 0;
+
+  // Same as `VerifyChain`, but uses (& fills) the cache.
+  VerifiedChain Verify(Span<Span<>> chain, StrView server_name,
+                       const TrustStore &, Clock::time_point now, Status &);
+
+  void Clear();
+
+  struct Entry {
+    Str server_name;
+    const TrustStore *trust_store;
+    VerifiedChain chain;
+  };
+  // Keyed by the SHA-256 of the leaf.
+  std::unordered_map<Str, Entry> entries;
+};
+
+} // namespace maf::x509
@@ -0,0 +1,101 @@
+#pragma maf main
+
+// Benchmark of `x509::VerifyChain` & `x509::ChainCache`.
+//
+// Usage: x509_bench <chain.pem> <server_name> [roots.pem]
+//
+// `chain.pem` holds the certificates sent by the server (leaf first). Without
+// `roots.pem`, the roots of the operating system are used. A chain can be
+// saved with:
+//
+//   openssl s_client -connect example.com:443 -showcerts < /dev/null
+//
+// Measures the verification of the chain from scratch ("cold") & when the
+// cache already holds it ("warm" - what repeated handshakes with the same
+// server cost). Results are printed as JSON Lines (see bench.hh).
+
+#include <cstdlib>
+
+#include "bench.hh"
+#include "fs.hh"
+#include "log.hh"
+#include "pem.hh"
+#include "x509.hh"
+
+using namespace maf;
+using bench::Clock;
+
+namespace {
+
+Vec<Vec<>> certificates;
+Vec<Span<>> chain;
+Str server_name;
+x509::TrustStore trust_store;
+
+void BenchVerify(bool warm, Size iterations) {
+  x509::ChainCache cache;
+  bench::Samples verify_us;
+  auto now = x509::Clock::now();
+  Status status;
+  if (warm) {
+    cache.Verify(chain, server_name, trust_store, now, status);
+  }
+  for (Size i = 0; i < iterations && OK(status); ++i) {
+    if (!warm) {
+      cache.Clear();
+    }
+    auto start = Clock::now();
+    cache.Verify(chain, server_name, trust_store, now, status);
+    verify_us.Add(bench::Microseconds(Clock::now() - start));
+  }
+  if (!OK(status)) {
+    FATAL << "Chain didn't verify: " << status;
+  }
+  bench::Report("x509_verify_chain")
+      .Set("cache", warm ? "warm" : "cold")
+      .Set("certificates", chain.size())
+      .Set("iterations", iterations)
+      .Set("cache_hits", cache.hits)
+      .SetPercentiles("verify_us", verify_us);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    ERROR << "Usage: " << argv[0] << " <chain.pem> <server_name> [roots.pem]";
+    return 1;
+  }
+  Status status;
+  Str error;
+  Str chain_pem = ReadFile(argv[1], error);
+  if (!error.empty()) {
+    FATAL << "Couldn't read " << argv[1] << ": " << error;
+  }
+  for (auto &block : pem::Decode(chain_pem, status)) {
+    if (block.label == "CERTIFICATE") {
+      certificates.push_back(std::move(block.der));
+    }
+  }
+  for (auto &der : certificates) {
+    chain.push_back(der);
+  }
+  server_name = argv[2];
+
+  auto load_start = Clock::now();
+  if (argc > 3) {
+    trust_store.LoadFile(argv[3], status);
+  } else {
+    trust_store.LoadSystem(status);
+  }
+  if (!OK(status)) {
+    FATAL << status;
+  }
+  bench::Report("x509_load_trust_store")
+      .Set("roots", trust_store.roots.size())
+      .Set("load_ms", bench::Microseconds(Clock::now() - load_start) / 1000);
+
+  BenchVerify(false, 1000);
+  BenchVerify(true, 100000);
+  return 0;
+}
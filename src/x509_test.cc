@@ -0,0 +1,208 @@
+#include "x509.hh"
+
+#include "gtest.hh"
+#include "pem.hh"
+
+using namespace maf;
+using namespace std::chrono;
+
+// Test chain generated with OpenSSL.
+
+// RSA 2048 root - "maf Test Root".
+static constexpr StrView kRootPEM =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIIDHjCCAgagAwIBAgIUGjzOypH1T0OwT1g2qWJnIIxJmSowDQYJKoZIhvcNAQEL\n"
+    "BQAwJjEMMAoGA1UECgwDbWFmMRYwFAYDVQQDDA1tYWYgVGVzdCBSb290MCAXDTI2\n"
+    "MTAxOTAyMTkwOFoYDzIxMjYwOTI1MDIxOTA4WjAmMQwwCgYDVQQKDANtYWYxFjAU\n"
+    "BgNVBAMMDW1hZiBUZXN0IFJvb3QwggEiMA0GCSqGSIb3DQEBAQUAA4IBDwAwggEK\n"
+    "AoIBAQDEf2AXepmLJWrhQLBIzTdZYX9JAVDB92MbR1HACVrHIWlSfaQKsOwT/J0o\n"
+    "5CshdKnQp10CC2hy4MCUWFbYd9PppQei28jiB/beuPw1zTpyO4MZhWmUENPNjkwW\n"
+    "i9xg/5q2kFCwpcqdcDULZ5+QDf8LVOzVD4iz2i3WJ1dy6cLM7xpte7Nts5LKkBpJ\n"
+    "rQmI9eyF/lBCBeoeuLbcSugVfimHMbHWdlH2Ibe1M6WyCt9AMIcNHuas2g3jxuW2\n"
+    "EWGY6+T4VETuMOrcSGuFHatVpyOlJ09SrpFZgUYigpGWpaSZFiU6RGsrHzt1L89Z\n"
+    "YKDscj55yxIlMtmFIgE6BHTd5rxFAgMBAAGjQjBAMA8GA1UdEwEB/wQFMAMBAf8w\n"
+    "DgYDVR0PAQH/BAQDAgEGMB0GA1UdDgQWBBQ3SJV7sqzCGeKJI6Q3luiHiicFWDAN\n"
+    "BgkqhkiG9w0BAQsFAAOCAQEAeAih3kZIqxZeeYbVpu3OlWPg404JQRRppyPU5tFK\n"
+    "lCL21zxgINih4J2NdSynArT2W1BdYCDcy4G4NHMNhqJo2eJFLyu/WJ+aDw0VA7D7\n"
+    "/P6gnWzSyqDq6N1AsPm4jRTzKtfaTNl6j0XfYGwEB9waDbNpYHNByiUsFh3Y4Sxj\n"
+    "FYW78TpEnJ3uPlQSeqjyqB7jeUcBRDtVP3dClAZZ7haY0IZmM16RzzjlChoKFcWc\n"
+    "0a09e2R6bE0qd9hHQqRXFn8deP/VG2Zobmd0MTqJ4JoowhSGhweJFbzv0skpL/Sz\n"
+    "J1lvBFLTI77p7zgXYLh9In7q+3UI+I2oUhHWxj0Sgb/xmg==\n"
+    "-----END CERTIFICATE-----\n";
+
+// RSA 2048 intermediate, signed by the root.
+static constexpr StrView kIntermediatePEM =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIIDSjCCAjKgAwIBAgIUCMVjZoq/TlpdBlKLCUe8uZ3rEYowDQYJKoZIhvcNAQEL\n"
+    "BQAwJjEMMAoGA1UECgwDbWFmMRYwFAYDVQQDDA1tYWYgVGVzdCBSb290MCAXDTI2\n"
+    "MTAxOTAyMTkwOFoYDzIxMjYwOTI1MDIxOTA4WjAuMQwwCgYDVQQKDANtYWYxHjAc\n"
+    "BgNVBAMMFW1hZiBUZXN0IEludGVybWVkaWF0ZTCCASIwDQYJKoZIhvcNAQEBBQAD\n"
+    "ggEPADCCAQoCggEBAJcunhYt+V882OEOv8VIqPoICLlduSIAT4q0SvgAoq1TpmMC\n"
+    "QTiJMvCHLzut8KN3w8XuupWbJd8R0xzwjjaBPA+uKySrGj50krArR5mW6+a04R2g\n"
+    "mP5cXnCa3yms7gzkhlvr/uemC+3xvrHOGyDypTQH0kCnX2MeIORasadjw7daHLiN\n"
+    "dRro4W1bhm2Wir5HpK5kXDr0p7pJ1x5SVLGHjb10cJB+tJR7bF6lFnfG8sULlyvK\n"
+    "oHrgxRhbCSVZmukbgCVPbCmp61xTRmvKuCQhGg3uvdNurZAQhdTpjqKU+Y0PsaZq\n"
+    "iVOTooy2tL2KqaeFhAvRiZtd3b88qX7Fj67EKIkCAwEAAaNmMGQwEgYDVR0TAQH/\n"
+    "BAgwBgEB/wIBADAOBgNVHQ8BAf8EBAMCAQYwHQYDVR0OBBYEFCSqx0FwH0hA5Rjs\n"
+    "Ats46Q7MOrMPMB8GA1UdIwQYMBaAFDdIlXuyrMIZ4okjpDeW6IeKJwVYMA0GCSqG\n"
+    "SIb3DQEBCwUAA4IBAQA+bGATuVE2YkJuBLv4SQPcqoI/qr1uySiRnEfVP/mxQ98q\n"
+    "nsscwOTGd4w0PGBLNrAq4KO1gSNk8+xgi8WKuEo08ZvaTpywymsP4sFAp6EBXk4T\n"
+    "j0XznCQMTCPPkUER5YVfxek98+kN13xr5lGOfAwqHXfpTEpU5d0sjvlmkI+wQt/p\n"
+    "rsUw6vsTceroDYLqGNOdBLslM9NqiQcBYQz76iXf+YNznKFcGirMmaqikoWm09UY\n"
+    "NQRsaKqKhSJBpHi2nYBS2teza38LkyTkdlS3jgeSgf/h/huM/u+HjU5uEoJUqcO2\n"
+    "IWFknf1uhyQ22fEJpVOTBX89j/nYY8nBNZg2TUGB\n"
+    "-----END CERTIFICATE-----\n";
+
+// Ed25519 leaf for "localhost" & "*.example.com", signed by the intermediate
+// with SHA-256.
+static constexpr StrView kLeafPEM =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIICdDCCAVygAwIBAgIUZzDwutl9TPZc1TkpWcVuTWnA2RUwDQYJKoZIhvcNAQEL\n"
+    "BQAwLjEMMAoGA1UECgwDbWFmMR4wHAYDVQQDDBVtYWYgVGVzdCBJbnRlcm1lZGlh\n"
+    "dGUwIBcNMjYxMDE5MDIxOTA4WhgPMjEyNjA5MjUwMjE5MDhaMBQxEjAQBgNVBAMM\n"
+    "CWxvY2FsaG9zdDAqMAUGAytlcAMhAEYwIE1/RTBcGz4e3xASnNQ5wqPB0j2zfWUA\n"
+    "CikS8bV9o4GbMIGYMAwGA1UdEwEB/wQCMAAwDgYDVR0PAQH/BAQDAgeAMBMGA1Ud\n"
+    "JQQMMAoGCCsGAQUFBwMBMCMGA1UdEQQcMBqCCWxvY2FsaG9zdIINKi5leGFtcGxl\n"
+    "LmNvbTAdBgNVHQ4EFgQUTgJi24Q00tU/kH+vp59gY6avXVUwHwYDVR0jBBgwFoAU\n"
+    "JKrHQXAfSEDlGOwC2zjpDsw6sw8wDQYJKoZIhvcNAQELBQADggEBAEVvklIozyV0\n"
+    "QTmpLiWHYEXisWgmgv+0XduVZWKc3DhS0aOvfJVIT3WxoV/gPPdV9+OD2Q55Ijt+\n"
+    "102/XOrwzyEUTp2Pn+EBl9wF5Rt71dzNrPsODdgEE9JIpP7tnajlSrPm4XxZj5TR\n"
+    "7d5+A15nyS1u7ZOIpIzgpZqTruJFL9pAaHbEHp/GdvEIIH4uuw/ZUcEnYQoR69LL\n"
+    "U5wyESBzFzuVKhTPqachwSo0Y3OgSv/75SDtxkoBr2unpm75jk4eq+4LFWYx2vn5\n"
+    "asmPFxB8QWsCT+C0wj0gVDKwZMEby5t0GTiBueSmk0XM/g20KncPu3edBK7FXi19\n"
+    "wKLQzN18mmc=\n"
+    "-----END CERTIFICATE-----\n";
+
+static const x509::Clock::time_point kNow = sys_days{2030y / 1 / 1};
+
+static Vec<> DER(StrView pem) {
+  Status status;
+  auto blocks = pem::Decode(pem, status);
+  EXPECT_TRUE(OK(status)) << status.ToStr();
+  return blocks.empty() ? Vec<>() : std::move(blocks[0].der);
+}
+
+struct X509Test : ::testing::Test {
+  Vec<> leaf = DER(kLeafPEM);
+  Vec<> intermediate = DER(kIntermediatePEM);
+  x509::TrustStore trust_store;
+
+  void SetUp() override {
+    Status status;
+    trust_store.LoadPEM(kRootPEM, status);
+    ASSERT_TRUE(OK(status)) << status.ToStr();
+  }
+
+  Vec<Span<>> chain = {leaf, intermediate};
+};
+
+TEST_F(X509Test, Parse) {
+  Status status;
+  auto certificate = x509::Certificate::Parse(leaf, status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_EQ(certificate.public_key.algorithm,
+            x509::PublicKey::Algorithm::kEd25519);
+  EXPECT_EQ(certificate.signature_algorithm,
+            x509::SignatureAlgorithm::kRSA_PKCS1_SHA256);
+  EXPECT_FALSE(certificate.is_ca);
+  EXPECT_EQ(certificate.dns_names,
+            Vec<StrView>({"localhost", "*.example.com"}));
+  // UTCTime & GeneralizedTime
+  EXPECT_EQ(certificate.not_before,
+            sys_days{2026y / 10 / 19} + 2h + 19min + 8s);
+  EXPECT_EQ(certificate.not_after, sys_days{2126y / 9 / 25} + 2h + 19min + 8s);
+
+  EXPECT_TRUE(certificate.MatchesName("localhost"));
+  EXPECT_TRUE(certificate.MatchesName("LocalHost"));
+  EXPECT_TRUE(certificate.MatchesName("www.example.com"));
+  EXPECT_FALSE(certificate.MatchesName("example.com"));
+  EXPECT_FALSE(certificate.MatchesName("a.b.example.com"));
+  EXPECT_FALSE(certificate.MatchesName("localhost.example.org"));
+
+  auto issuer = x509::Certificate::Parse(intermediate, status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_TRUE(issuer.is_ca);
+  EXPECT_EQ(issuer.public_key.algorithm, x509::PublicKey::Algorithm::kRSA);
+  EXPECT_EQ(issuer.subject, certificate.issuer);
+  EXPECT_TRUE(certificate.SignedBy(issuer.public_key));
+  EXPECT_FALSE(issuer.SignedBy(issuer.public_key));
+}
+
+TEST_F(X509Test, Truncated) {
+  Status status;
+  x509::Certificate::Parse(Span<>(leaf).first(leaf.size() - 1), status);
+  EXPECT_FALSE(OK(status));
+}
+
+TEST_F(X509Test, VerifyChain) {
+  Status status;
+  auto verified =
+      x509::VerifyChain(chain, "localhost", trust_store, kNow, status);
+  ASSERT_TRUE(OK(status)) << status.ToStr();
+  EXPECT_EQ(verified.leaf_key.algorithm, x509::PublicKey::Algorithm::kEd25519);
+  EXPECT_EQ(verified.not_before, sys_days{2026y / 10 / 19} + 2h + 19min + 8s);
+
+  // Out of order, with an unrelated certificate.
+  Vec<> root = DER(kRootPEM);
+  Vec<Span<>> shuffled = {leaf, root, intermediate};
+  x509::VerifyChain(shuffled, "www.example.com", trust_store, kNow, status);
+  EXPECT_TRUE(OK(status)) << status.ToStr();
+}
+
+TEST_F(X509Test, Rejected) {
+  {
+    Status status;
+    x509::VerifyChain(chain, "example.org", trust_store, kNow, status);
+    EXPECT_FALSE(OK(status));
+  }
+  {
+    Status status;
+    x509::VerifyChain(chain, "localhost", trust_store,
+                      sys_days{2020y / 1 / 1}, status);
+    EXPECT_FALSE(OK(status));
+  }
+  {
+    Status status;
+    Vec<Span<>> without_intermediate = {leaf};
+    x509::VerifyChain(without_intermediate, "localhost", trust_store, kNow,
+                      status);
+    EXPECT_FALSE(OK(status));
+  }
+  {
+    Status status;
+    x509::TrustStore empty;
+    x509::VerifyChain(chain, "localhost", empty, kNow, status);
+    EXPECT_FALSE(OK(status));
+  }
+  {
+    Status status;
+    leaf[leaf.size() - 1] ^= 1; // signature
+    x509::VerifyChain(chain, "localhost", trust_store, kNow, status);
+    EXPECT_FALSE(OK(status));
+  }
+}
+
+TEST_F(X509Test, ChainCache) {
+  x509::ChainCache cache;
+  for (int i = 0; i < 3; ++i) {
+    Status status;
+    cache.Verify(chain, "localhost", trust_store, kNow, status);
+    EXPECT_TRUE(OK(status)) << status.ToStr();
+  }
+  EXPECT_EQ(cache.misses, 1);
+  EXPECT_EQ(cache.hits, 2);
+
+  // Different name - verified again (& rejected).
+  Status status;
+  cache.Verify(chain, "example.org", trust_store, kNow, status);
+  EXPECT_FALSE(OK(status));
+  EXPECT_EQ(cache.misses, 2);
+
+  // Outside of the validity period.
+  status.Reset();
+  cache.Verify(chain, "localhost", trust_store, sys_days{2200y / 1 / 1},
+               status);
+  EXPECT_FALSE(OK(status));
+  EXPECT_EQ(cache.misses, 3);
+  EXPECT_EQ(cache.hits, 2);
+}